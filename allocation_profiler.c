@@ -0,0 +1,247 @@
+#include "allocation_profiler.h"
+
+#include <execinfo.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compound_procedure.h"
+#include "log.h"
+#include "memory.h"
+#include "root.h"
+#include "type_descriptor.h"
+
+struct AllocationSite {
+  void *site;
+  enum Tag tag;
+  struct AllocationCount count;
+};
+
+struct ProcedureAllocations {
+  Object procedure;
+  struct AllocationCount count;
+};
+
+static u64 sample_interval;
+// The number of objects left to allocate before the next sample.
+static u64 objects_until_sample;
+
+static struct AllocationCount tag_counts[NUM_TAGS];
+
+static struct AllocationSite *sites;
+static u64 num_sites;
+static u64 max_sites;
+
+// The procedures which may still be alive, and the samples of every procedure which has been collected.
+static struct ProcedureAllocations *procedures;
+static u64 num_procedures;
+static u64 max_procedures;
+static struct AllocationCount collected_procedures;
+
+static void Count(struct AllocationCount *count, u64 num_samples);
+// Returns the count for the site (or procedure), adding one if needed. Returns 0 if the table couldn't grow.
+static struct AllocationCount *SiteCount(void *site, enum Tag tag);
+static struct AllocationCount *ProcedureCount(Object procedure);
+// Grow *table of max_entries entries of entry_size bytes, if it is full. Returns false if it couldn't grow.
+static b64 GrowTable(void **table, u64 num_entries, u64 *max_entries, u64 entry_size);
+
+static int CompareSites(const void *a, const void *b);
+static int CompareProcedures(const void *a, const void *b);
+static void PrintCount(struct AllocationCount count);
+static void PrintSite(void *site);
+static const char *TagString(enum Tag tag);
+
+void SetAllocationSampleInterval(u64 new_sample_interval) {
+  sample_interval = new_sample_interval;
+  objects_until_sample = new_sample_interval;
+}
+
+void ResetAllocationProfile() {
+  memset(tag_counts, 0, sizeof(tag_counts));
+  num_sites = 0;
+  num_procedures = 0;
+  memset(&collected_procedures, 0, sizeof(collected_procedures));
+  objects_until_sample = sample_interval;
+}
+
+void ProfileAllocation(enum Tag tag, u64 num_objects, void *site) {
+  if (sample_interval == 0) return;
+  if (num_objects < objects_until_sample) {
+    objects_until_sample -= num_objects;
+    return;
+  }
+  // An allocation larger than the interval stands for every sample it spans.
+  u64 num_objects_past_sample = num_objects - objects_until_sample;
+  u64 num_samples = num_objects_past_sample / sample_interval + 1;
+  objects_until_sample = sample_interval - num_objects_past_sample % sample_interval;
+
+  Count(&tag_counts[tag], num_samples);
+  struct AllocationCount *site_count = SiteCount(site, tag);
+  if (site_count) Count(site_count, num_samples);
+  // Registers have no read barrier, so nothing moves while the new object is uninitialized.
+  // The table is updated at the end of every collection.
+  Object procedure = GetRegister(REGISTER_PROCEDURE);
+  struct AllocationCount *procedure_count = ProcedureCount(procedure);
+  if (procedure_count) Count(procedure_count, num_samples);
+}
+
+struct AllocationCount TagAllocationCount(enum Tag tag) { return tag_counts[tag]; }
+
+struct AllocationCount ProcedureAllocationCount(Object procedure) {
+  for (u64 i = 0; i < num_procedures; ++i) {
+    if (procedures[i].procedure == procedure) return procedures[i].count;
+  }
+  struct AllocationCount none = {0, 0};
+  return none;
+}
+
+void PrintAllocationProfile() {
+  printf("Allocation profile, sampled every %llu objects:\n", (unsigned long long)sample_interval);
+  printf("By tag:\n");
+  for (u64 tag = 0; tag < NUM_TAGS; ++tag) {
+    if (tag_counts[tag].num_samples == 0) continue;
+    PrintCount(tag_counts[tag]);
+    printf("%s\n", TagString(tag));
+  }
+
+  printf("By site:\n");
+  qsort(sites, num_sites, sizeof(struct AllocationSite), CompareSites);
+  for (u64 i = 0; i < num_sites; ++i) {
+    PrintCount(sites[i].count);
+    printf("%s at ", TagString(sites[i].tag));
+    PrintSite(sites[i].site);
+    printf("\n");
+  }
+
+  printf("By procedure:\n");
+  qsort(procedures, num_procedures, sizeof(struct ProcedureAllocations), CompareProcedures);
+  for (u64 i = 0; i < num_procedures; ++i) {
+    Object procedure = procedures[i].procedure;
+    PrintCount(procedures[i].count);
+    if (IsCompoundProcedure(procedure)) {
+      // The environment of a procedure is too large to print.
+      printf("(fn ");
+      PrintObject(ProcedureParameters(procedure));
+      printf(" ...)\n");
+    } else if (IsPrimitiveProcedure(procedure)) {
+      PrintSite((void*)UnboxPrimitiveProcedure(procedure));
+      printf("\n");
+    } else {
+      PrintObject(procedure);
+      printf("\n");
+    }
+  }
+  if (collected_procedures.num_samples > 0) {
+    PrintCount(collected_procedures);
+    printf("<collected procedures>\n");
+  }
+}
+
+void UpdateAllocationProfile() {
+  u64 num_kept = 0;
+  for (u64 i = 0; i < num_procedures; ++i) {
+    struct ProcedureAllocations allocations = procedures[i];
+    allocations.procedure = SurvivingObject(allocations.procedure);
+    if (IsNil(allocations.procedure) && !IsNil(procedures[i].procedure)) {
+      collected_procedures.num_samples += allocations.count.num_samples;
+      collected_procedures.num_objects += allocations.count.num_objects;
+      continue;
+    }
+    // During an incremental collection, samples of a moved procedure are counted in a second entry,
+    // for its new copy. Both now refer to the same procedure, so they're merged.
+    struct AllocationCount *kept_count = 0;
+    for (u64 j = 0; j < num_kept && !kept_count; ++j) {
+      if (procedures[j].procedure == allocations.procedure) kept_count = &procedures[j].count;
+    }
+    if (kept_count) {
+      kept_count->num_samples += allocations.count.num_samples;
+      kept_count->num_objects += allocations.count.num_objects;
+      continue;
+    }
+    procedures[num_kept++] = allocations;
+  }
+  num_procedures = num_kept;
+}
+
+void DestroyAllocationProfile() {
+  free(sites);
+  free(procedures);
+  sites = 0;
+  procedures = 0;
+  max_sites = 0;
+  max_procedures = 0;
+  ResetAllocationProfile();
+}
+
+static void Count(struct AllocationCount *count, u64 num_samples) {
+  count->num_samples += num_samples;
+  count->num_objects += num_samples * sample_interval;
+}
+
+static struct AllocationCount *SiteCount(void *site, enum Tag tag) {
+  for (u64 i = 0; i < num_sites; ++i) {
+    if (sites[i].site == site && sites[i].tag == tag) return &sites[i].count;
+  }
+  if (!GrowTable((void**)&sites, num_sites, &max_sites, sizeof(struct AllocationSite))) return 0;
+  struct AllocationSite *new_site = &sites[num_sites++];
+  new_site->site = site;
+  new_site->tag = tag;
+  memset(&new_site->count, 0, sizeof(new_site->count));
+  return &new_site->count;
+}
+
+static struct AllocationCount *ProcedureCount(Object procedure) {
+  for (u64 i = 0; i < num_procedures; ++i) {
+    if (procedures[i].procedure == procedure) return &procedures[i].count;
+  }
+  if (!GrowTable((void**)&procedures, num_procedures, &max_procedures, sizeof(struct ProcedureAllocations))) return 0;
+  struct ProcedureAllocations *new_procedure = &procedures[num_procedures++];
+  new_procedure->procedure = procedure;
+  memset(&new_procedure->count, 0, sizeof(new_procedure->count));
+  return &new_procedure->count;
+}
+
+static b64 GrowTable(void **table, u64 num_entries, u64 *max_entries, u64 entry_size) {
+  if (num_entries < *max_entries) return 1;
+  u64 new_max_entries = *max_entries ? 2 * *max_entries : 64;
+  void *new_table = realloc(*table, entry_size*new_max_entries);
+  if (!new_table) {
+    LOG_ERROR("Could not grow an allocation profile table to %llu entries. The sample is dropped", new_max_entries);
+    return 0;
+  }
+  *table = new_table;
+  *max_entries = new_max_entries;
+  return 1;
+}
+
+static int CompareSites(const void *a, const void *b) {
+  u64 a_objects = ((const struct AllocationSite*)a)->count.num_objects;
+  u64 b_objects = ((const struct AllocationSite*)b)->count.num_objects;
+  return (a_objects < b_objects) - (a_objects > b_objects);
+}
+
+static int CompareProcedures(const void *a, const void *b) {
+  u64 a_objects = ((const struct ProcedureAllocations*)a)->count.num_objects;
+  u64 b_objects = ((const struct ProcedureAllocations*)b)->count.num_objects;
+  return (a_objects < b_objects) - (a_objects > b_objects);
+}
+
+static void PrintCount(struct AllocationCount count) {
+  printf("  %12llu bytes %8llu samples  ",
+      (unsigned long long)(count.num_objects * sizeof(Object)), (unsigned long long)count.num_samples);
+}
+
+static void PrintSite(void *site) {
+  char **symbols = backtrace_symbols(&site, 1);
+  if (symbols) {
+    printf("%s", symbols[0]);
+    free(symbols);
+  } else {
+    printf("%p", site);
+  }
+}
+
+static const char *TagString(enum Tag tag) {
+  const char *name = TypeDescriptorOf(tag)->name;
+  return name ? name : "other";
+}
@@ -0,0 +1,42 @@
+#ifndef ALLOCATION_PROFILER_H
+#define ALLOCATION_PROFILER_H
+
+#include "tag.h"
+
+// The allocation profiler samples roughly one allocation per sample_interval objects allocated.
+// Each sample records the tag of the allocated object, the C function the allocator returns to,
+// and the procedure in REGISTER_PROCEDURE. A sample stands for the sample_interval objects allocated
+// since the previous sample, so the totals estimate the objects allocated by each site, tag and procedure.
+//
+// Procedures are recorded without being kept alive. Procedures which are collected are counted together.
+// Sites are printed as symbols when the executable exports them (e.g. linked with -rdynamic),
+// and as addresses otherwise.
+
+// Begin sampling every sample_interval objects. 0 stops sampling. The profile is kept.
+void SetAllocationSampleInterval(u64 sample_interval);
+// Forget every sample.
+void ResetAllocationProfile();
+
+// Record the allocation of num_objects objects for an object with tag, if it is sampled.
+// Called by each typed allocator, with the address it returns to.
+void ProfileAllocation(enum Tag tag, u64 num_objects, void *site);
+
+struct AllocationCount {
+  u64 num_samples;
+  // The estimated number of objects allocated.
+  u64 num_objects;
+};
+// The samples of every allocation of objects with tag.
+struct AllocationCount TagAllocationCount(enum Tag tag);
+// The samples taken while procedure was in REGISTER_PROCEDURE.
+struct AllocationCount ProcedureAllocationCount(Object procedure);
+
+// Print the estimated bytes and the samples per tag, per site and per procedure, largest first.
+void PrintAllocationProfile();
+
+// Collector internals.
+// Update the recorded procedures, once every reachable object has been moved.
+void UpdateAllocationProfile();
+void DestroyAllocationProfile();
+
+#endif
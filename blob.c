@@ -2,7 +2,6 @@
 
 #include <assert.h>
 #include <stdio.h>
-#include <string.h>
 
 #include "log.h"
 #include "memory.h"
@@ -13,7 +12,7 @@ u64 CeilingU64(u64 numerator, u64 denominator);
 
 u64 AllocateBlob(u64 num_bytes, enum ErrorCode *error) {
   u64 num_objects = NumObjectsPerBlob(num_bytes);
-  EnsureEnoughMemory(num_objects, error);
+  u64 new_reference = AllocateObjects(num_objects, error);
   if (*error) {
     LOG_ERROR("Error allocating blob of size %llu objects: %s",
         num_objects,
@@ -22,10 +21,7 @@ u64 AllocateBlob(u64 num_bytes, enum ErrorCode *error) {
   }
   // [ ..., free.. ]
 
-  u64 new_reference = memory.free;
   memory.the_objects[new_reference] = BoxBlobHeader(num_bytes);
-  memory.free += num_objects;
-  memory.num_objects_allocated += num_objects;
   // [ ..., nBytes, byte0, ..., byteN, pad.., free.. ]
 
   return new_reference;
@@ -35,10 +31,8 @@ u64 MoveBlob(u64 ref) {
   // New: [ ..., free... ]
   // Old: [ ..., nBytes, byte0, ..., byteN, pad.., ] OR
   //      [ ..., <BH new>, ... ]
-  u64 new_reference = memory.free;
-
-  LOG(LOG_MEMORY, "moving from %llu in the_objects to %llu in new_objects\n", ref, new_reference);
-  Object old_header = memory.the_objects[ref];
+  LOG(LOG_MEMORY, "moving from %llu\n", ref);
+  Object old_header = LoadHeader(ref);
   if (IsBrokenHeart(old_header)) {
     // Already been moved
     // Old: [ ..., <BH new>, ... ]
@@ -52,13 +46,10 @@ u64 MoveBlob(u64 ref) {
   u64 num_objects = NumObjectsPerBlob(bytes_in_blob);
   LOG(LOG_MEMORY, "moving blob of size %llu bytes, (%llu objects)\n", bytes_in_blob, num_objects);
 
-  memcpy(&memory.new_objects[memory.free], &memory.the_objects[ref], num_objects*sizeof(Object));
-  memory.free += num_objects;
+  u64 new_reference = MoveObjects(ref, old_header, num_objects);
   // New: [ ..., nBytes, byte0, ..., byteN, pad.., free.. ]
-
-  LOG(LOG_MEMORY, "Leaving a broken heart pointing at %llu in its place\n", new_reference);
-  memory.the_objects[ref] = BoxBrokenHeart(new_reference);
   // Old: [ ..., <BH new>, ... ]
+  LOG(LOG_MEMORY, "Left a broken heart pointing at %llu in its place\n", new_reference);
 
   return new_reference;
 }
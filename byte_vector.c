@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "allocation_profiler.h"
 #include "blob.h"
 #include "log.h"
 #include "memory.h"
@@ -11,11 +12,24 @@
 Object AllocateByteVector(u64 num_bytes, enum ErrorCode *error) {
   u64 new_reference = AllocateBlob(num_bytes, error);
   if (*error) return nil;
+  ProfileAllocation(TAG_BYTE_VECTOR, NumObjectsPerBlob(num_bytes), __builtin_return_address(0));
 
   memset(&memory.the_objects[new_reference + 1], 0, num_bytes);
   return BoxByteVector(new_reference);
 }
 
+Object AllocatePinnedByteVector(u64 num_bytes, enum ErrorCode *error) {
+  u64 new_reference = AllocatePinnableObjects(NumObjectsPerBlob(num_bytes), error);
+  if (*error) return nil;
+  ProfileAllocation(TAG_BYTE_VECTOR, NumObjectsPerBlob(num_bytes), __builtin_return_address(0));
+
+  memory.the_objects[new_reference] = BoxBlobHeader(num_bytes);
+  memset(&memory.the_objects[new_reference + 1], 0, num_bytes);
+  Object byte_vector = BoxByteVector(new_reference);
+  PinObject(byte_vector, error);
+  return byte_vector;
+}
+
 Object MoveByteVector(Object byte_vector) {
   return BoxByteVector(MoveBlob(UnboxReference(byte_vector)));
 }
@@ -39,6 +53,11 @@ void UnsafeByteVectorSet(Object byte_vector, u64 index, u8 value) {
   bytes[index] = value;
 }
 
+u8 *ByteVectorBuffer(Object byte_vector) {
+  assert(IsByteVector(byte_vector));
+  return (u8*)&memory.the_objects[UnboxReference(byte_vector)+1];
+}
+
 void PrintByteVector(Object object) {
   printf("(byte-vector");
   u64 reference = UnboxReference(object);
@@ -9,8 +9,14 @@
 
 // Allocate and access a vector of 8-bit bytes.
 Object AllocateByteVector(u64 num_bytes, enum ErrorCode *error);
+// Allocate a byte vector which is pinned (see memory.h), so its buffer doesn't move until it is unpinned.
+Object AllocatePinnedByteVector(u64 num_bytes, enum ErrorCode *error);
 Object MoveByteVector(Object byte_vector);
 
+// Returns the bytes of byte_vector.
+// The buffer moves when byte_vector is moved, so it may only be held across an allocation if byte_vector is pinned.
+u8 *ByteVectorBuffer(Object byte_vector);
+
 // Returns the number of bytes in byte_vector.
 // Crashes if byte_vector isn't a byte vector.
 s64 UnsafeByteVectorLength(Object byte_vector);
@@ -0,0 +1,765 @@
+#include "bytecode.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "byte_vector.h"
+#include "compound_procedure.h"
+#include "environment.h"
+#include "evaluate.h"
+#include "expression.h"
+#include "jit.h"
+#include "log.h"
+#include "memory.h"
+#include "pair.h"
+#include "record.h"
+#include "root.h"
+#include "string.h"
+#include "symbol_table.h"
+#include "vector.h"
+
+// The slots of code.
+enum CodeSlot {
+  CODE_SOURCE,
+  CODE_PARAMETERS,
+  CODE_VARIABLES,
+  CODE_BYTES,
+  CODE_CONSTANTS,
+  CODE_CELLS,
+  CODE_CALLS,
+  CODE_TRANSLATION,
+  NUM_CODE_SLOTS,
+};
+
+// The largest operand: a constant index, jump target or number of arguments.
+#define MAX_OPERAND 0xffff
+
+static const char *opcode_names[NUM_OPCODES] = {
+  [OP_CONSTANT]      = "constant",
+  [OP_LOOKUP]        = "lookup",
+  [OP_ASSIGN]        = "assign",
+  [OP_DEFINE]        = "define",
+  [OP_LOCAL]         = "local",
+  [OP_SET_LOCAL]     = "set-local",
+  [OP_POP]           = "pop",
+  [OP_JUMP]          = "jump",
+  [OP_JUMP_IF_FALSE] = "jump-if-false",
+  [OP_CLOSURE]       = "closure",
+  [OP_CALL]          = "call",
+  [OP_TAIL_CALL]     = "tail-call",
+  [OP_RETURN]        = "return",
+};
+
+// The code being compiled. The instructions are built outside of the heap, and the constants are consed
+// in reverse onto REGISTER_ARGUMENT_LIST, until FinishCode allocates the code.
+struct Compiler {
+  u8 *bytes;
+  u64 num_bytes;
+  u64 max_bytes;
+  u64 num_constants;
+};
+
+// REGISTER_EXPRESSION (IN) is compiled. In tail position, its value is returned from the code.
+// Uses REGISTER_EXPRESSION, REGISTER_UNEVALUATED and REGISTER_VALUE.
+static void CompileExpression(struct Compiler *compiler, b64 is_tail, enum ErrorCode *error);
+// Compile expression, leaving REGISTER_EXPRESSION as it was.
+static void CompilePart(struct Compiler *compiler, Object expression, b64 is_tail, enum ErrorCode *error);
+// REGISTER_EXPRESSION (IN) is compiled, when it is the special form of the function.
+static void CompileVariable(struct Compiler *compiler, enum ErrorCode *error);
+static void CompileQuoted(struct Compiler *compiler, enum ErrorCode *error);
+static void CompileAssignment(struct Compiler *compiler, enum ErrorCode *error);
+static void CompileDefinition(struct Compiler *compiler, enum ErrorCode *error);
+static void CompileIf(struct Compiler *compiler, b64 is_tail, enum ErrorCode *error);
+static void CompileLambda(struct Compiler *compiler, enum ErrorCode *error);
+static void CompileApplication(struct Compiler *compiler, b64 is_tail, enum ErrorCode *error);
+// Compile each expression of sequence, discarding the values of all but the last.
+// Fails with malformed_error if sequence isn't a proper list.
+static void CompileSequence(struct Compiler *compiler, Object sequence, b64 is_tail,
+    enum ErrorCode malformed_error, enum ErrorCode *error);
+
+static void Emit(struct Compiler *compiler, u8 byte, enum ErrorCode *error);
+static void EmitOperand(struct Compiler *compiler, u64 operand, enum ErrorCode *error);
+// Emit opcode with the operands depth and index of a lexical address.
+static void EmitLocalInstruction(struct Compiler *compiler, enum Opcode opcode, u64 depth, u64 index,
+    enum ErrorCode *error);
+// Emit opcode with the index of the constant in REGISTER_VALUE, adding it to the constants if it isn't one already.
+static void EmitConstantInstruction(struct Compiler *compiler, enum Opcode opcode, enum ErrorCode *error);
+// Set the target of the jump whose operand is at bytes[index] to the next instruction.
+static void PatchJump(struct Compiler *compiler, u64 index, enum ErrorCode *error);
+// REGISTER_EXPRESSION (IN) the source of the code
+// REGISTER_UNEVALUATED (IN) the parameters of the code's procedure
+// REGISTER_VALUE (IN) the variables of the code's frame
+// REGISTER_ARGUMENT_LIST (IN) the constants in reverse
+// REGISTER_VALUE (OUT) holds the code
+static void FinishCode(struct Compiler *compiler, enum ErrorCode *error);
+
+// Count a call of code, and translate it into machine code once it is hot (see jit.h).
+static void CountCall(Object code);
+// The translation of code, or -1 if it hasn't been translated.
+static s64 CodeTranslation(Object code);
+
+// Apply the procedure below the top num_arguments objects of the stack to them, popping both.
+// A primitive or record procedure pushes its result. A compound procedure is entered instead:
+// its code and environment replace REGISTER_EXPRESSION and REGISTER_ENVIRONMENT, and *pc is 0.
+// Unless is_tail, a frame to return to is pushed first. Returns true if a compound procedure was entered.
+// A compound procedure made by the analyzing evaluator is applied by it, and pushes its result.
+// On error, the procedure and its arguments are popped, along with anything pushed since.
+static b64 Apply(u64 num_arguments, b64 is_tail, u64 *pc, enum ErrorCode *error);
+// For Apply: each pops the procedure and its arguments, or fails leaving the stack for Apply to restore.
+static void ApplyRecordProcedure(u64 num_arguments, enum ErrorCode *error);
+// Apply a primitive, or a compound procedure made by the analyzing evaluator, to a list of the arguments.
+static void ApplyToArgumentList(u64 num_arguments, enum ErrorCode *error);
+// Enter the compound procedure below the top num_arguments objects of the stack, in a new frame of its arguments.
+static b64 EnterProcedure(u64 num_arguments, b64 is_tail, u64 *pc, enum ErrorCode *error);
+
+void Compile(enum ErrorCode *error) {
+  u64 stack_size = StackSize();
+  struct Compiler compiler = {0};
+  SetArgumentList(nil);
+  Save(REGISTER_EXPRESSION, error);
+  if (!*error) CompileExpression(&compiler, 1, error);
+  if (!*error) {
+    Restore(REGISTER_EXPRESSION);
+    SetUnevaluated(nil);
+    SetValue(nil);
+    FinishCode(&compiler, error);
+  }
+  free(compiler.bytes);
+  // The compiler saves registers as it goes, and an error leaves them on the stack.
+  SetStackSize(stack_size);
+  SetArgumentList(nil);
+  SetScope(nil);
+  if (*error) SetValue(nil);
+}
+
+static void CompileExpression(struct Compiler *compiler, b64 is_tail, enum ErrorCode *error) {
+  Object expression = GetExpression();
+  if (IsSelfEvaluating(expression)) {
+    SetValue(expression);
+    EmitConstantInstruction(compiler, OP_CONSTANT, error);
+  }
+  else if (IsVariable(expression))    CompileVariable(compiler, error);
+  else if (IsQuoted(expression))      CompileQuoted(compiler, error);
+  else if (IsAssignment(expression))  CompileAssignment(compiler, error);
+  else if (IsDefinition(expression))  CompileDefinition(compiler, error);
+  else if (IsIf(expression))          { CompileIf(compiler, is_tail, error); return; }
+  else if (IsLambda(expression))      CompileLambda(compiler, error);
+  else if (IsBegin(expression)) {
+    Object sequence;
+    ExtractBegin(expression, &sequence, error);
+    if (*error) return;
+    CompileSequence(compiler, sequence, is_tail, ERROR_EVALUATE_BEGIN_MALFORMED, error);
+    return;
+  }
+  else if (IsApplication(expression)) { CompileApplication(compiler, is_tail, error); return; }
+  else {
+    LOG_ERROR("Unknown Expression");
+    LOG_OP(LOG_EVALUATE, PrintlnObject(expression));
+    *error = ERROR_EVALUATE_UNKNOWN_EXPRESSION;
+  }
+  if (!*error && is_tail) Emit(compiler, OP_RETURN, error);
+}
+
+static void CompilePart(struct Compiler *compiler, Object expression, b64 is_tail, enum ErrorCode *error) {
+  Save(REGISTER_EXPRESSION, error);
+  if (*error) return;
+  SetExpression(expression);
+  CompileExpression(compiler, is_tail, error);
+  if (*error) return;
+  Restore(REGISTER_EXPRESSION);
+}
+
+static void CompileVariable(struct Compiler *compiler, enum ErrorCode *error) {
+  u64 depth, index;
+  if (FindLexicalAddress(GetExpression(), GetScope(), &depth, &index)) {
+    EmitLocalInstruction(compiler, OP_LOCAL, depth, index, error);
+    return;
+  }
+  SetValue(GetExpression());
+  EmitConstantInstruction(compiler, OP_LOOKUP, error);
+}
+
+static void CompileQuoted(struct Compiler *compiler, enum ErrorCode *error) {
+  Object quoted_expression;
+  ExtractQuoted(GetExpression(), &quoted_expression, error);
+  if (*error) return;
+  SetValue(quoted_expression);
+  EmitConstantInstruction(compiler, OP_CONSTANT, error);
+}
+
+static void CompileAssignment(struct Compiler *compiler, enum ErrorCode *error) {
+  Object variable, value;
+  ExtractAssignmentArguments(GetExpression(), &variable, &value, error);
+  if (*error) return;
+  CompilePart(compiler, value, 0, error);
+  if (*error) return;
+  ExtractAssignmentArguments(GetExpression(), &variable, &value, error);
+  u64 depth, index;
+  if (FindLexicalAddress(variable, GetScope(), &depth, &index)) {
+    EmitLocalInstruction(compiler, OP_SET_LOCAL, depth, index, error);
+    if (*error) return;
+    // Return the symbol 'ok as the result of an assignment
+    SetValue(FindSymbol("ok"));
+    EmitConstantInstruction(compiler, OP_CONSTANT, error);
+    return;
+  }
+  SetValue(variable);
+  EmitConstantInstruction(compiler, OP_ASSIGN, error);
+}
+
+static void CompileDefinition(struct Compiler *compiler, enum ErrorCode *error) {
+  Object variable, value;
+  ExtractDefinitionArguments(GetExpression(), &variable, &value, error);
+  if (*error) return;
+  CompilePart(compiler, value, 0, error);
+  if (*error) return;
+  ExtractDefinitionArguments(GetExpression(), &variable, &value, error);
+  SetValue(variable);
+  // A definition in the body of a procedure is of a variable of its frame.
+  u64 depth, index;
+  if (FindLexicalAddress(variable, GetScope(), &depth, &index)) {
+    EmitLocalInstruction(compiler, OP_SET_LOCAL, depth, index, error);
+    if (*error) return;
+    // Return the symbol name as the result of the definition.
+    EmitConstantInstruction(compiler, OP_CONSTANT, error);
+    return;
+  }
+  EmitConstantInstruction(compiler, OP_DEFINE, error);
+}
+
+static void CompileIf(struct Compiler *compiler, b64 is_tail, enum ErrorCode *error) {
+  Object predicate, consequent, alternative;
+  ExtractIfPredicate(GetExpression(), &predicate, error);
+  if (*error) return;
+  ExtractIfAlternatives(GetExpression(), &consequent, &alternative, error);
+  if (*error) return;
+
+  CompilePart(compiler, predicate, 0, error);
+  if (*error) return;
+  Emit(compiler, OP_JUMP_IF_FALSE, error);
+  if (*error) return;
+  u64 alternative_jump = compiler->num_bytes;
+  EmitOperand(compiler, 0, error);
+  if (*error) return;
+
+  ExtractIfAlternatives(GetExpression(), &consequent, &alternative, error);
+  CompilePart(compiler, consequent, is_tail, error);
+  if (*error) return;
+  // A consequent in tail position returns, so it doesn't need to jump past the alternative.
+  u64 end_jump = 0;
+  if (!is_tail) {
+    Emit(compiler, OP_JUMP, error);
+    if (*error) return;
+    end_jump = compiler->num_bytes;
+    EmitOperand(compiler, 0, error);
+    if (*error) return;
+  }
+
+  PatchJump(compiler, alternative_jump, error);
+  if (*error) return;
+  ExtractIfAlternatives(GetExpression(), &consequent, &alternative, error);
+  CompilePart(compiler, alternative, is_tail, error);
+  if (*error) return;
+  if (!is_tail) PatchJump(compiler, end_jump, error);
+}
+
+static void CompileLambda(struct Compiler *compiler, enum ErrorCode *error) {
+  Object parameters, body;
+  ExtractLambdaArguments(GetExpression(), &parameters, &body, error);
+  if (*error) return;
+
+  // The body is compiled into code of its own, with its own constants, in the scope of the procedure's frame.
+  struct Compiler body_compiler = {0};
+  Save(REGISTER_ARGUMENT_LIST, error);
+  if (!*error) Save(REGISTER_EXPRESSION, error);
+  if (!*error) Save(REGISTER_SCOPE, error);
+  if (!*error) ExtendScope(error);
+  if (!*error) {
+    SetArgumentList(nil);
+    ExtractLambdaArguments(GetExpression(), &parameters, &body, error);
+    CompileSequence(&body_compiler, body, 1, ERROR_EVALUATE_LAMBDA_BODY_MALFORMED, error);
+  }
+  if (!*error) {
+    SetValue(First(GetScope()));
+    Restore(REGISTER_SCOPE);
+    Restore(REGISTER_EXPRESSION);
+    ExtractLambdaArguments(GetExpression(), &parameters, &body, error);
+    SetUnevaluated(parameters);
+    SetExpression(body);
+    FinishCode(&body_compiler, error);
+  }
+  free(body_compiler.bytes);
+  if (*error) return;
+  Restore(REGISTER_ARGUMENT_LIST);
+
+  // Like the analyzed bodies of the analyzing evaluator, the body of a procedure is a list,
+  // so that the procedure can be applied by either engine. REFERENCES INVALIDATED
+  Object body_list = AllocatePair(error);
+  if (*error) return;
+  SetCar(body_list, GetValue());
+  SetValue(body_list);
+  EmitConstantInstruction(compiler, OP_CLOSURE, error);
+}
+
+static void CompileApplication(struct Compiler *compiler, b64 is_tail, enum ErrorCode *error) {
+  CompilePart(compiler, Operator(GetExpression()), 0, error);
+  if (*error) return;
+
+  u64 num_operands = 0;
+  for (SetUnevaluated(Operands(GetExpression())); IsPair(GetUnevaluated());
+      SetUnevaluated(RestOperands(GetUnevaluated())), ++num_operands) {
+    Save(REGISTER_UNEVALUATED, error);
+    if (*error) return;
+    CompilePart(compiler, FirstOperand(GetUnevaluated()), 0, error);
+    if (*error) return;
+    Restore(REGISTER_UNEVALUATED);
+  }
+  if (!HasNoOperands(GetUnevaluated())) {
+    *error = ERROR_EVALUATE_APPLICATION_DOTTED_LIST;
+    return;
+  }
+
+  Emit(compiler, is_tail ? OP_TAIL_CALL : OP_CALL, error);
+  if (*error) return;
+  EmitOperand(compiler, num_operands, error);
+  // A tail call of a compound procedure never returns here, but a primitive's result is returned.
+  if (!*error && is_tail) Emit(compiler, OP_RETURN, error);
+}
+
+static void CompileSequence(struct Compiler *compiler, Object sequence, b64 is_tail,
+    enum ErrorCode malformed_error, enum ErrorCode *error) {
+  if (!IsPair(sequence)) {
+    *error = IsNil(sequence) ? ERROR_EVALUATE_SEQUENCE_EMPTY : malformed_error;
+    return;
+  }
+  for (SetUnevaluated(sequence); IsPair(GetUnevaluated()); SetUnevaluated(RestExpressions(GetUnevaluated()))) {
+    b64 is_last = IsLastExpression(GetUnevaluated());
+    Save(REGISTER_UNEVALUATED, error);
+    if (*error) return;
+    CompilePart(compiler, FirstExpression(GetUnevaluated()), is_last && is_tail, error);
+    if (*error) return;
+    Restore(REGISTER_UNEVALUATED);
+    if (!is_last) Emit(compiler, OP_POP, error);
+    if (*error) return;
+  }
+  if (!IsNil(GetUnevaluated())) *error = malformed_error;
+}
+
+static void Emit(struct Compiler *compiler, u8 byte, enum ErrorCode *error) {
+  if (compiler->num_bytes == compiler->max_bytes) {
+    u64 max_bytes = compiler->max_bytes ? 2*compiler->max_bytes : 64;
+    u8 *bytes = realloc(compiler->bytes, max_bytes);
+    if (!bytes) {
+      LOG_ERROR("Could not grow the code to %llu bytes", max_bytes);
+      *error = ERROR_COULD_NOT_ALLOCATE_HEAP_BUFFER;
+      return;
+    }
+    compiler->bytes = bytes;
+    compiler->max_bytes = max_bytes;
+  }
+  compiler->bytes[compiler->num_bytes++] = byte;
+}
+
+static void EmitOperand(struct Compiler *compiler, u64 operand, enum ErrorCode *error) {
+  if (operand > MAX_OPERAND) {
+    LOG_ERROR("The operand %llu is larger than %d", operand, MAX_OPERAND);
+    *error = ERROR_COMPILE_OPERAND_TOO_LARGE;
+    return;
+  }
+  Emit(compiler, operand & 0xff, error);
+  if (*error) return;
+  Emit(compiler, operand >> 8, error);
+}
+
+static void EmitLocalInstruction(struct Compiler *compiler, enum Opcode opcode, u64 depth, u64 index,
+    enum ErrorCode *error) {
+  Emit(compiler, opcode, error);
+  if (*error) return;
+  EmitOperand(compiler, depth, error);
+  if (*error) return;
+  EmitOperand(compiler, index, error);
+}
+
+static void EmitConstantInstruction(struct Compiler *compiler, enum Opcode opcode, enum ErrorCode *error) {
+  u64 index = compiler->num_constants;
+  u64 constant_index = compiler->num_constants;
+  for (Object constants = GetArgumentList(); IsPair(constants); constants = Cdr(constants)) {
+    --constant_index;
+    if (Car(constants) == GetValue()) {
+      index = constant_index;
+      break;
+    }
+  }
+  if (index == compiler->num_constants) {
+    // REFERENCES INVALIDATED
+    Object pair = AllocatePair(error);
+    if (*error) return;
+    SetCar(pair, GetValue());
+    SetCdr(pair, GetArgumentList());
+    SetArgumentList(pair);
+    ++compiler->num_constants;
+  }
+  Emit(compiler, opcode, error);
+  if (*error) return;
+  EmitOperand(compiler, index, error);
+}
+
+static void PatchJump(struct Compiler *compiler, u64 index, enum ErrorCode *error) {
+  u64 target = compiler->num_bytes;
+  if (target > MAX_OPERAND) {
+    LOG_ERROR("The jump target %llu is larger than %d", target, MAX_OPERAND);
+    *error = ERROR_COMPILE_OPERAND_TOO_LARGE;
+    return;
+  }
+  compiler->bytes[index] = target & 0xff;
+  compiler->bytes[index + 1] = target >> 8;
+}
+
+static void FinishCode(struct Compiler *compiler, enum ErrorCode *error) {
+  // REFERENCES INVALIDATED
+  Object code = AllocateRecord(NUM_CODE_SLOTS, error);
+  if (*error) return;
+  SetRecordType(code, BoxEvaluateFunction(EvaluateBytecode));
+  SetRecordSlot(code, CODE_SOURCE, GetExpression());
+  SetRecordSlot(code, CODE_PARAMETERS, GetUnevaluated());
+  SetRecordSlot(code, CODE_VARIABLES, GetValue());
+  SetRecordSlot(code, CODE_CALLS, BoxFixnum(0));
+  SetExpression(code);
+
+  Object bytes = AllocateByteVector(compiler->num_bytes, error);
+  if (*error) return;
+  memcpy(ByteVectorBuffer(bytes), compiler->bytes, compiler->num_bytes);
+  SetRecordSlot(GetExpression(), CODE_BYTES, bytes);
+
+  Object constants = AllocateVector(compiler->num_constants, error);
+  if (*error) return;
+  u64 index = compiler->num_constants;
+  for (Object reversed = GetArgumentList(); IsPair(reversed); reversed = Cdr(reversed))
+    UnsafeVectorSet(constants, --index, Car(reversed));
+  SetRecordSlot(GetExpression(), CODE_CONSTANTS, constants);
+
+  Object cells = AllocateVector(compiler->num_constants, error);
+  if (*error) return;
+  SetRecordSlot(GetExpression(), CODE_CELLS, cells);
+
+  LOG(LOG_EVALUATE, "Compiled:\n");
+  LOG_OP(LOG_EVALUATE, PrintBytecode(GetExpression()));
+  SetValue(GetExpression());
+}
+
+b64 IsBytecode(Object object) {
+  return IsRecord(object) && RecordType(object) == BoxEvaluateFunction(EvaluateBytecode);
+}
+
+Object CodeSource(Object code) { return RecordSlot(code, CODE_SOURCE); }
+Object CodeParameters(Object code) { return RecordSlot(code, CODE_PARAMETERS); }
+Object CodeVariables(Object code) { return RecordSlot(code, CODE_VARIABLES); }
+u8 *CodeBytes(Object code) { return ByteVectorBuffer(RecordSlot(code, CODE_BYTES)); }
+u64 CodeNumBytes(Object code) { return UnsafeByteVectorLength(RecordSlot(code, CODE_BYTES)); }
+Object CodeConstant(Object code, u64 index) { return UnsafeVectorRef(RecordSlot(code, CODE_CONSTANTS), index); }
+
+Object CodeGlobalCell(Object code, u64 index, Object environment) {
+  Object cell = UnsafeVectorRef(RecordSlot(code, CODE_CELLS), index);
+  if (!IsNil(cell)) return cell;
+  cell = LookupGlobalCell(CodeConstant(code, index), environment);
+  if (!IsNil(cell)) UnsafeVectorSet(RecordSlot(code, CODE_CELLS), index, cell);
+  return cell;
+}
+
+static s64 CodeTranslation(Object code) {
+  Object translation = RecordSlot(code, CODE_TRANSLATION);
+  return IsNil(translation) ? -1 : UnboxFixnum(translation);
+}
+
+static void CountCall(Object code) {
+  if (!IsJitEnabled() || !IsNil(RecordSlot(code, CODE_TRANSLATION))) return;
+  u64 num_calls = UnboxFixnum(RecordSlot(code, CODE_CALLS)) + 1;
+  SetRecordSlot(code, CODE_CALLS, BoxFixnum(num_calls));
+  if (num_calls < JitThreshold()) return;
+  s64 translation = TranslateBytecode(code);
+  // Code which can't be translated isn't tried again.
+  SetRecordSlot(code, CODE_TRANSLATION, BoxFixnum(translation));
+}
+
+u64 ReadOperand(const u8 *bytes, u64 *pc) {
+  u64 operand = bytes[*pc] | (u64)bytes[*pc + 1] << 8;
+  *pc += 2;
+  return operand;
+}
+
+// For RunBytecode: on error, the stack is left as it was found.
+#define CHECK(op)  do { (op); if (*error) { SetStackSize(stack_size); return nil; } } while(0)
+
+Object RunBytecode(enum ErrorCode *error) {
+  u64 stack_size = StackSize();
+  // The number of frames pushed by calls since the machine started.
+  u64 num_frames = 0;
+  u64 pc = 0;
+  // Allocation may move the bytes, so they are found again after anything that allocates.
+  const u8 *bytes = CodeBytes(GetExpression());
+  s64 translation = CodeTranslation(GetExpression());
+  for (;;) {
+    // Machine code runs what it can, and leaves the rest to the machine.
+    if (translation >= 0) pc = RunTranslation(translation, pc);
+    enum Opcode opcode = bytes[pc++];
+    LOG(LOG_EVALUATE, "%llu: %s\n", pc - 1, opcode_names[opcode]);
+    switch (opcode) {
+      case OP_CONSTANT:
+        CHECK(Push(CodeConstant(GetExpression(), ReadOperand(bytes, &pc)), error));
+        break;
+      case OP_LOOKUP: {
+        u64 index = ReadOperand(bytes, &pc);
+        Object cell = CodeGlobalCell(GetExpression(), index, GetEnvironment());
+        if (IsNil(cell)) {
+          LOG_ERROR("Could not find %s in environment", StringCharacterBuffer(CodeConstant(GetExpression(), index)));
+          CHECK(*error = ERROR_EVALUATE_UNBOUND_VARIABLE);
+        }
+        CHECK(Push(CellValue(cell), error));
+        break;
+      }
+      case OP_ASSIGN: {
+        Object variable = CodeConstant(GetExpression(), ReadOperand(bytes, &pc));
+        CHECK(SetVariableValue(variable, Pop(), GetEnvironment(), error));
+        // Return the symbol 'ok as the result of an assignment
+        CHECK(Push(FindSymbol("ok"), error));
+        break;
+      }
+      case OP_DEFINE:
+        SetUnevaluated(CodeConstant(GetExpression(), ReadOperand(bytes, &pc)));
+        SetValue(Pop());
+        CHECK(DefineVariable(error));
+        bytes = CodeBytes(GetExpression());
+        // Return the symbol name as the result of the definition.
+        CHECK(Push(GetUnevaluated(), error));
+        break;
+      case OP_LOCAL: {
+        u64 depth = ReadOperand(bytes, &pc);
+        u64 index = ReadOperand(bytes, &pc);
+        CHECK(Push(LookupLexicalAddress(depth, index, GetEnvironment()), error));
+        break;
+      }
+      case OP_SET_LOCAL: {
+        u64 depth = ReadOperand(bytes, &pc);
+        u64 index = ReadOperand(bytes, &pc);
+        SetLexicalAddress(depth, index, Pop(), GetEnvironment());
+        break;
+      }
+      case OP_POP:
+        Pop();
+        break;
+      case OP_JUMP:
+        pc = ReadOperand(bytes, &pc);
+        break;
+      case OP_JUMP_IF_FALSE: {
+        u64 target = ReadOperand(bytes, &pc);
+        if (!IsTruthy(Pop())) pc = target;
+        break;
+      }
+      case OP_CLOSURE: {
+        u64 index = ReadOperand(bytes, &pc);
+        // REFERENCES INVALIDATED
+        Object procedure;
+        CHECK(procedure = AllocateCompoundProcedure(error));
+        bytes = CodeBytes(GetExpression());
+        Object body = CodeConstant(GetExpression(), index);
+        SetProcedureEnvironment(procedure, GetEnvironment());
+        SetProcedureParameters(procedure, CodeParameters(First(body)));
+        SetProcedureBody(procedure, body);
+        SetProcedureVariables(procedure, CodeVariables(First(body)));
+        CHECK(Push(procedure, error));
+        break;
+      }
+      case OP_CALL:
+      case OP_TAIL_CALL: {
+        u64 num_arguments = ReadOperand(bytes, &pc);
+        b64 is_tail = opcode == OP_TAIL_CALL;
+        b64 entered;
+        CHECK(entered = Apply(num_arguments, is_tail, &pc, error));
+        if (entered && !is_tail) ++num_frames;
+        bytes = CodeBytes(GetExpression());
+        translation = CodeTranslation(GetExpression());
+        break;
+      }
+      case OP_RETURN: {
+        Object value = Pop();
+        if (num_frames == 0) {
+          assert(StackSize() == stack_size);
+          return value;
+        }
+        --num_frames;
+        SetEnvironment(Pop());
+        pc = UnboxFixnum(Pop());
+        SetExpression(Pop());
+        bytes = CodeBytes(GetExpression());
+        translation = CodeTranslation(GetExpression());
+        CHECK(Push(value, error));
+        break;
+      }
+      default:
+        assert(!"Error: unknown opcode");
+        return nil;
+    }
+  }
+}
+
+#undef CHECK
+
+static b64 Apply(u64 num_arguments, b64 is_tail, u64 *pc, enum ErrorCode *error) {
+  u64 stack_size = StackSize() - num_arguments - 1;
+  Object procedure = StackRef(num_arguments);
+  b64 entered = 0;
+  if (IsRecordProcedure(procedure)) ApplyRecordProcedure(num_arguments, error);
+  else if (IsCompoundProcedure(procedure) && IsBytecode(First(ProcedureBody(procedure))))
+    entered = EnterProcedure(num_arguments, is_tail, pc, error);
+  else if (IsCompoundProcedure(procedure) || IsPrimitiveProcedure(procedure))
+    ApplyToArgumentList(num_arguments, error);
+  else *error = ERROR_EVALUATE_UNKNOWN_PROCEDURE_TYPE;
+  if (*error) {
+    SetStackSize(stack_size);
+    return 0;
+  }
+  return entered;
+}
+
+static void ApplyToArgumentList(u64 num_arguments, enum ErrorCode *error) {
+  // The arguments are popped into an argument list. REFERENCES INVALIDATED
+  ReserveObjects(2*num_arguments, error);
+  if (*error) return;
+  SetArgumentList(nil);
+  for (u64 i = 0; i < num_arguments; ++i) {
+    Object pair = AllocateReservedPair();
+    SetCar(pair, Pop());
+    SetCdr(pair, GetArgumentList());
+    SetArgumentList(pair);
+  }
+  Object procedure = Pop();
+
+  // The procedure may evaluate, which uses the registers, so the code and environment are kept on the stack.
+  Push(GetExpression(), error);
+  if (*error) return;
+  Push(GetEnvironment(), error);
+  if (*error) return;
+  Object value = IsPrimitiveProcedure(procedure)
+    ? UnboxPrimitiveProcedure(procedure)(GetArgumentList(), error)
+    : ApplyCompoundProcedure(procedure, GetArgumentList(), error);
+  SetEnvironment(Pop());
+  SetExpression(Pop());
+  if (*error) return;
+  Push(value, error);
+}
+
+static b64 EnterProcedure(u64 num_arguments, b64 is_tail, u64 *pc, enum ErrorCode *error) {
+  if (num_arguments != CountFrameVariables(ProcedureParameters(StackRef(num_arguments)))) {
+    *error = ERROR_EVALUATE_ARITY_MISMATCH;
+    return 0;
+  }
+  // REFERENCES INVALIDATED
+  Object frame = AllocateFrame(CountFrameVariables(ProcedureVariables(StackRef(num_arguments))), error);
+  if (*error) return 0;
+  Object procedure = StackRef(num_arguments);
+  SetFrameEnclosingEnvironment(frame, ProcedureEnvironment(procedure));
+  SetFrameVariableList(frame, ProcedureVariables(procedure));
+  for (u64 i = 0; i < num_arguments; ++i) SetFrameVariable(frame, i, StackRef(num_arguments - 1 - i));
+  SetStackSize(StackSize() - num_arguments - 1);
+
+  if (!is_tail) {
+    Push(GetExpression(), error);
+    if (!*error) Push(BoxFixnum(*pc), error);
+    if (!*error) Push(GetEnvironment(), error);
+    if (*error) return 0;
+  }
+  SetExpression(First(ProcedureBody(procedure)));
+  CountCall(GetExpression());
+  SetEnvironment(frame);
+  *pc = 0;
+  return 1;
+}
+
+static void ApplyRecordProcedure(u64 num_arguments, enum ErrorCode *error) {
+  Object procedure = StackRef(num_arguments);
+  if (num_arguments != RecordProcedureArity(procedure)) {
+    *error = ERROR_EVALUATE_ARITY_MISMATCH;
+    return;
+  }
+
+  Object result;
+  switch (RecordProcedureKind(procedure)) {
+    case RECORD_KIND_CONSTRUCTOR:
+      // REFERENCES INVALIDATED
+      result = AllocateRecord(num_arguments, error);
+      if (*error) return;
+      SetRecordType(result, RecordProcedureType(StackRef(num_arguments)));
+      for (u64 i = 0; i < num_arguments; ++i) SetRecordSlot(result, i, StackRef(num_arguments - 1 - i));
+      break;
+    case RECORD_KIND_PREDICATE:
+      result = BoxBoolean(IsRecordOfType(StackRef(0), RecordProcedureType(procedure)));
+      break;
+    case RECORD_KIND_ACCESSOR:
+      if (!IsRecordOfType(StackRef(0), RecordProcedureType(procedure))) {
+        *error = ERROR_EVALUATE_INVALID_ARGUMENT_TYPE;
+        return;
+      }
+      result = RecordSlot(StackRef(0), RecordProcedureField(procedure));
+      break;
+    case RECORD_KIND_MODIFIER:
+      if (!IsRecordOfType(StackRef(1), RecordProcedureType(procedure))) {
+        *error = ERROR_EVALUATE_INVALID_ARGUMENT_TYPE;
+        return;
+      }
+      SetRecordSlot(StackRef(1), RecordProcedureField(procedure), StackRef(0));
+      result = FindSymbol("ok");
+      break;
+    default:
+      // A record type isn't applicable.
+      *error = ERROR_EVALUATE_UNKNOWN_PROCEDURE_TYPE;
+      return;
+  }
+  SetStackSize(StackSize() - num_arguments - 1);
+  Push(result, error);
+}
+
+void PrintBytecode(Object code) {
+  const u8 *bytes = CodeBytes(code);
+  u64 num_bytes = CodeNumBytes(code);
+  printf("code ");
+  PrintlnObject(CodeSource(code));
+  for (u64 pc = 0; pc < num_bytes;) {
+    enum Opcode opcode = bytes[pc];
+    printf("%4llu %s", (unsigned long long)pc++, opcode_names[opcode]);
+    switch (opcode) {
+      case OP_CONSTANT:
+      case OP_LOOKUP:
+      case OP_ASSIGN:
+      case OP_DEFINE:
+      case OP_CLOSURE:
+        printf(" ");
+        PrintObject(CodeConstant(code, ReadOperand(bytes, &pc)));
+        break;
+      case OP_LOCAL:
+      case OP_SET_LOCAL: {
+        u64 depth = ReadOperand(bytes, &pc);
+        printf(" %llu %llu", (unsigned long long)depth, (unsigned long long)ReadOperand(bytes, &pc));
+        break;
+      }
+      case OP_JUMP:
+      case OP_JUMP_IF_FALSE:
+      case OP_CALL:
+      case OP_TAIL_CALL:
+        printf(" %llu", (unsigned long long)ReadOperand(bytes, &pc));
+        break;
+      case OP_POP:
+      case OP_RETURN:
+      case NUM_OPCODES:
+        break;
+    }
+    printf("\n");
+  }
+
+  Object constants = RecordSlot(code, CODE_CONSTANTS);
+  for (u64 i = 0; i < UnsafeVectorLength(constants); ++i) {
+    Object body = UnsafeVectorRef(constants, i);
+    if (IsPair(body) && IsBytecode(First(body))) PrintBytecode(First(body));
+  }
+}
@@ -0,0 +1,82 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "error.h"
+#include "tag.h"
+
+// The bytecode engine compiles an expression into bytecode, which is run by a stack machine.
+// It is an alternative to analyzing and evaluating expressions (see evaluate.c), selected with SetEngine.
+//
+// Code is a record whose type is EvaluateBytecode (see record.h), so that it prints as its source:
+//   [ ..., 9, EvaluateBytecode, source, parameters, variables, bytes, constants, cells, calls, translation, ... ]
+//   parameters: the parameters of the procedure, when the code is the body of one.
+//   variables: the variables of the procedure's frame: the parameters, followed by the variables
+//     defined in the body (see environment.h).
+//   bytes: a byte vector of instructions. Each is an opcode followed by its 16-bit little-endian operands.
+//   constants: a vector of the constants, variables and procedure bodies referenced by the instructions.
+//   cells: a vector of the cells of the global variables in constants, cached as they're looked up (see environment.h).
+//   calls: the number of times the code has been called, counted while the JIT is enabled (see jit.h).
+//   translation: the code's translation into machine code, or nil if it hasn't been translated.
+//
+// The machine keeps its operands on the control stack. A call pushes a frame of the caller's code,
+// program counter and environment, which the callee's OP_RETURN pops. Calls in tail position don't push a frame.
+// The callee's environment is a new frame of its arguments, made straight from the stack.
+// A procedure made by the bytecode engine has the body (code), and is applied by either engine.
+// The machine applies procedures made by the analyzing evaluator through it, like primitives (see evaluate.h).
+
+enum Opcode {
+  // Push constants[k].
+  OP_CONSTANT,
+  // Push the value of the global variable constants[k].
+  OP_LOOKUP,
+  // Pop a value, and assign it to the global variable constants[k]. Push ok.
+  OP_ASSIGN,
+  // Pop a value, and define the global variable constants[k] as it. Push the variable.
+  OP_DEFINE,
+  // Push the value of the local variable at the lexical address (depth, index) (see environment.h).
+  OP_LOCAL,
+  // Pop a value, and assign it to the local variable at (depth, index).
+  OP_SET_LOCAL,
+  // Pop a value.
+  OP_POP,
+  // Jump to target.
+  OP_JUMP,
+  // Pop a value, and jump to target if it is false.
+  OP_JUMP_IF_FALSE,
+  // Push a procedure of the body constants[k] in the current environment.
+  OP_CLOSURE,
+  // Pop n arguments and a procedure, and push the result of applying the procedure to them.
+  OP_CALL,
+  // Like OP_CALL, but returns the result of the application from the current procedure.
+  OP_TAIL_CALL,
+  // Pop a value, and return it from the current procedure.
+  OP_RETURN,
+  NUM_OPCODES,
+};
+
+// REGISTER_EXPRESSION (IN) is compiled
+// REGISTER_SCOPE (IN) the scope it's compiled in (see environment.h), which is nil afterwards
+// REGISTER_VALUE (OUT) holds the code
+// Uses REGISTER_UNEVALUATED and REGISTER_ARGUMENT_LIST.
+void Compile(enum ErrorCode *error);
+// Run the code in REGISTER_EXPRESSION in REGISTER_ENVIRONMENT, and return its value.
+// Uses REGISTER_UNEVALUATED, REGISTER_ARGUMENT_LIST and REGISTER_VALUE.
+Object RunBytecode(enum ErrorCode *error);
+
+b64 IsBytecode(Object object);
+Object CodeSource(Object code);
+Object CodeParameters(Object code);
+Object CodeVariables(Object code);
+u8 *CodeBytes(Object code);
+u64 CodeNumBytes(Object code);
+Object CodeConstant(Object code, u64 index);
+// The cell of the global variable constants[index] in environment, or nil if it isn't defined.
+// Once found, the cell is cached in the code.
+Object CodeGlobalCell(Object code, u64 index, Object environment);
+// The operand of the instruction at bytes[*pc]. Advances *pc past it.
+u64 ReadOperand(const u8 *bytes, u64 *pc);
+
+// Print the instructions of code, followed by those of the procedure bodies it makes.
+void PrintBytecode(Object code);
+
+#endif
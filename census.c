@@ -0,0 +1,94 @@
+#include "census.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "type_descriptor.h"
+
+struct HeapCensus heap_census;
+
+static b64 is_taking_census;
+// The register whose objects are being counted, or NUM_REGISTERS for none of them.
+static u64 census_register;
+
+static const char *register_names[NUM_REGISTERS] = {
+  [REGISTER_SYMBOL_TABLE]  = "symbol-table",
+  [REGISTER_READ_SOURCE]   = "read-source",
+  [REGISTER_READ_STACK]    = "read-stack",
+  [REGISTER_READ_RESULT]   = "read-result",
+  [REGISTER_STACK]         = "stack",
+  [REGISTER_EXPRESSION]    = "expression",
+  [REGISTER_VALUE]         = "value",
+  [REGISTER_ENVIRONMENT]   = "environment",
+  [REGISTER_ARGUMENT_LIST] = "argument-list",
+  [REGISTER_PROCEDURE]     = "procedure",
+  [REGISTER_UNEVALUATED]   = "unevaluated",
+  [REGISTER_CONTINUE]      = "continue",
+  [REGISTER_SCOPE]         = "scope",
+  [REGISTER_PRIMITIVE_A]   = "primitive-a",
+  [REGISTER_PRIMITIVE_B]   = "primitive-b",
+  [REGISTER_PRIMITIVE_C]   = "primitive-c",
+  [REGISTER_PRIMITIVE_D]   = "primitive-d",
+};
+
+// The total objects retained by reg.
+static u64 RegisterObjects(u64 reg);
+static const char *TagName(u64 tag);
+
+void PrintHeapCensus() {
+  printf("Heap census of collection %llu: %llu live objects\n",
+      (unsigned long long)heap_census.collection, (unsigned long long)heap_census.num_objects);
+  for (u64 tag = 0; tag < NUM_TAGS; ++tag) {
+    if (heap_census.count_by_tag[tag] == 0) continue;
+    printf("  %-20s %10llu objects in %8llu %ss\n",
+        TagName(tag), (unsigned long long)heap_census.objects_by_tag[tag],
+        (unsigned long long)heap_census.count_by_tag[tag], TagName(tag));
+  }
+
+  // Registers, largest first.
+  b64 printed[NUM_REGISTERS] = {0};
+  for (u64 i = 0; i < NUM_REGISTERS; ++i) {
+    u64 largest = NUM_REGISTERS;
+    for (u64 reg = 0; reg < NUM_REGISTERS; ++reg) {
+      if (printed[reg] || RegisterObjects(reg) == 0) continue;
+      if (largest == NUM_REGISTERS || RegisterObjects(reg) > RegisterObjects(largest)) largest = reg;
+    }
+    if (largest == NUM_REGISTERS) break;
+    printed[largest] = 1;
+    printf("  %-20s %10llu objects retained:", register_names[largest], (unsigned long long)RegisterObjects(largest));
+    for (u64 tag = 0; tag < NUM_TAGS; ++tag) {
+      u64 num_objects = heap_census.objects_by_register[largest][tag];
+      if (num_objects > 0) printf(" %s=%llu", TagName(tag), (unsigned long long)num_objects);
+    }
+    printf("\n");
+  }
+}
+
+b64 IsTakingCensus() { return is_taking_census; }
+
+void BeginCensus(u64 collection) {
+  memset(&heap_census, 0, sizeof(heap_census));
+  heap_census.collection = collection;
+  census_register = NUM_REGISTERS;
+  is_taking_census = 1;
+}
+
+void BeginCensusOfRegister(u64 reg) { census_register = reg; }
+
+void CountCensusObjects(enum Tag tag, u64 num_objects) {
+  if (num_objects == 0) return;
+  heap_census.count_by_tag[tag] += tag == TAG_PAIR ? num_objects / 2 : 1;
+  heap_census.objects_by_tag[tag] += num_objects;
+  heap_census.num_objects += num_objects;
+  if (census_register < NUM_REGISTERS) heap_census.objects_by_register[census_register][tag] += num_objects;
+}
+
+void EndCensus() { is_taking_census = 0; }
+
+static u64 RegisterObjects(u64 reg) {
+  u64 num_objects = 0;
+  for (u64 tag = 0; tag < NUM_TAGS; ++tag) num_objects += heap_census.objects_by_register[reg][tag];
+  return num_objects;
+}
+
+static const char *TagName(u64 tag) { return TypeDescriptorOf(tag)->name; }
@@ -0,0 +1,37 @@
+#ifndef CENSUS_H
+#define CENSUS_H
+
+#include "root.h"
+#include "tag.h"
+
+// A heap census counts the live objects during a full collection: by tag, and by the root register
+// which retains them. The registers are traced one at a time, in the order of enum Register,
+// so an object reachable from several registers is counted for the first of them.
+// Pinned objects are marked before the census begins, and aren't counted.
+
+struct HeapCensus {
+  // The value of memory.num_collections for the collection which took the census. 0 if none has been taken.
+  u64 collection;
+  // The number of live objects, and the objects (words) they occupy, of each tag.
+  u64 count_by_tag[NUM_TAGS];
+  u64 objects_by_tag[NUM_TAGS];
+  // The objects first reached from each register, by tag.
+  u64 objects_by_register[NUM_REGISTERS][NUM_TAGS];
+  u64 num_objects;
+};
+// The most recent census.
+extern struct HeapCensus heap_census;
+
+// Print the objects of each tag, and the registers which retain the most, largest first.
+void PrintHeapCensus();
+
+// Collector internals.
+b64 IsTakingCensus();
+void BeginCensus(u64 collection);
+// Count the objects reached from now on for reg. NUM_REGISTERS counts them for no register.
+void BeginCensusOfRegister(u64 reg);
+// Count the num_objects objects of a newly reached object with tag. A run of pairs may be counted at once.
+void CountCensusObjects(enum Tag tag, u64 num_objects);
+void EndCensus();
+
+#endif
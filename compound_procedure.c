@@ -3,33 +3,32 @@
 #include <assert.h>
 #include <stdio.h>
 
+#include "allocation_profiler.h"
 #include "log.h"
 #include "memory.h"
 #include "tag.h"
 
 Object AllocateCompoundProcedure(enum ErrorCode *error) {
-  EnsureEnoughMemory(3, error);
+  u64 new_reference = AllocateObjects(4, error);
   if (*error) return nil;
+  ProfileAllocation(TAG_COMPOUND_PROCEDURE, 4, __builtin_return_address(0));
 
   // [ ..., free.. ]
-  u64 new_reference = memory.free;
-  memory.the_objects[memory.free++] = nil;
-  memory.the_objects[memory.free++] = nil;
-  memory.the_objects[memory.free++] = nil;
-  memory.num_objects_allocated += 3;
-  // [ ..., environment, parameters, body, free.. ]
+  memory.the_objects[new_reference] = nil;
+  memory.the_objects[new_reference+1] = nil;
+  memory.the_objects[new_reference+2] = nil;
+  memory.the_objects[new_reference+3] = nil;
+  // [ ..., environment, parameters, body, variables, free.. ]
   return BoxCompoundProcedure(new_reference);
 }
 
 Object MoveCompoundProcedure(Object procedure) {
   u64 ref = UnboxReference(procedure);
   // New: [ ..., free... ]
-  // Old: [ ..., environment, parameters, body, ...] OR
+  // Old: [ ..., environment, parameters, body, variables, ...] OR
   //      [ ..., <BH new>, ... ]
-  u64 new_reference = memory.free;
-
-  LOG(LOG_MEMORY, "moving from %llu in the_objects to %llu in new_objects\n", ref, new_reference);
-  Object old_environment = memory.the_objects[ref];
+  LOG(LOG_MEMORY, "moving from %llu\n", ref);
+  Object old_environment = LoadHeader(ref);
   if (IsBrokenHeart(old_environment)) {
     // The procedure has already been moved. Return the updated reference.
     // Old: [ ..., <BH new>, ... ]
@@ -37,42 +36,50 @@ Object MoveCompoundProcedure(Object procedure) {
     return BoxCompoundProcedure(UnboxReference(old_environment));
   }
 
-  LOG(LOG_MEMORY, "Moving from the_objects to new_objects, leaving a broken heart at %llu pointing to %llu\n", ref, new_reference);
-  Object moved_procedure = BoxCompoundProcedure(new_reference);
-  // Old: [ ..., environment, parameters, body, ... ]
-  memory.new_objects[memory.free++] = old_environment; // environment
-  memory.new_objects[memory.free++] = memory.the_objects[ref+1]; // parameters
-  memory.new_objects[memory.free++] = memory.the_objects[ref+2]; // body
-  // New: [ ..., environment, parameters, body, free.. ]
-  memory.the_objects[ref] = BoxBrokenHeart(new_reference);
+  // Old: [ ..., environment, parameters, body, variables, ... ]
+  u64 new_reference = MoveObjects(ref, old_environment, 4);
+  // New: [ ..., environment, parameters, body, variables, free.. ]
   // Old: [ ...,  <BH new>, ... ]
-  return moved_procedure;
+  LOG(LOG_MEMORY, "Moved to the to-space, leaving a broken heart at %llu pointing to %llu\n", ref, new_reference);
+  return BoxCompoundProcedure(new_reference);
 }
 
 Object ProcedureEnvironment(Object procedure) {
   assert(IsCompoundProcedure(procedure));
-  return memory.the_objects[UnboxReference(procedure)];
+  return ReadBarrier(UnboxReference(procedure));
 }
 Object ProcedureParameters(Object procedure) {
   assert(IsCompoundProcedure(procedure));
-  return memory.the_objects[UnboxReference(procedure) + 1];
+  return ReadBarrier(UnboxReference(procedure) + 1);
 }
 Object ProcedureBody(Object procedure) {
   assert(IsCompoundProcedure(procedure));
-  return memory.the_objects[UnboxReference(procedure) + 2];
+  return ReadBarrier(UnboxReference(procedure) + 2);
+}
+Object ProcedureVariables(Object procedure) {
+  assert(IsCompoundProcedure(procedure));
+  return ReadBarrier(UnboxReference(procedure) + 3);
 }
 void SetProcedureEnvironment(Object procedure, Object environment) {
   assert(IsCompoundProcedure(procedure));
+  WriteBarrier(UnboxReference(procedure), environment);
   memory.the_objects[UnboxReference(procedure)] = environment;
 }
 void SetProcedureParameters(Object procedure, Object parameters) {
   assert(IsCompoundProcedure(procedure));
+  WriteBarrier(UnboxReference(procedure) + 1, parameters);
   memory.the_objects[UnboxReference(procedure) + 1] = parameters;
 }
 void SetProcedureBody(Object procedure, Object body) {
   assert(IsCompoundProcedure(procedure));
+  WriteBarrier(UnboxReference(procedure) + 2, body);
   memory.the_objects[UnboxReference(procedure) + 2] = body;
 }
+void SetProcedureVariables(Object procedure, Object variables) {
+  assert(IsCompoundProcedure(procedure));
+  WriteBarrier(UnboxReference(procedure) + 3, variables);
+  memory.the_objects[UnboxReference(procedure) + 3] = variables;
+}
 
 void PrintCompoundProcedure(Object procedure) {
   printf("#procedure(");
@@ -4,22 +4,27 @@
 #include "error.h"
 #include "tag.h"
 
-// A compound procedure type representing 3 associated Objects.
-// Memory Layout: [ ..., environment, parameters, body, ... ]
+// A compound procedure type representing 4 associated Objects.
+// Memory Layout: [ ..., environment, parameters, body, variables, ... ]
+// The body is a list of analyzed expressions (see evaluate.c). The variables are those of the procedure's frame:
+// its parameters, followed by the variables defined in its body (see environment.h).
 //
 // A compound procedure object is a reference to this tuple.
 
-// Allocate a triple representing a compound procedure.
+// Allocate a tuple representing a compound procedure.
 Object AllocateCompoundProcedure(enum ErrorCode *error);
-// Move a compound procedure from the_objects to new_objects
+// Move a compound procedure from the from-space to the to-space
 Object MoveCompoundProcedure(Object procedure);
 
 Object ProcedureEnvironment(Object procedure);
 Object ProcedureParameters(Object procedure);
 Object ProcedureBody(Object procedure);
+Object ProcedureVariables(Object procedure);
+// Setters pass through the write barrier.
 void SetProcedureEnvironment(Object procedure, Object environment);
 void SetProcedureParameters(Object procedure, Object parameters);
 void SetProcedureBody(Object procedure, Object body);
+void SetProcedureVariables(Object procedure, Object variables);
 
 void PrintCompoundProcedure(Object procedure);
 
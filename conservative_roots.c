@@ -0,0 +1,311 @@
+// pthread_getattr_np
+#define _GNU_SOURCE
+#include "conservative_roots.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "large_object_space.h"
+#include "log.h"
+#include "memory.h"
+
+struct StackPin {
+  // The pinned object is [start, end).
+  u64 start;
+  u64 end;
+  // The number of objects within the pinned objects before this one.
+  u64 objects_before;
+};
+
+// One bit per object in the_objects, set where an object starts.
+static u64 *object_starts;
+static u64 num_object_start_words;
+
+// The pinned objects, sorted by start once FindStackPins is done.
+static struct StackPin *pins;
+static u64 num_pins;
+static u64 max_pins;
+
+// The fillers left around the pinned objects in the nursery, which may be reused by allocations.
+struct NurseryHole {
+  u64 start;
+  u64 end;
+};
+static struct NurseryHole *holes;
+static u64 num_holes;
+static u64 max_holes;
+// Holes before this one are full.
+static u64 next_hole;
+
+// The highest address of the stack of the thread which initialized memory.
+static u64 stack_end;
+
+static b64 IsObjectStart(u64 reference);
+// Returns the first object start in [index, end), or end if there isn't one.
+static u64 NextObjectStart(u64 index, u64 end);
+// Finds the last object start in [start, index]. Returns false if there isn't one.
+static b64 PreviousObjectStart(u64 index, u64 start, u64 *object_start);
+
+// Scan the stack below the caller's frame, and the registers the caller saved.
+static void ScanStack(b64 is_full_collection);
+static void ScanStackWords(b64 is_full_collection);
+// Pin the object word refers to, if it looks like a reference to one which could move.
+static void PinAmbiguousReference(u64 word, b64 is_full_collection);
+static void AddStackPin(u64 start, u64 end);
+static void AddNurseryHole(u64 start, u64 end);
+static int CompareStackPins(const void *a, const void *b);
+
+void InitializeConservativeRoots(u64 num_objects, enum ErrorCode *error) {
+  num_object_start_words = num_objects / 64 + 1;
+  object_starts = (u64*)calloc(num_object_start_words, sizeof(u64));
+  if (!object_starts) {
+    *error = ERROR_COULD_NOT_ALLOCATE_HEAP_BUFFER;
+    return;
+  }
+  num_pins = 0;
+
+  pthread_attr_t attributes;
+  if (pthread_getattr_np(pthread_self(), &attributes)) {
+    *error = ERROR_COULD_NOT_FIND_STACK;
+    return;
+  }
+  void *stack_address;
+  size_t stack_size;
+  int result = pthread_attr_getstack(&attributes, &stack_address, &stack_size);
+  pthread_attr_destroy(&attributes);
+  if (result) {
+    *error = ERROR_COULD_NOT_FIND_STACK;
+    return;
+  }
+  stack_end = (u64)stack_address + stack_size;
+}
+
+void DestroyConservativeRoots() {
+  free(object_starts);
+  free(pins);
+  free(holes);
+  object_starts = 0;
+  pins = 0;
+  holes = 0;
+  num_object_start_words = 0;
+  num_pins = 0;
+  max_pins = 0;
+  num_holes = 0;
+  max_holes = 0;
+  next_hole = 0;
+}
+
+void RecordObjectStart(u64 reference) {
+  object_starts[reference / 64] |= 1ull << (reference % 64);
+}
+
+void ClearObjectStarts(u64 start, u64 end) {
+  for (; start < end && start % 64; ++start) object_starts[start / 64] &= ~(1ull << (start % 64));
+  for (; start + 64 <= end; start += 64) object_starts[start / 64] = 0;
+  for (; start < end; ++start) object_starts[start / 64] &= ~(1ull << (start % 64));
+}
+
+void MoveObjectStarts(u64 start, u64 end, u64 destination) {
+  // Starts are moved in increasing order, so a start is never overwritten before it has been moved.
+  for (u64 index = NextObjectStart(start, end); index < end; index = NextObjectStart(index + 1, end)) {
+    object_starts[index / 64] &= ~(1ull << (index % 64));
+    RecordObjectStart(destination + index - start);
+  }
+}
+
+void FindStackPins(b64 is_full_collection) {
+  num_pins = 0;
+  ScanStack(is_full_collection);
+
+  // Several words may refer to the same object.
+  qsort(pins, num_pins, sizeof(struct StackPin), CompareStackPins);
+  u64 num_kept = 0;
+  u64 objects_before = 0;
+  for (u64 i = 0; i < num_pins; ++i) {
+    if (num_kept > 0 && pins[num_kept - 1].start == pins[i].start) continue;
+    pins[num_kept] = pins[i];
+    pins[num_kept].objects_before = objects_before;
+    objects_before += pins[i].end - pins[i].start;
+    ++num_kept;
+  }
+  num_pins = num_kept;
+  LOG(LOG_MEMORY, "Pinned %llu objects (%llu objects) referenced from the stack\n", num_pins, objects_before);
+}
+
+void ForgetStackPins() { num_pins = 0; }
+
+u64 NumStackPins() { return num_pins; }
+u64 StackPinStart(u64 index) { return pins[index].start; }
+u64 StackPinEnd(u64 index) { return pins[index].end; }
+
+u64 StackPinIndex(u64 reference) {
+  u64 low = 0;
+  u64 high = num_pins;
+  while (low < high) {
+    u64 middle = low + (high - low) / 2;
+    if (pins[middle].start <= reference) low = middle + 1;
+    else high = middle;
+  }
+  return low;
+}
+
+b64 IsStackPinned(u64 reference) {
+  if (num_pins == 0) return 0;
+  u64 index = StackPinIndex(reference);
+  return index > 0 && reference < pins[index - 1].end;
+}
+
+u64 StackPinnedObjectsBefore(u64 reference) {
+  u64 index = StackPinIndex(reference);
+  if (index == 0) return 0;
+  struct StackPin *pin = &pins[index - 1];
+  return pin->objects_before + (reference < pin->end ? reference : pin->end) - pin->start;
+}
+
+u64 FillNurseryAroundStackPins(u64 end) {
+  ClearObjectStarts(0, end);
+  num_holes = next_hole = 0;
+  u64 fill = 0;
+  for (u64 i = 0; i < num_pins && pins[i].start < end; ++i) {
+    WriteFiller(fill, pins[i].start);
+    AddNurseryHole(fill, pins[i].start);
+    RecordObjectStart(pins[i].start);
+    fill = pins[i].end;
+  }
+  return fill;
+}
+
+b64 AllocateInNurseryHole(u64 num_objects, u64 *reference) {
+  for (; next_hole < num_holes; ++next_hole) {
+    struct NurseryHole *hole = &holes[next_hole];
+    if (hole->end - hole->start < num_objects) continue;
+    // The filler moves up past the new object.
+    *reference = hole->start;
+    hole->start += num_objects;
+    RecordObjectStart(*reference);
+    WriteFiller(hole->start, hole->end);
+    return 1;
+  }
+  return 0;
+}
+
+void WriteFiller(u64 start, u64 end) {
+  if (start == end) return;
+  // [ ..., N, bytes.., ... ] where the blob is exactly end - start objects.
+  memory.the_objects[start] = BoxBlobHeader(sizeof(Object)*(end - start - 1));
+  RecordObjectStart(start);
+}
+
+static b64 IsObjectStart(u64 reference) {
+  return (object_starts[reference / 64] >> (reference % 64)) & 1;
+}
+
+static u64 NextObjectStart(u64 index, u64 end) {
+  while (index < end) {
+    u64 bits = object_starts[index / 64] >> (index % 64);
+    if (bits) {
+      index += __builtin_ctzll(bits);
+      break;
+    }
+    index = (index / 64 + 1) * 64;
+  }
+  return index < end ? index : end;
+}
+
+static b64 PreviousObjectStart(u64 index, u64 start, u64 *object_start) {
+  u64 word = index / 64;
+  // The bits at or below index.
+  u64 bits = object_starts[word] & (~0ull >> (63 - index % 64));
+  while (!bits && word > start / 64) bits = object_starts[--word];
+  if (!bits) return 0;
+  *object_start = 64*word + 63 - __builtin_clzll(bits);
+  return *object_start >= start;
+}
+
+static void ScanStack(b64 is_full_collection) __attribute__((noinline));
+static void ScanStack(b64 is_full_collection) {
+  // Save every callee-saved register in this frame, which is scanned along with the rest of the stack.
+  __builtin_unwind_init();
+  ScanStackWords(is_full_collection);
+  // Keep this frame from being popped by a tail call.
+  __asm__ volatile("" ::: "memory");
+}
+
+// The stack holds the redzones of other frames, which can't be read with AddressSanitizer.
+static void ScanStackWords(b64 is_full_collection) __attribute__((noinline, no_sanitize_address));
+static void ScanStackWords(b64 is_full_collection) {
+  // Stack slots are aligned to 8 bytes.
+  u64 *word = (u64*)__builtin_frame_address(0);
+  for (; (u64)word < stack_end; ++word) PinAmbiguousReference(*word, is_full_collection);
+}
+
+static void PinAmbiguousReference(u64 word, b64 is_full_collection) {
+  b64 is_reference = IsReference(word);
+  u64 index;
+  if (is_reference) {
+    index = UnboxReference(word);
+  } else {
+    u64 the_objects = (u64)memory.the_objects;
+    if (word < the_objects) return;
+    index = (word - the_objects) / sizeof(Object);
+  }
+  if (index >= memory.num_arena_objects) return;
+
+  if (IsLargeObject(index)) {
+    u64 start;
+    if (!is_full_collection || !FindLargeObjectContaining(index, &start)) return;
+    if (!is_reference || start == index) MarkLargeObject(start);
+    return;
+  }
+
+  u64 region_start, region_end;
+  if (index < memory.nursery_free) {
+    region_start = 0;
+    region_end = memory.nursery_free;
+  } else if (is_full_collection && memory.space_start <= index && index < memory.free) {
+    region_start = memory.space_start;
+    region_end = memory.free;
+  } else {
+    return;
+  }
+  u64 start = index;
+  if (is_reference ? !IsObjectStart(index) : !PreviousObjectStart(index, region_start, &start)) return;
+  AddStackPin(start, NextObjectStart(start + 1, region_end));
+}
+
+static void AddStackPin(u64 start, u64 end) {
+  if (num_pins == max_pins) {
+    u64 new_max_pins = max_pins ? 2*max_pins : 64;
+    struct StackPin *new_pins = (struct StackPin*)realloc(pins, sizeof(struct StackPin)*new_max_pins);
+    // An object which is referenced from the stack can't be moved, so there's no way to continue.
+    if (!new_pins) LOG_ERROR("Could not grow the stack pins to %llu objects", new_max_pins);
+    assert(new_pins);
+    pins = new_pins;
+    max_pins = new_max_pins;
+  }
+  pins[num_pins].start = start;
+  pins[num_pins].end = end;
+  ++num_pins;
+}
+
+static void AddNurseryHole(u64 start, u64 end) {
+  if (start == end) return;
+  if (num_holes == max_holes) {
+    u64 new_max_holes = max_holes ? 2*max_holes : 64;
+    struct NurseryHole *new_holes = (struct NurseryHole*)realloc(holes, sizeof(struct NurseryHole)*new_max_holes);
+    // The hole stays filled, and isn't reused.
+    if (!new_holes) return;
+    holes = new_holes;
+    max_holes = new_max_holes;
+  }
+  holes[num_holes].start = start;
+  holes[num_holes].end = end;
+  ++num_holes;
+}
+
+static int CompareStackPins(const void *a, const void *b) {
+  u64 a_start = ((const struct StackPin*)a)->start;
+  u64 b_start = ((const struct StackPin*)b)->start;
+  return a_start < b_start ? -1 : a_start > b_start;
+}
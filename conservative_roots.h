@@ -0,0 +1,58 @@
+#ifndef CONSERVATIVE_ROOTS_H
+#define CONSERVATIVE_ROOTS_H
+
+#include "error.h"
+#include "tag.h"
+
+// With mostly_copying set, C code may keep Objects in local variables across allocations (Bartlett's mostly-copying collection).
+//
+// Each collection scans the C stack and the machine registers of the allocating thread for words which look like
+// references to objects which could move: Objects with a reference tag, and pointers into the_objects (e.g. the
+// characters of a string). Such a word may only happen to look like a reference, so it can't be updated.
+// Instead, the object it refers to is pinned for the collection: it stays where it is, and its slots are scanned as roots.
+//
+// A tagged reference must refer to the start of an object, and a pointer may point anywhere within one,
+// so the start of every object in the nursery and the current space is recorded in a bitmap.
+// Large objects referenced from the stack are marked by full collections.
+//
+// Pinned objects stay in the nursery after the collection, and the gaps around them are filled with blobs.
+// Small objects are allocated from those gaps before the rest of the nursery.
+// Pinned objects in the current space are kept in place by the compactor (see mark_compact.h).
+// Indices into the_objects (u64) aren't recognized as references.
+
+void InitializeConservativeRoots(u64 num_objects, enum ErrorCode *error);
+void DestroyConservativeRoots();
+
+// Object starts, which are recorded by allocations and by the collectors.
+void RecordObjectStart(u64 reference);
+void ClearObjectStarts(u64 start, u64 end);
+// Move the object starts of [start, end) to destination. The ranges may overlap if destination <= start.
+void MoveObjectStarts(u64 start, u64 end, u64 destination);
+
+// Pin the objects in the nursery referenced from the stack, and during a full collection, those in the current space.
+// Large objects referenced from the stack are marked during a full collection.
+void FindStackPins(b64 is_full_collection);
+// Unpin every object pinned by FindStackPins.
+void ForgetStackPins();
+
+// The pinned objects, sorted by start.
+u64 NumStackPins();
+u64 StackPinStart(u64 index);
+u64 StackPinEnd(u64 index);
+// The number of pinned objects which start at or before reference.
+u64 StackPinIndex(u64 reference);
+// True if reference is within a pinned object.
+b64 IsStackPinned(u64 reference);
+// The number of objects within the pinned objects before reference.
+u64 StackPinnedObjectsBefore(u64 reference);
+
+// Fill the unpinned objects in [0, end) of the nursery with blobs, and clear their starts.
+// Returns the end of the last pinned object in [0, end), or 0 if there isn't one.
+u64 FillNurseryAroundStackPins(u64 end);
+// Allocate num_objects from the blobs left between the pinned objects in the nursery.
+// Returns false if none of them has room.
+b64 AllocateInNurseryHole(u64 num_objects, u64 *reference);
+// Overwrite [start, end) with a single blob.
+void WriteFiller(u64 start, u64 end);
+
+#endif
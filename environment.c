@@ -1,119 +1,257 @@
 #include "environment.h"
 
 #include <assert.h>
-#include <string.h>
 
+#include "compound_procedure.h"
+#include "expression.h"
 #include "log.h"
+#include "memory.h"
 #include "pair.h"
 #include "string.h"
+#include "symbol_table.h"
+#include "vector.h"
 
-// Environment := (innermost-scope next-innermost-scope ... global-scope)
-// Scope       := (variables . values)
-// Variables   := (variable ...)
-// Values      := (value    ...)
+// Environment  := frame | global-scope
+// Frame        := #(enclosing-environment variables value ...)
+// Global scope := (buckets)
+// Buckets      := #(cells ...), the cells hashed by the name of their variable
+// Cells        := ((variable . value) ...)
 
-Object LookupVariableReference(Object variable, Object environment);
-Object LookupVariableInScope(Object variable, Object scope);
+// The number of buckets of a global scope.
+#define GLOBAL_SCOPE_BUCKETS 256
 
-// Constructor/accessors for scopes
-Object AllocateScope(enum ErrorCode *error);
-Object ScopeVariables(Object scope);
-Object ScopeValues(Object scope);
-void SetScopeVariables(Object scope, Object variables);
-void SetScopeValues(Object scope, Object variables);
+// The global scope at the end of environment.
+Object GlobalScope(Object environment);
+// The frame depth frames out from the innermost frame of environment.
+Object FrameAtDepth(u64 depth, Object environment);
 
-Object InnerScope(Object environment);
-void SetInnerScope(Object environment, Object scope);
+// Accessors for global scopes
+Object ScopeBuckets(Object scope);
+u64 ScopeBucketIndex(Object scope, Object variable);
+
+// Frames are vectors, whose first object is the enclosing environment, followed by the list of variables.
+Object FrameEnclosingEnvironment(Object frame);
+Object FrameVariableList(Object frame);
+
+// For ExtendScope: the variables of a frame, appended in order to the list from first to last,
+// from pairs which were reserved up front.
+struct FrameVariables {
+  Object first;
+  Object last;
+};
+// Call visit on each variable defined by expression, outside of quotations and nested lambdas.
+static void VisitDefinitions(Object expression, void (*visit)(Object variable, void *context), void *context);
+static void CountDefinition(Object variable, void *num_definitions);
+// Append the variable to the frame variables, unless it's already one of them.
+static void AdjoinDefinition(Object variable, void *frame_variables);
+static void AppendFrameVariable(struct FrameVariables *frame_variables, Object variable);
 
 Object LookupVariableValue(Object variable, Object environment, b64 *found) {
-  Object values = LookupVariableReference(variable, environment);
-  if (IsNil(values)) {
+  Object cell = LookupGlobalCell(variable, environment);
+  if (IsNil(cell)) {
     *found = 0;
     return nil;
   }
   *found = 1;
-  return First(values);
+  return CellValue(cell);
 }
 
 void SetVariableValue(Object variable, Object value, Object environment, enum ErrorCode *error) {
-  Object values = LookupVariableReference(variable, environment);
-  if (IsNil(values)) {
+  Object cell = LookupGlobalCell(variable, environment);
+  if (IsNil(cell)) {
     *error = ERROR_EVALUATE_SET_UNBOUND_VARIABLE;
     return;
   }
-  SetCar(values, value);
+  SetCellValue(cell, value);
 }
 
 void DefineVariable(enum ErrorCode *error) {
-  // Environment := (scope . more-scopes)
-  // Scope       := (variables . values)
-  {
-    Object new_variables = AllocatePair(error);
-    if (*error) return;
-    SetCar(new_variables, GetUnevaluated());
-    Object inner_scope = InnerScope(GetEnvironment());
-    SetCdr(new_variables, ScopeVariables(inner_scope));
-    SetScopeVariables(inner_scope, new_variables);
+  Object cell = LookupGlobalCell(GetUnevaluated(), GetEnvironment());
+  if (!IsNil(cell)) {
+    SetCellValue(cell, GetValue());
+    return;
   }
-  {
-    Object new_values = AllocatePair(error);
-    if (*error) return;
-    SetCar(new_values, GetValue());
-    Object inner_scope = InnerScope(GetEnvironment());
-    SetCdr(new_values, ScopeValues(inner_scope));
-    SetScopeValues(inner_scope, new_values);
+
+  // Both pairs are reserved up front, so that objects held here aren't invalidated between the allocations.
+  ReserveObjects(4, error);
+  if (*error) return;
+  Object global_scope = GlobalScope(GetEnvironment());
+  cell = AllocateReservedPair();
+  SetCar(cell, GetUnevaluated());
+  SetCellValue(cell, GetValue());
+
+  Object buckets = ScopeBuckets(global_scope);
+  u64 index = ScopeBucketIndex(global_scope, GetUnevaluated());
+  Object cells = AllocateReservedPair();
+  SetCar(cells, cell);
+  SetCdr(cells, UnsafeVectorRef(buckets, index));
+  UnsafeVectorSet(buckets, index, cells);
+}
+
+Object LookupGlobalCell(Object variable, Object environment) {
+  Object global_scope = GlobalScope(environment);
+  Object cells = UnsafeVectorRef(ScopeBuckets(global_scope), ScopeBucketIndex(global_scope, variable));
+  // Symbols are interned, so they're compared by identity.
+  for (; IsPair(cells); cells = Cdr(cells)) {
+    if (Car(Car(cells)) == variable) return Car(cells);
   }
+  return nil;
 }
 
+Object CellValue(Object cell) { return Cdr(cell); }
+void SetCellValue(Object cell, Object value) { SetCdr(cell, value); }
+
 void ExtendEnvironment(enum ErrorCode *error) {
-  {
-    Object new_environment = AllocatePair(error);
-    if (*error) return;
-    SetCdr(new_environment, GetEnvironment());
-    SetEnvironment(new_environment);
+  u64 num_parameters = CountFrameVariables(ProcedureParameters(GetProcedure()));
+  u64 num_arguments = 0;
+  for (Object arguments = GetArgumentList(); IsPair(arguments); arguments = Cdr(arguments)) ++num_arguments;
+  if (num_arguments != num_parameters) {
+    *error = ERROR_EVALUATE_ARITY_MISMATCH;
+    return;
   }
-
-  Object new_scope = AllocateScope(error);
+  // REFERENCES INVALIDATED
+  Object frame = AllocateFrame(CountFrameVariables(ProcedureVariables(GetProcedure())), error);
   if (*error) return;
-  SetScopeVariables(new_scope, GetUnevaluated());
-  SetScopeValues(new_scope, GetArgumentList());
+  SetFrameEnclosingEnvironment(frame, ProcedureEnvironment(GetProcedure()));
+  SetFrameVariableList(frame, ProcedureVariables(GetProcedure()));
+  Object arguments = GetArgumentList();
+  for (u64 index = 0; index < num_parameters; ++index, arguments = Cdr(arguments))
+    SetFrameVariable(frame, index, Car(arguments));
+  SetEnvironment(frame);
+}
 
-  SetInnerScope(GetEnvironment(), new_scope);
+Object AllocateFrame(u64 num_variables, enum ErrorCode *error) {
+  return AllocateVector(2 + num_variables, error);
 }
 
-void MakeInitialEnvironment(enum ErrorCode *error) {
-  SetEnvironment(AllocatePair(error));
-  if (*error) return; 
-  SetInnerScope(GetEnvironment(), AllocateScope(error));
+u64 FrameNumVariables(Object frame) { return UnsafeVectorLength(frame) - 2; }
+Object FrameEnclosingEnvironment(Object frame) { return UnsafeVectorRef(frame, 0); }
+void SetFrameEnclosingEnvironment(Object frame, Object environment) { UnsafeVectorSet(frame, 0, environment); }
+Object FrameVariableList(Object frame) { return UnsafeVectorRef(frame, 1); }
+void SetFrameVariableList(Object frame, Object variables) { UnsafeVectorSet(frame, 1, variables); }
+void SetFrameVariable(Object frame, u64 index, Object value) { UnsafeVectorSet(frame, 2 + index, value); }
+
+u64 CountFrameVariables(Object variables) {
+  u64 num_variables = 0;
+  for (; IsPair(variables); variables = Cdr(variables)) ++num_variables;
+  return num_variables;
 }
 
-Object LookupVariableReference(Object variable, Object environment) {
-  for (; !IsNil(environment); environment = Cdr(environment)) {
-    Object scope = InnerScope(environment);
-    Object values = LookupVariableInScope(variable, scope);
-    if (!IsNil(values)) return values;
-  }
-  return nil;
+Object LookupLexicalAddress(u64 depth, u64 index, Object environment) {
+  return UnsafeVectorRef(FrameAtDepth(depth, environment), 2 + index);
 }
 
-Object LookupVariableInScope(Object variable, Object scope) {
-  Object variables = ScopeVariables(scope);
-  Object values = ScopeValues(scope);
+void SetLexicalAddress(u64 depth, u64 index, Object value, Object environment) {
+  SetFrameVariable(FrameAtDepth(depth, environment), index, value);
+}
 
-  for (; IsPair(variables); variables = Cdr(variables), values = Cdr(values)) {
-    if (!strcmp(StringCharacterBuffer(variable), StringCharacterBuffer(Car(variables)))) {
-      return values;
+b64 FindLexicalAddress(Object variable, Object scope, u64 *depth, u64 *index) {
+  for (*depth = 0; IsPair(scope); scope = Cdr(scope), ++*depth) {
+    *index = 0;
+    for (Object variables = Car(scope); IsPair(variables); variables = Cdr(variables), ++*index) {
+      if (Car(variables) == variable) return 1;
     }
   }
-  return nil;
+  return 0;
+}
+
+void MakeEnvironmentScope(enum ErrorCode *error) {
+  u64 num_frames = 0;
+  for (Object environment = GetEnvironment(); IsVector(environment); environment = FrameEnclosingEnvironment(environment))
+    ++num_frames;
+  // REFERENCES INVALIDATED
+  ReserveObjects(2*num_frames, error);
+  if (*error) return;
+  // The frames are visited innermost first, so each is appended to the scope.
+  SetScope(nil);
+  Object last = nil;
+  for (Object environment = GetEnvironment(); IsVector(environment); environment = FrameEnclosingEnvironment(environment)) {
+    Object pair = AllocateReservedPair();
+    SetCar(pair, FrameVariableList(environment));
+    if (IsNil(last)) SetScope(pair);
+    else SetCdr(last, pair);
+    last = pair;
+  }
+}
+
+void ExtendScope(enum ErrorCode *error) {
+  Object parameters, body;
+  ExtractLambdaArguments(GetExpression(), &parameters, &body, error);
+  if (*error) return;
+  // Definitions which are repeated are counted each time, so this may reserve more than is used.
+  u64 num_variables = CountFrameVariables(parameters);
+  for (; IsPair(body); body = Cdr(body)) VisitDefinitions(Car(body), CountDefinition, &num_variables);
+
+  // The frame variables and the new scope are reserved up front. REFERENCES INVALIDATED
+  ReserveObjects(2*num_variables + 2, error);
+  if (*error) return;
+  ExtractLambdaArguments(GetExpression(), &parameters, &body, error);
+  struct FrameVariables frame_variables = {nil, nil};
+  for (; IsPair(parameters); parameters = Cdr(parameters)) AppendFrameVariable(&frame_variables, Car(parameters));
+  for (; IsPair(body); body = Cdr(body)) VisitDefinitions(Car(body), AdjoinDefinition, &frame_variables);
+
+  Object scope = AllocateReservedPair();
+  SetCar(scope, frame_variables.first);
+  SetCdr(scope, GetScope());
+  SetScope(scope);
+  SetValue(frame_variables.first);
+}
+
+static void VisitDefinitions(Object expression, void (*visit)(Object variable, void *context), void *context) {
+  if (!IsPair(expression) || IsQuoted(expression) || IsLambda(expression)) return;
+  if (IsDefinition(expression)) {
+    Object variable, value;
+    enum ErrorCode error = NO_ERROR;
+    ExtractDefinitionArguments(expression, &variable, &value, &error);
+    // A malformed definition is reported when it's analyzed.
+    if (error) return;
+    visit(variable, context);
+    VisitDefinitions(value, visit, context);
+    return;
+  }
+  for (; IsPair(expression); expression = Cdr(expression)) VisitDefinitions(Car(expression), visit, context);
+}
+
+static void CountDefinition(Object variable, void *num_definitions) { ++*(u64*)num_definitions; }
+
+static void AdjoinDefinition(Object variable, void *context) {
+  struct FrameVariables *frame_variables = context;
+  for (Object variables = frame_variables->first; IsPair(variables); variables = Cdr(variables)) {
+    if (Car(variables) == variable) return;
+  }
+  AppendFrameVariable(frame_variables, variable);
+}
+
+static void AppendFrameVariable(struct FrameVariables *frame_variables, Object variable) {
+  Object pair = AllocateReservedPair();
+  SetCar(pair, variable);
+  if (IsNil(frame_variables->first)) frame_variables->first = pair;
+  else SetCdr(frame_variables->last, pair);
+  frame_variables->last = pair;
+}
+
+void MakeInitialEnvironment(enum ErrorCode *error) {
+  // REFERENCES INVALIDATED
+  SetValue(AllocateVector(GLOBAL_SCOPE_BUCKETS, error));
+  if (*error) return;
+  Object global_scope = AllocatePair(error);
+  if (*error) return;
+  SetCar(global_scope, GetValue());
+  SetEnvironment(global_scope);
+}
+
+Object GlobalScope(Object environment) {
+  while (IsVector(environment)) environment = FrameEnclosingEnvironment(environment);
+  return environment;
 }
 
-Object AllocateScope(enum ErrorCode *error) { return AllocatePair(error); }
-Object ScopeVariables(Object scope) { return Car(scope); }
-Object ScopeValues(Object scope) { return Cdr(scope); }
+Object FrameAtDepth(u64 depth, Object environment) {
+  for (; depth > 0; --depth) environment = FrameEnclosingEnvironment(environment);
+  return environment;
+}
 
-void SetScopeVariables(Object scope, Object variables) { SetCar(scope, variables); }
-void SetScopeValues(Object scope, Object variables) { SetCdr(scope, variables); }
+Object ScopeBuckets(Object scope) { return Car(scope); }
 
-Object InnerScope(Object environment) { return First(environment); } 
-void SetInnerScope(Object environment, Object scope) { SetCar(environment, scope); }
+u64 ScopeBucketIndex(Object scope, Object variable) {
+  return HashString(StringCharacterBuffer(variable)) % UnsafeVectorLength(ScopeBuckets(scope));
+}
@@ -5,25 +5,76 @@
 #include "root.h"
 
 // An environment provides a nestable lexical scope.
-// It is conceptually a stack of scopes, where each environment scope
-// contains a lookup table of symbol->value.
+// It is a chain of frames, one for each call of a compound procedure, ending with the global scope:
+//   Environment  := frame | global-scope
+//   Frame        := [ ..., N+2, enclosing-environment, variables, value0, ..., valueN-1, ... ], a vector
+//   Global scope := a hash table of cells, one for each global variable
+//
+// The variables of a frame are those of its procedure: the parameters, followed by the variables
+// defined in the procedure's body, which are bound to nil until they are defined (see ExtendScope).
+// A frame records the list of its variables, so that expressions evaluated in it later can find them.
+// They are found before evaluation, by their lexical address: the depth of their frame, counted outward from
+// the innermost frame, and their index in it. Looking one up follows depth enclosing environments, and loads the value.
+// Variables which aren't in any frame are global. Each is bound to a cell, (variable . value), which a definition
+// creates once, and then updates in place. Cells are never removed, so the places which reference a global variable
+// cache its cell once it's found (see evaluate.c and bytecode.c), and each lookup after the first is a load.
+// A cached cell belongs to the global scope it was found in.
 
-// Attempts to look up the symbol variable in environment, starting with the innermost scope
-// and searching outward. If found, returns the value and sets *found to true.
+// Attempts to look up the global variable in environment's global scope.
+// If found, returns the value and sets *found to true.
 // Otherwise returns nil and sets *found to false.
 Object LookupVariableValue(Object variable, Object environment, b64 *found);
-// Attempts to look up variable in environment, starting with the innermost scope
-// and searching outward. If found, sets the variable's value to value.
+// Attempts to look up the global variable in environment's global scope.
+// If found, sets the variable's value to value.
 // Causes an error if not found.
 void SetVariableValue(Object variable, Object value, Object environment, enum ErrorCode *error);
 
-// Creates a new variable in the innermost scope, bound to value.
-// If the variable is already in the environment, causes an error.
+// Creates the variable REGISTER_UNEVALUATED in the global scope of REGISTER_ENVIRONMENT, bound to REGISTER_VALUE.
+// The cell of a variable which is already defined is updated instead.
 void DefineVariable(enum ErrorCode *error);
-// Creates an environment with a new scope/frame added to the provided environment.
-// The symbols in parameters are associated with the values in arguments in the new scope.
+// Creates a frame for the variables of the compound procedure in REGISTER_PROCEDURE, enclosed by its environment,
+// and makes it REGISTER_ENVIRONMENT. The parameters are bound in order to the arguments in REGISTER_ARGUMENT_LIST,
+// and the variables defined in the body to nil.
+// Causes ERROR_EVALUATE_ARITY_MISMATCH unless there is an argument for each parameter.
 void ExtendEnvironment(enum ErrorCode *error);
 
+// Cells
+// The cell of the global variable in environment's global scope, or nil if it isn't defined.
+Object LookupGlobalCell(Object variable, Object environment);
+Object CellValue(Object cell);
+void SetCellValue(Object cell, Object value);
+
+// Frames
+// Allocate a frame for num_variables variables, bound to nil, with no enclosing environment. REFERENCES INVALIDATED
+Object AllocateFrame(u64 num_variables, enum ErrorCode *error);
+u64 FrameNumVariables(Object frame);
+void SetFrameEnclosingEnvironment(Object frame, Object environment);
+void SetFrameVariable(Object frame, u64 index, Object value);
+// The list of the variables of the frame.
+void SetFrameVariableList(Object frame, Object variables);
+// The number of variables in a frame for variables, a list of symbols.
+u64 CountFrameVariables(Object variables);
+
+// Lexical addresses
+// Look up the variable at the lexical address (depth, index) in environment.
+Object LookupLexicalAddress(u64 depth, u64 index, Object environment);
+void SetLexicalAddress(u64 depth, u64 index, Object value, Object environment);
+
+// Scopes
+// While expressions are analyzed or compiled, REGISTER_SCOPE holds a list of the variables of each frame
+// around them, innermost first. It starts as the scope of the environment they'll be evaluated in.
+//
+// REGISTER_ENVIRONMENT (IN) an environment
+// REGISTER_SCOPE (OUT) holds the variables of each of its frames, innermost first. REFERENCES INVALIDATED
+void MakeEnvironmentScope(enum ErrorCode *error);
+// Finds the lexical address of variable in scope. Returns false if variable is global.
+b64 FindLexicalAddress(Object variable, Object scope, u64 *depth, u64 *index);
+// REGISTER_EXPRESSION (IN) a lambda expression
+// REGISTER_SCOPE (IN/OUT) the variables of the lambda's frame are added as the innermost frame
+// REGISTER_VALUE (OUT) holds the variables of the frame: the parameters, followed by each variable
+//   defined in the body, outside of any nested lambda, which isn't a parameter. REFERENCES INVALIDATED
+void ExtendScope(enum ErrorCode *error);
+
 // Creates the initial environment. Crashes if there isn't enough memory.
 void MakeInitialEnvironment(enum ErrorCode *error);
 
@@ -55,15 +55,22 @@
   X(ERROR_EVALUATE_DIVIDE_BY_ZERO) \
   X(ERROR_EVALUATE_ARITHMETIC_OVERFLOW) \
   X(ERROR_EVALUATE_ARITHMETIC_UNDERFLOW) \
+  X(ERROR_COMPILE_OPERAND_TOO_LARGE) \
   X(ERROR_COULD_NOT_OPEN_BINARY_FILE_FOR_READING) \
   X(ERROR_COULD_NOT_CLOSE_FILE) \
   X(ERROR_COULD_NOT_SEEK_TO_START_OF_FILE) \
   X(ERROR_COULD_NOT_SEEK_TO_END_OF_FILE) \
   X(ERROR_COULD_NOT_TELL_FILE_POSITION) \
   X(ERROR_COULD_NOT_READ_FILE) \
+  X(ERROR_FILE_IS_CLOSED) \
+  X(ERROR_COULD_NOT_OPEN_GC_LOG) \
+  X(ERROR_OBJECT_CANNOT_BE_PINNED) \
+  X(ERROR_OBJECT_IS_NOT_PINNED) \
+  X(ERROR_COULD_NOT_FIND_STACK) \
   X(ERROR_COULD_NOT_ALLOCATE_HEAP) \
   X(ERROR_COULD_NOT_ALLOCATE_HEAP_BUFFER) \
-  X(ERROR_OUT_OF_MEMORY)
+  X(ERROR_OUT_OF_MEMORY) \
+  X(ERROR_STACK_OVERFLOW)
 
 enum ErrorCode {
 #define X(value) value,
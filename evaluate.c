@@ -1,38 +1,94 @@
 #include "evaluate.h"
 
 #include <assert.h>
+#include <stdio.h>
+#include <time.h>
 
+#include "bytecode.h"
 #include "compound_procedure.h"
 #include "environment.h"
 #include "expression.h"
+#include "jit.h"
 #include "log.h"
 #include "memory.h"
 #include "pair.h"
 #include "primitives.h"
 #include "root.h"
 #include "read.h"
+#include "record.h"
 #include "string.h"
 #include "symbol_table.h"
 
 Object EvaluateInAFreshEnvironment(Object expression);
 
+// Analysis
+// Expressions are analyzed once, before they are evaluated, so that their syntax isn't examined again
+// each time they are evaluated. An analyzed expression is a record whose type is the EvaluateFunction
+// which evaluates it, followed by the expression it was analyzed from and its parts:
+//   constant:    [ ..., N+1, EvaluateConstant,    source, value, ... ]
+//   variable:    [ ..., N+1, EvaluateVariable,    source, variable, cell, ... ]
+//   assignment:  [ ..., N+1, EvaluateAssignment,  source, variable, value, ... ]
+//   definition:  [ ..., N+1, EvaluateDefinition,  source, variable, value, ... ]
+//   local variable:   [ ..., N+1, EvaluateLocalVariable,   source, depth, index, ... ]
+//   local assignment: [ ..., N+1, EvaluateLocalAssignment, source, value, depth, index, result, ... ]
+//   if:          [ ..., N+1, EvaluateIf,          source, predicate, consequent, alternative, ... ]
+//   lambda:      [ ..., N+1, EvaluateLambda,      source, parameters, body, variables, ... ]
+//   begin:       [ ..., N+1, EvaluateBegin,       source, sequence, ... ]
+//   application: [ ..., N+1, EvaluateApplication, source, operator, operands, ... ]
+// body, sequence and operands are lists of analyzed expressions, and the other parts are analyzed expressions,
+// except for the variables, parameters, values of constants, lexical addresses and results. Compound procedures keep the analyzed body.
+//
+// Variables of the frames of procedures are analyzed into their lexical address (depth, index) (see environment.h).
+// The others are global. A set! or define of a local variable is a local assignment, whose result is ok or
+// the variable. The variables of a lambda are those of its frame. The cell of a global variable is nil
+// until it is first looked up, and is then cached.
+
+// REGISTER_EXPRESSION (IN) is analyzed
+// REGISTER_VALUE (OUT) holds the analyzed expression
+// Uses REGISTER_UNEVALUATED and REGISTER_ARGUMENT_LIST. The stack is left as it was.
+static void Analyze(enum ErrorCode *error);
+// REGISTER_EXPRESSION (IN) is analyzed, when it is the special form of the function.
+// REGISTER_ARGUMENT_LIST (OUT) holds the analyzed expression
+static void AnalyzeVariable(enum ErrorCode *error);
+static void AnalyzeQuoted(enum ErrorCode *error);
+static void AnalyzeAssignment(enum ErrorCode *error);
+static void AnalyzeDefinition(enum ErrorCode *error);
+static void AnalyzeIf(enum ErrorCode *error);
+static void AnalyzeLambda(enum ErrorCode *error);
+static void AnalyzeBegin(enum ErrorCode *error);
+// The assignment or definition in REGISTER_EXPRESSION is of the local variable at (depth, index).
+static void AnalyzeLocalAssignment(u64 depth, u64 index, enum ErrorCode *error);
+static void AnalyzeApplication(enum ErrorCode *error);
+// Allocate an analyzed expression of REGISTER_EXPRESSION into REGISTER_ARGUMENT_LIST.
+static void AllocateAnalyzed(EvaluateFunction evaluate, u64 num_parts, enum ErrorCode *error);
+// Analyze expression into part of the analyzed expression in REGISTER_ARGUMENT_LIST.
+static void AnalyzePart(u64 part, Object expression, enum ErrorCode *error);
+// Analyze each expression of list into part of the analyzed expression in REGISTER_ARGUMENT_LIST.
+// Fails with dotted_list_error if list isn't a proper list.
+static void AnalyzeListPart(u64 part, Object list, enum ErrorCode dotted_list_error, enum ErrorCode *error);
+// The expression the analyzed expression was analyzed from.
+static Object AnalyzedSource(Object analyzed);
+static Object AnalyzedPart(Object analyzed, u64 part);
+static void SetAnalyzedPart(Object analyzed, u64 part, Object value);
+
 // EvaluateFunctions
-// REGISTER_EXPRESSION (IN) is evaluated
+// REGISTER_EXPRESSION (IN) the analyzed expression which is evaluated
 // REGISTER_VALUE (OUT) holds the value
 // REGISTER_CONTINUE (IN) where to continue execution when complete.
 // Stack (...)
 void EvaluateDispatch();
-void EvaluateSelfEvaluating();
+void EvaluateConstant();
 void EvaluateVariable();
-void EvaluateQuoted();
 void EvaluateAssignment();
 void EvaluateDefinition();
+void EvaluateLocalVariable();
+void EvaluateLocalAssignment();
 void EvaluateIf();
 void EvaluateLambda();
 void EvaluateBegin();
 void EvaluateApplication();
 
-// REGISTER_UNEVALUATED (IN) holds a list of expressions to evaluate
+// REGISTER_UNEVALUATED (IN) holds a list of analyzed expressions to evaluate
 void EvaluateSequence();
 // Stack (continue ...)
 void EvaluateSequenceLastExpression();
@@ -69,19 +125,49 @@ void EvaluateApplicationAccumulateArgument();
 //   procedure: the evaluated operator
 void EvaluateApplicationAccumulateLastArgument();
 
+// REGISTER_VALUE (IN) holds the evaluated record procedure
+// REGISTER_UNEVALUATED (IN) holds the unevaluated operands
+// Stack (continue ...)
+void EvaluateRecordApplication();
+
+// REGISTER_UNEVALUATED (IN) The unevaluated arguments, at least one.
+// REGISTER_ARGUMENT_LIST (IN) The record being constructed.
+// Stack (continue ...)
+void EvaluateRecordConstructorLoop();
+
+// Stack (unevaluated environment record continue ...)
+//   unevaluated: the unevaluated arguments, starting with the one just evaluated
+//   record: the record being constructed
+void EvaluateRecordConstructorSlot();
+
+// REGISTER_VALUE (IN) holds the evaluated argument of a predicate or accessor
+// Stack (procedure continue ...)
+void EvaluateRecordUnaryApplication();
+
+// REGISTER_VALUE (IN) holds the record to modify
+// Stack (unevaluated environment procedure continue ...)
+void EvaluateRecordModifierValue();
+
+// REGISTER_VALUE (IN) holds the value to store
+// Stack (record procedure continue ...)
+void EvaluateRecordModify();
+
 // Stack (continue environment expression ...)
 //   continue: where to resume when if expression is fully evaluated
 //   environment: environment of the if expression
-//   expression: (if predicate consequent alternative)
+//   expression: the analyzed if expression
 void EvaluateIfDecide();
 void EvaluateAssignment1();
 void EvaluateDefinition1();
+void EvaluateLocalAssignment1();
 
 void EvaluateUnboundVariable();
 
-void EvaluateUnknown();
 void EvaluateError();
 
+// Run the evaluation loop from start until it quits. Returns the error it quit with, if any, and clears it.
+static enum ErrorCode RunEvaluation(EvaluateFunction start);
+
 Object MakeProcedure(enum ErrorCode *error);
 
 // Procedures
@@ -90,8 +176,12 @@ Object ApplyPrimitiveProcedure(Object procedure, Object arguments, enum ErrorCod
 // Application
 void AdjoinArgument(enum ErrorCode *error);
 
+// Writes a program without escaping the strings in it.
+#define BERT(bertscript...) #bertscript
+
 static EvaluateFunction next = 0;
 static enum ErrorCode error = NO_ERROR;
+static enum Engine engine = ENGINE_ANALYZE;
 
 #define BEGIN do { 
 #define END   } while(0)
@@ -107,7 +197,7 @@ static enum ErrorCode error = NO_ERROR;
 #define SAVE(reg)  BEGIN  CHECK(Save((reg), &error));  END
 
 void DefinePrimitive(const u8 *name, PrimitiveFunction function) {
-  enum ErrorCode error;
+  enum ErrorCode error = NO_ERROR;
   SetUnevaluated(InternSymbol(name, &error));
   assert(!error);
   SetValue(BoxPrimitiveProcedure(function));
@@ -115,39 +205,83 @@ void DefinePrimitive(const u8 *name, PrimitiveFunction function) {
   assert(!error);
 }
 
+void SetEngine(enum Engine new_engine) { engine = new_engine; }
+
 // TODO: take & return error code
 Object Evaluate(Object expression) {
   SetExpression(expression);
+  // The expression sees the local variables of REGISTER_ENVIRONMENT, e.g. when it's evaluated by a procedure.
+  MakeEnvironmentScope(&error);
+  if (engine == ENGINE_BYTECODE) {
+    if (!error) Compile(&error);
+    if (!error) {
+      SetExpression(GetValue());
+      SetValue(RunBytecode(&error));
+    }
+    if (error) {
+      LOG_ERROR("%s", ErrorCodeString(error));
+      error = NO_ERROR;
+      SetValue(nil);
+    }
+    return GetValue();
+  }
+
+  if (!error) Analyze(&error);
+  SetScope(nil);
+  SetExpression(GetValue());
   // Set continue to quit when evaluation finishes.
   SetContinue(0);
 
-  // Start the evaluation by evaluating the provided expression.
-  next = EvaluateDispatch;
-
-  // Run the evaluation loop until quit.
-  while (next) next();
+  // Start the evaluation by evaluating the analyzed expression, and run it until quit.
+  // An error has already been reported by EvaluateError.
+  RunEvaluation(error ? EvaluateError : EvaluateDispatch);
 
   // Return the evaluated expression.
   return GetValue();
 }
 
+Object ApplyCompoundProcedure(Object procedure, Object arguments, enum ErrorCode *error) {
+  u64 stack_size = StackSize();
+  SetProcedure(procedure);
+  SetArgumentList(arguments);
+  // Set continue to quit when the body has been evaluated.
+  SetContinue(0);
+  Save(REGISTER_CONTINUE, error);
+  if (*error) return nil;
+  *error = RunEvaluation(EvaluateApplicationDispatch);
+  if (*error) {
+    SetStackSize(stack_size);
+    return nil;
+  }
+  return GetValue();
+}
+
+static enum ErrorCode RunEvaluation(EvaluateFunction start) {
+  next = start;
+  while (next) next();
+  enum ErrorCode result = error;
+  error = NO_ERROR;
+  return result;
+}
+
 Object EvaluateInAFreshEnvironment(Object expression) {
   error = NO_ERROR;
   // Set the expression to be evaluated.
   SetExpression(expression);
 
   // Clear the stack.
-  SetRegister(REGISTER_STACK, nil);
+  ClearStack();
 
   // Ensure that the evaluator can find all the necessary symbols.
   // to avoid allocating during EvaluateDispatch.
-  InternSymbol("quote", &error);
-  InternSymbol("set!", &error);
-  InternSymbol("define", &error);
-  InternSymbol("if", &error);
-  InternSymbol("fn", &error);
-  InternSymbol("begin", &error);
-  InternSymbol("ok", &error);
+  // They are permanent, since finding a symbol doesn't keep it alive.
+  InternPermanentSymbol("quote", &error);
+  InternPermanentSymbol("set!", &error);
+  InternPermanentSymbol("define", &error);
+  InternPermanentSymbol("if", &error);
+  InternPermanentSymbol("fn", &error);
+  InternPermanentSymbol("begin", &error);
+  InternPermanentSymbol("ok", &error);
 
   // Create the initial environment
   MakeInitialEnvironment(&error);
@@ -160,59 +294,265 @@ Object EvaluateInAFreshEnvironment(Object expression) {
   return Evaluate(GetExpression());
 }
 
+static void Analyze(enum ErrorCode *error) {
+  Object expression = GetExpression();
+  if (IsSelfEvaluating(expression)) {
+    AllocateAnalyzed(EvaluateConstant, 1, error);
+    if (*error) return;
+    SetAnalyzedPart(GetArgumentList(), 0, GetExpression());
+  }
+  else if (IsVariable(expression))    AnalyzeVariable(error);
+  else if (IsQuoted(expression))      AnalyzeQuoted(error);
+  else if (IsAssignment(expression))  AnalyzeAssignment(error);
+  else if (IsDefinition(expression))  AnalyzeDefinition(error);
+  else if (IsIf(expression))          AnalyzeIf(error);
+  else if (IsLambda(expression))      AnalyzeLambda(error);
+  else if (IsBegin(expression))       AnalyzeBegin(error);
+  else if (IsApplication(expression)) AnalyzeApplication(error);
+  else {
+    LOG_ERROR("Unknown Expression");
+    LOG_OP(LOG_EVALUATE, PrintlnObject(expression));
+    *error = ERROR_EVALUATE_UNKNOWN_EXPRESSION;
+  }
+  SetValue(*error ? nil : GetArgumentList());
+}
+
+// The syntax of each expression is checked before the analyzed expression is allocated,
+// and its parts are extracted again from the source afterwards. REFERENCES INVALIDATED
+
+static void AnalyzeVariable(enum ErrorCode *error) {
+  u64 depth, index;
+  if (!FindLexicalAddress(GetExpression(), GetScope(), &depth, &index)) {
+    AllocateAnalyzed(EvaluateVariable, 2, error);
+    if (*error) return;
+    SetAnalyzedPart(GetArgumentList(), 0, GetExpression());
+    return;
+  }
+  AllocateAnalyzed(EvaluateLocalVariable, 2, error);
+  if (*error) return;
+  SetAnalyzedPart(GetArgumentList(), 0, BoxFixnum(depth));
+  SetAnalyzedPart(GetArgumentList(), 1, BoxFixnum(index));
+}
+
+static void AnalyzeQuoted(enum ErrorCode *error) {
+  Object quoted_expression;
+  ExtractQuoted(GetExpression(), &quoted_expression, error);
+  if (*error) return;
+  AllocateAnalyzed(EvaluateConstant, 1, error);
+  if (*error) return;
+  ExtractQuoted(AnalyzedSource(GetArgumentList()), &quoted_expression, error);
+  SetAnalyzedPart(GetArgumentList(), 0, quoted_expression);
+}
+
+static void AnalyzeAssignment(enum ErrorCode *error) {
+  Object variable, value;
+  ExtractAssignmentArguments(GetExpression(), &variable, &value, error);
+  if (*error) return;
+  u64 depth, index;
+  if (FindLexicalAddress(variable, GetScope(), &depth, &index)) {
+    AnalyzeLocalAssignment(depth, index, error);
+    return;
+  }
+  AllocateAnalyzed(EvaluateAssignment, 2, error);
+  if (*error) return;
+  ExtractAssignmentArguments(AnalyzedSource(GetArgumentList()), &variable, &value, error);
+  SetAnalyzedPart(GetArgumentList(), 0, variable);
+  AnalyzePart(1, value, error);
+}
+
+static void AnalyzeDefinition(enum ErrorCode *error) {
+  Object variable, value;
+  ExtractDefinitionArguments(GetExpression(), &variable, &value, error);
+  if (*error) return;
+  // A definition in the body of a procedure is of a variable of its frame.
+  u64 depth, index;
+  if (FindLexicalAddress(variable, GetScope(), &depth, &index)) {
+    AnalyzeLocalAssignment(depth, index, error);
+    return;
+  }
+  AllocateAnalyzed(EvaluateDefinition, 2, error);
+  if (*error) return;
+  ExtractDefinitionArguments(AnalyzedSource(GetArgumentList()), &variable, &value, error);
+  SetAnalyzedPart(GetArgumentList(), 0, variable);
+  AnalyzePart(1, value, error);
+}
+
+static void AnalyzeLocalAssignment(u64 depth, u64 index, enum ErrorCode *error) {
+  AllocateAnalyzed(EvaluateLocalAssignment, 4, error);
+  if (*error) return;
+  Object source = AnalyzedSource(GetArgumentList());
+  Object variable, value;
+  b64 is_definition = IsDefinition(source);
+  if (is_definition) ExtractDefinitionArguments(source, &variable, &value, error);
+  else ExtractAssignmentArguments(source, &variable, &value, error);
+  SetAnalyzedPart(GetArgumentList(), 1, BoxFixnum(depth));
+  SetAnalyzedPart(GetArgumentList(), 2, BoxFixnum(index));
+  SetAnalyzedPart(GetArgumentList(), 3, is_definition ? variable : FindSymbol("ok"));
+  AnalyzePart(0, value, error);
+}
+
+static void AnalyzeIf(enum ErrorCode *error) {
+  Object predicate, consequent, alternative;
+  ExtractIfPredicate(GetExpression(), &predicate, error);
+  if (*error) return;
+  ExtractIfAlternatives(GetExpression(), &consequent, &alternative, error);
+  if (*error) return;
+  AllocateAnalyzed(EvaluateIf, 3, error);
+  if (*error) return;
+
+  ExtractIfPredicate(AnalyzedSource(GetArgumentList()), &predicate, error);
+  AnalyzePart(0, predicate, error);
+  if (*error) return;
+  ExtractIfAlternatives(AnalyzedSource(GetArgumentList()), &consequent, &alternative, error);
+  AnalyzePart(1, consequent, error);
+  if (*error) return;
+  ExtractIfAlternatives(AnalyzedSource(GetArgumentList()), &consequent, &alternative, error);
+  AnalyzePart(2, alternative, error);
+}
+
+static void AnalyzeLambda(enum ErrorCode *error) {
+  Object parameters, body;
+  ExtractLambdaArguments(GetExpression(), &parameters, &body, error);
+  if (*error) return;
+  AllocateAnalyzed(EvaluateLambda, 3, error);
+  if (*error) return;
+
+  // The body is analyzed in the scope of the procedure's frame.
+  Save(REGISTER_SCOPE, error);
+  if (*error) return;
+  ExtendScope(error);
+  if (!*error) {
+    SetAnalyzedPart(GetArgumentList(), 2, GetValue());
+    ExtractLambdaArguments(AnalyzedSource(GetArgumentList()), &parameters, &body, error);
+    SetAnalyzedPart(GetArgumentList(), 0, parameters);
+    AnalyzeListPart(1, body, ERROR_EVALUATE_LAMBDA_BODY_MALFORMED, error);
+  }
+  Restore(REGISTER_SCOPE);
+}
+
+static void AnalyzeBegin(enum ErrorCode *error) {
+  Object sequence;
+  ExtractBegin(GetExpression(), &sequence, error);
+  if (*error) return;
+  AllocateAnalyzed(EvaluateBegin, 1, error);
+  if (*error) return;
+  ExtractBegin(AnalyzedSource(GetArgumentList()), &sequence, error);
+  AnalyzeListPart(0, sequence, ERROR_EVALUATE_BEGIN_MALFORMED, error);
+}
+
+static void AnalyzeApplication(enum ErrorCode *error) {
+  AllocateAnalyzed(EvaluateApplication, 2, error);
+  if (*error) return;
+  AnalyzePart(0, Operator(AnalyzedSource(GetArgumentList())), error);
+  if (*error) return;
+  AnalyzeListPart(1, Operands(AnalyzedSource(GetArgumentList())), ERROR_EVALUATE_APPLICATION_DOTTED_LIST, error);
+}
+
+static void AllocateAnalyzed(EvaluateFunction evaluate, u64 num_parts, enum ErrorCode *error) {
+  // REFERENCES INVALIDATED
+  Object analyzed = AllocateRecord(1 + num_parts, error);
+  if (*error) return;
+  SetRecordType(analyzed, BoxEvaluateFunction(evaluate));
+  SetRecordSlot(analyzed, 0, GetExpression());
+  SetArgumentList(analyzed);
+}
+
+static void AnalyzePart(u64 part, Object expression, enum ErrorCode *error) {
+  SetExpression(expression);
+  Save(REGISTER_ARGUMENT_LIST, error);
+  if (*error) return;
+  Analyze(error);
+  Restore(REGISTER_ARGUMENT_LIST);
+  if (*error) return;
+  SetAnalyzedPart(GetArgumentList(), part, GetValue());
+}
+
+static void AnalyzeListPart(u64 part, Object list, enum ErrorCode dotted_list_error, enum ErrorCode *error) {
+  SetUnevaluated(list);
+  Save(REGISTER_ARGUMENT_LIST, error);
+  if (*error) return;
+  // The analyzed expressions are consed onto REGISTER_ARGUMENT_LIST in reverse.
+  SetArgumentList(nil);
+  for (; !*error && IsPair(GetUnevaluated()); SetUnevaluated(Rest(GetUnevaluated()))) {
+    // The stack is reserved up front, so that it can be restored after an error.
+    Save(REGISTER_ARGUMENT_LIST, error);
+    if (*error) break;
+    Save(REGISTER_UNEVALUATED, error);
+    if (!*error) {
+      SetExpression(First(GetUnevaluated()));
+      Analyze(error);
+      Restore(REGISTER_UNEVALUATED);
+    }
+    Restore(REGISTER_ARGUMENT_LIST);
+    if (*error) break;
+
+    // REFERENCES INVALIDATED
+    Object pair = AllocatePair(error);
+    if (*error) break;
+    SetCar(pair, GetValue());
+    SetCdr(pair, GetArgumentList());
+    SetArgumentList(pair);
+  }
+  if (!*error && !IsNil(GetUnevaluated())) *error = dotted_list_error;
+
+  Object reversed = GetArgumentList();
+  Object analyzed = nil;
+  while (IsPair(reversed)) {
+    Object next_pair = Cdr(reversed);
+    SetCdr(reversed, analyzed);
+    analyzed = reversed;
+    reversed = next_pair;
+  }
+  SetValue(analyzed);
+  Restore(REGISTER_ARGUMENT_LIST);
+  if (*error) return;
+  SetAnalyzedPart(GetArgumentList(), part, GetValue());
+}
+
+static Object AnalyzedSource(Object analyzed) { return RecordSlot(analyzed, 0); }
+static Object AnalyzedPart(Object analyzed, u64 part) { return RecordSlot(analyzed, 1 + part); }
+static void SetAnalyzedPart(Object analyzed, u64 part, Object value) { SetRecordSlot(analyzed, 1 + part, value); }
+
 void EvaluateDispatch() {
   Object expression = GetExpression();
   LOG(LOG_EVALUATE, "Evaluating expression:");
   LOG_OP(LOG_EVALUATE, PrintlnObject(expression));
-
-  BRANCH(IsSelfEvaluating(expression), EvaluateSelfEvaluating);
-  BRANCH(IsVariable(expression),       EvaluateVariable);
-  BRANCH(IsQuoted(expression),         EvaluateQuoted);
-  BRANCH(IsAssignment(expression),     EvaluateAssignment);
-  BRANCH(IsDefinition(expression),     EvaluateDefinition);
-  BRANCH(IsIf(expression),             EvaluateIf);
-  BRANCH(IsLambda(expression),         EvaluateLambda);
-  BRANCH(IsBegin(expression),          EvaluateBegin);
-  BRANCH(IsApplication(expression),    EvaluateApplication);
-  GOTO(EvaluateUnknown);
+  GOTO(UnboxEvaluateFunction(RecordType(expression)));
 }
 
-void EvaluateSelfEvaluating() {
-  FINISH(GetExpression());
+void EvaluateConstant() {
+  FINISH(AnalyzedPart(GetExpression(), 0));
 }
 
 void EvaluateVariable() {
-  b64 found = 0;
-  Object value = LookupVariableValue(GetExpression(), GetEnvironment(), &found);
-  BRANCH(!found, EvaluateUnboundVariable);
-  FINISH(value);
+  Object cell = AnalyzedPart(GetExpression(), 1);
+  if (IsNil(cell)) {
+    cell = LookupGlobalCell(AnalyzedPart(GetExpression(), 0), GetEnvironment());
+    BRANCH(IsNil(cell), EvaluateUnboundVariable);
+    SetAnalyzedPart(GetExpression(), 1, cell);
+  }
+  FINISH(CellValue(cell));
 }
 
-void EvaluateUnboundVariable() {
-  LOG_ERROR("Could not find %s in environment", StringCharacterBuffer(GetExpression()));
-  ERROR(ERROR_EVALUATE_UNBOUND_VARIABLE);
+void EvaluateLocalVariable() {
+  Object expression = GetExpression();
+  FINISH(LookupLexicalAddress(UnboxFixnum(AnalyzedPart(expression, 0)), UnboxFixnum(AnalyzedPart(expression, 1)),
+      GetEnvironment()));
 }
 
-void EvaluateQuoted() {
-  Object quoted_expression;
-  CHECK(ExtractQuoted(GetExpression(), &quoted_expression, &error));
-  FINISH(quoted_expression);
+void EvaluateUnboundVariable() {
+  LOG_ERROR("Could not find %s in environment", StringCharacterBuffer(AnalyzedPart(GetExpression(), 0)));
+  ERROR(ERROR_EVALUATE_UNBOUND_VARIABLE);
 }
 
-
 void EvaluateLambda() {
-  Object parameters, body;
-  CHECK(ExtractLambdaArguments(GetExpression(), &parameters, &body, &error));
-
-  SetUnevaluated(parameters);
-  SetExpression(body);
-  
   Object procedure;
   CHECK(procedure = AllocateCompoundProcedure(&error));
 
   SetProcedureEnvironment(procedure, GetEnvironment());
-  SetProcedureParameters(procedure, GetUnevaluated());
-  SetProcedureBody(procedure, GetExpression());
+  SetProcedureParameters(procedure, AnalyzedPart(GetExpression(), 0));
+  SetProcedureBody(procedure, AnalyzedPart(GetExpression(), 1));
+  SetProcedureVariables(procedure, AnalyzedPart(GetExpression(), 2));
 
   FINISH(procedure);
 }
@@ -220,10 +560,10 @@ void EvaluateLambda() {
 void EvaluateApplication() {
   SAVE(REGISTER_CONTINUE);
   SAVE(REGISTER_ENVIRONMENT);
-  SetUnevaluated(Operands(GetExpression()));
+  SetUnevaluated(AnalyzedPart(GetExpression(), 1));
   SAVE(REGISTER_UNEVALUATED);
   // First: Evaluate the operator
-  SetExpression(Operator(GetExpression()));
+  SetExpression(AnalyzedPart(GetExpression(), 0));
   // Continue by evaluating the operands
   SetContinue(EvaluateApplicationOperands);
   // Evaluate the operator
@@ -236,6 +576,9 @@ void EvaluateApplicationOperands() {
   Restore(REGISTER_UNEVALUATED);
   Restore(REGISTER_ENVIRONMENT);
 
+  // Record procedures are applied without an argument list.
+  BRANCH(IsRecordProcedure(GetValue()), EvaluateRecordApplication);
+
   // Save the evaluated procedure.
   SetProcedure(GetValue());
   SetArgumentList(EmptyArgumentList());
@@ -296,23 +639,105 @@ void EvaluateApplicationDispatch() {
     CONTINUE;
   } else if (IsCompoundProcedure(proc)) {
     // Compound-procedure application
-    SetUnevaluated(ProcedureParameters(proc));
-    SetEnvironment(ProcedureEnvironment(proc));
     CHECK(ExtendEnvironment(&error));
-
-    proc = GetProcedure();
-    SetUnevaluated(ProcedureBody(proc));
+    SetUnevaluated(ProcedureBody(GetProcedure()));
     GOTO(EvaluateSequence);
   }
 
   ERROR(ERROR_EVALUATE_UNKNOWN_PROCEDURE_TYPE);
 }
 
-void EvaluateBegin() {
-  Object sequence;
-  CHECK(ExtractBegin(GetExpression(), &sequence, &error));
+void EvaluateRecordApplication() {
+  SetProcedure(GetValue());
+  u64 num_operands = 0;
+  Object operands = GetUnevaluated();
+  for (; IsPair(operands); operands = RestOperands(operands)) ++num_operands;
+  if (!HasNoOperands(operands)) ERROR(ERROR_EVALUATE_APPLICATION_DOTTED_LIST);
+  if (num_operands != RecordProcedureArity(GetProcedure())) ERROR(ERROR_EVALUATE_ARITY_MISMATCH);
+
+  switch (RecordProcedureKind(GetProcedure())) {
+    case RECORD_KIND_CONSTRUCTOR:
+      // The arguments are stored into the new record as they are evaluated. REFERENCES INVALIDATED
+      CHECK(SetArgumentList(AllocateRecord(num_operands, &error)));
+      SetRecordType(GetArgumentList(), RecordProcedureType(GetProcedure()));
+      BRANCH(num_operands > 0, EvaluateRecordConstructorLoop);
+      Restore(REGISTER_CONTINUE);
+      FINISH(GetArgumentList());
+    case RECORD_KIND_MODIFIER:
+      SAVE(REGISTER_PROCEDURE);
+      SAVE(REGISTER_ENVIRONMENT);
+      SAVE(REGISTER_UNEVALUATED);
+      SetContinue(EvaluateRecordModifierValue);
+      break;
+    default:
+      SAVE(REGISTER_PROCEDURE);
+      SetContinue(EvaluateRecordUnaryApplication);
+      break;
+  }
+  SetExpression(FirstOperand(GetUnevaluated()));
+  GOTO(EvaluateDispatch);
+}
+
+void EvaluateRecordConstructorLoop() {
+  SAVE(REGISTER_ARGUMENT_LIST);
+  SAVE(REGISTER_ENVIRONMENT);
+  SAVE(REGISTER_UNEVALUATED);
+  SetExpression(FirstOperand(GetUnevaluated()));
+  SetContinue(EvaluateRecordConstructorSlot);
+  GOTO(EvaluateDispatch);
+}
+
+void EvaluateRecordConstructorSlot() {
+  Restore(REGISTER_UNEVALUATED);
+  Restore(REGISTER_ENVIRONMENT);
+  Restore(REGISTER_ARGUMENT_LIST);
+
+  // The slot is found from the number of arguments left.
+  Object record = GetArgumentList();
+  u64 num_unevaluated = 0;
+  for (Object operands = GetUnevaluated(); IsPair(operands); operands = RestOperands(operands)) ++num_unevaluated;
+  SetRecordSlot(record, RecordNumSlots(record) - num_unevaluated, GetValue());
+
+  SetUnevaluated(RestOperands(GetUnevaluated()));
+  BRANCH(!HasNoOperands(GetUnevaluated()), EvaluateRecordConstructorLoop);
+  Restore(REGISTER_CONTINUE);
+  FINISH(record);
+}
+
+void EvaluateRecordUnaryApplication() {
+  Restore(REGISTER_PROCEDURE);
+  Restore(REGISTER_CONTINUE);
+  Object procedure = GetProcedure();
+  Object record = GetValue();
+  b64 is_instance = IsRecordOfType(record, RecordProcedureType(procedure));
+  if (RecordProcedureKind(procedure) == RECORD_KIND_PREDICATE) FINISH(BoxBoolean(is_instance));
+  if (!is_instance) ERROR(ERROR_EVALUATE_INVALID_ARGUMENT_TYPE);
+  FINISH(RecordSlot(record, RecordProcedureField(procedure)));
+}
+
+void EvaluateRecordModifierValue() {
+  Restore(REGISTER_UNEVALUATED);
+  Restore(REGISTER_ENVIRONMENT);
+  SetArgumentList(GetValue());
+  SAVE(REGISTER_ARGUMENT_LIST);
+  SetExpression(FirstOperand(RestOperands(GetUnevaluated())));
+  SetContinue(EvaluateRecordModify);
+  GOTO(EvaluateDispatch);
+}
 
-  SetUnevaluated(sequence);
+void EvaluateRecordModify() {
+  Restore(REGISTER_ARGUMENT_LIST);
+  Restore(REGISTER_PROCEDURE);
+  Restore(REGISTER_CONTINUE);
+  Object procedure = GetProcedure();
+  Object record = GetArgumentList();
+  if (!IsRecordOfType(record, RecordProcedureType(procedure))) ERROR(ERROR_EVALUATE_INVALID_ARGUMENT_TYPE);
+  SetRecordSlot(record, RecordProcedureField(procedure), GetValue());
+  FINISH(FindSymbol("ok"));
+}
+
+void EvaluateBegin() {
+  SetUnevaluated(AnalyzedPart(GetExpression(), 0));
   SAVE(REGISTER_CONTINUE);
   GOTO(EvaluateSequence);
 }
@@ -354,10 +779,7 @@ void EvaluateIfDecide() {
   Restore(REGISTER_ENVIRONMENT);
   Restore(REGISTER_EXPRESSION);
 
-  Object consequent, alternative;
-  CHECK(ExtractIfAlternatives(GetExpression(), &consequent, &alternative, &error));
-
-  SetExpression(IsTruthy(GetValue()) ? consequent : alternative);
+  SetExpression(AnalyzedPart(GetExpression(), IsTruthy(GetValue()) ? 1 : 2));
   GOTO(EvaluateDispatch);
 }
 
@@ -367,10 +789,7 @@ void EvaluateIf() {
   SAVE(REGISTER_CONTINUE);
   SetContinue(EvaluateIfDecide);
 
-  Object predicate;
-  CHECK(ExtractIfPredicate(GetExpression(), &predicate, &error));
-
-  SetExpression(predicate);
+  SetExpression(AnalyzedPart(GetExpression(), 0));
   GOTO(EvaluateDispatch);
 }
 
@@ -387,12 +806,9 @@ void EvaluateAssignment1() {
 
 
 void EvaluateAssignment() {
-  Object variable, value;
-  CHECK(ExtractAssignmentArguments(GetExpression(), &variable, &value, &error));
-
-  SetUnevaluated(variable);
+  SetUnevaluated(AnalyzedPart(GetExpression(), 0));
+  SetExpression(AnalyzedPart(GetExpression(), 1));
   SAVE(REGISTER_UNEVALUATED);
-  SetExpression(value);
   SAVE(REGISTER_ENVIRONMENT);
   SAVE(REGISTER_CONTINUE);
   SetContinue(EvaluateAssignment1);
@@ -410,29 +826,46 @@ void EvaluateDefinition1() {
 
 void EvaluateDefinition() {
   // (define name value)
-  Object variable, value;
-  CHECK(ExtractDefinitionArguments(GetExpression(), &variable, &value, &error));
-
-  // (define name value)
-  SetUnevaluated(variable);
+  SetUnevaluated(AnalyzedPart(GetExpression(), 0));
+  SetExpression(AnalyzedPart(GetExpression(), 1));
   SAVE(REGISTER_UNEVALUATED);
-  SetExpression(value);
   SAVE(REGISTER_ENVIRONMENT);
   SAVE(REGISTER_CONTINUE);
   SetContinue(EvaluateDefinition1);
   GOTO(EvaluateDispatch);
 }
 
-void EvaluateUnknown() {
-  LOG_ERROR("Unknown Expression");
-  LOG_OP(LOG_EVALUATE, PrintlnObject(GetExpression()));
+void EvaluateLocalAssignment1() {
+  Restore(REGISTER_CONTINUE);
+  Restore(REGISTER_ENVIRONMENT);
+  Restore(REGISTER_EXPRESSION);
+  Object expression = GetExpression();
+  SetLexicalAddress(UnboxFixnum(AnalyzedPart(expression, 1)), UnboxFixnum(AnalyzedPart(expression, 2)),
+      GetValue(), GetEnvironment());
+  FINISH(AnalyzedPart(expression, 3));
+}
 
-  ERROR(ERROR_EVALUATE_UNKNOWN_EXPRESSION);
+void EvaluateLocalAssignment() {
+  SAVE(REGISTER_EXPRESSION);
+  SAVE(REGISTER_ENVIRONMENT);
+  SAVE(REGISTER_CONTINUE);
+  SetContinue(EvaluateLocalAssignment1);
+  SetExpression(AnalyzedPart(GetExpression(), 0));
+  GOTO(EvaluateDispatch);
+}
+
+void EvaluateBytecode() {
+  // The machine may apply a primitive which evaluates, and continue is used by the evaluator.
+  SAVE(REGISTER_CONTINUE);
+  Object value;
+  CHECK(value = RunBytecode(&error));
+  Restore(REGISTER_CONTINUE);
+  FINISH(value);
 }
 
 void EvaluateError() {
+  // The error is cleared by RunEvaluation, which reports it.
   LOG_ERROR("%s", ErrorCodeString(error));
-  error = NO_ERROR;
   GOTO(0);
 }
 
@@ -449,6 +882,41 @@ void AdjoinArgument(enum ErrorCode *error) {
   SetArgumentList(SetLastCdr(GetArgumentList(), last_pair));
 }
 
+static u64 Nanoseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (u64)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static Object ReadObject(const u8 *source, enum ErrorCode *error);
+
+void BenchmarkEvaluate() {
+  const char *config_names[] = {"analyze", "bytecode", "jit"};
+  const char *program = BERT(
+      (begin
+       (define fib
+        (fn (n)
+         (if (eq? n 0) 0 (if (eq? n 1) 1 (+:binary (fib (-:binary n 1)) (fib (-:binary n 2)))))))
+       (fib 25)));
+  printf("Evaluating %s with each engine:\n", program);
+  b64 was_jit_enabled = IsJitEnabled();
+  for (u64 config = 0; config < 3; ++config) {
+    if (config == 2 && !was_jit_enabled) break;
+    InitializeMemory(1 << 16, &error);
+    InitializeSymbolTable(1, &error);
+    SetEngine(config == 0 ? ENGINE_ANALYZE : ENGINE_BYTECODE);
+    EnableJit(config == 2);
+    u64 start = Nanoseconds();
+    Object value = EvaluateInAFreshEnvironment(ReadObject(program, &error));
+    u64 nanoseconds = Nanoseconds() - start;
+    printf("  %-8s %8.3fms ", config_names[config], nanoseconds / 1e6);
+    PrintlnObject(value);
+    DestroyMemory();
+  }
+  SetEngine(ENGINE_ANALYZE);
+  EnableJit(was_jit_enabled);
+}
+
 static Object ReadObject(const u8 *source, enum ErrorCode *error) {
   *error = NO_ERROR;
   Object string = AllocateString(source, error);
@@ -464,7 +932,6 @@ void TestEvaluate() {
 
   LOG_OP(LOG_TEST, PrintlnObject(EvaluateInAFreshEnvironment(BoxFixnum(42))));
 
-#define BERT(bertscript...) #bertscript
 
   Object expression = ReadObject("'(hello world)", &error);
   LOG_OP(LOG_TEST, PrintlnObject(expression));
@@ -498,6 +965,14 @@ void TestEvaluate() {
   LOG_OP(LOG_TEST, PrintlnObject(expression));
   LOG_OP(LOG_TEST, PrintlnObject(EvaluateInAFreshEnvironment(expression)));
 
+  expression = ReadObject("((fn (x) (define y 2) y) 1 5)", &error);
+  LOG_OP(LOG_TEST, PrintlnObject(expression));
+  LOG_OP(LOG_TEST, PrintlnObject(EvaluateInAFreshEnvironment(expression)));
+
+  expression = ReadObject("((fn (x y) x) 1)", &error);
+  LOG_OP(LOG_TEST, PrintlnObject(expression));
+  LOG_OP(LOG_TEST, PrintlnObject(EvaluateInAFreshEnvironment(expression)));
+
   expression = ReadObject("+:binary", &error);
   LOG_OP(LOG_TEST, PrintlnObject(expression));
   LOG_OP(LOG_TEST, PrintlnObject(EvaluateInAFreshEnvironment(expression)));
@@ -555,6 +1030,41 @@ void TestEvaluate() {
   LOG_OP(LOG_TEST, PrintlnObject(expression));
   LOG_OP(LOG_TEST, PrintlnObject(EvaluateInAFreshEnvironment(expression)));
 
+  expression = ReadObject("(vector-length (gc-statistics))", &error);
+  LOG_OP(LOG_TEST, PrintlnObject(expression));
+  LOG_OP(LOG_TEST, PrintlnObject(EvaluateInAFreshEnvironment(expression)));
+
+  expression = ReadObject("(byte-vector-pinned? (allocate-pinned-byte-vector 16))", &error);
+  LOG_OP(LOG_TEST, PrintlnObject(expression));
+  LOG_OP(LOG_TEST, PrintlnObject(EvaluateInAFreshEnvironment(expression)));
+
+  // Procedure bodies are analyzed once, however many times they are applied.
+  expression = ReadObject(BERT(
+        (begin
+         (define count-down
+          (fn (n)
+           (if (eq? n 0) (quote done) (count-down (-:binary n 1)))))
+         (count-down 1000))), &error);
+  LOG_OP(LOG_TEST, PrintlnObject(expression));
+  LOG_OP(LOG_TEST, PrintlnObject(EvaluateInAFreshEnvironment(expression)));
+
+  // Syntax errors are found by analysis, before anything is evaluated.
+  expression = ReadObject("(begin (define x 1) (fn () (if x)))", &error);
+  LOG_OP(LOG_TEST, PrintlnObject(expression));
+  LOG_OP(LOG_TEST, PrintlnObject(EvaluateInAFreshEnvironment(expression)));
+
+  expression = ReadObject(BERT(
+        (begin
+         (define point (make-record-type (quote point) (quote (x y))))
+         (define make-point (record-constructor point))
+         (define point-x (record-accessor point (quote x)))
+         (define set-point-y! (record-modifier point (quote y)))
+         (define p (make-point 3 4))
+         (set-point-y! p (point-x p))
+         (list p ((record-predicate point) p) (record? p) (record? point) make-point set-point-y!))), &error);
+  LOG_OP(LOG_TEST, PrintlnObject(expression));
+  LOG_OP(LOG_TEST, PrintlnObject(EvaluateInAFreshEnvironment(expression)));
+
   expression = ReadObject(BERT(
         (begin
          (define read-entire-file
@@ -570,5 +1080,133 @@ void TestEvaluate() {
 
   LOG_OP(LOG_TEST, PrintlnObject(expression));
   LOG_OP(LOG_TEST, PrintlnObject(EvaluateInAFreshEnvironment(expression)));
+
+  // The bytecode engine gives the same values as the analyzing evaluator.
+  // They are immediates, so they aren't moved by the collections of the next evaluation.
+  const char *programs[] = {
+    "(begin (define x 42) x)",
+    "((fn (x y z) z) 1 2 3)",
+    "(((fn (z) (fn () z)) 3))",
+    "(-:binary (+:binary 720 360) 14)",
+    "(begin (define x 1) (set! x (+:binary x 1)) x)",
+    "(if (eq? 1 2) 1 (if (eq? 2 2) 2 3))",
+    "(evaluate (quote (+:binary 1 2)))",
+    BERT(
+        (begin
+         (define count-down
+          (fn (n)
+           (if (eq? n 0) (quote done) (count-down (-:binary n 1)))))
+         (eq? (count-down 1000) (quote done)))),
+    BERT(
+        (begin
+         (define fib
+          (fn (n)
+           (if (eq? n 0) 0 (if (eq? n 1) 1 (+:binary (fib (-:binary n 1)) (fib (-:binary n 2)))))))
+         (fib 15))),
+    BERT(
+        (begin
+         (define point (make-record-type (quote point) (quote (x y))))
+         (define p ((record-constructor point) 3 4))
+         ((record-modifier point (quote x)) p 5)
+         ((fn (x) (+:binary x ((record-accessor point (quote y)) p))) ((record-accessor point (quote x)) p)))),
+    // Machine code leaves mixed and overflowing arithmetic to the primitives.
+    BERT(
+        (begin
+         (define square (fn (x) (*:binary x x)))
+         (define sum-squares
+          (fn (n total)
+           (if (eq? n 0) total (sum-squares (-:binary n 1) (+:binary total (square 15e-1))))))
+         (eq? (sum-squares 300 0) (sum-squares 300 0e0)))),
+    BERT(
+        (begin
+         (define grow (fn (n x) (if (eq? n 0) x (grow (-:binary n 1) (*:binary x 2)))))
+         (grow 200 1))),
+    // Local variables are found by their lexical address, in the frames of the procedures around them.
+    "((((fn (a) (fn (b) (fn (c) (-:binary a c)))) 10) 20) 3)",
+    "(begin (define x 1) ((fn (x) ((fn (y) (+:binary x y)) 10)) 2))",
+    "((fn (x) (define x 5) x) 1)",
+    BERT(
+        (begin
+         (define make-counter (fn (count) (fn () (set! count (+:binary count 1)) count)))
+         (define counter (make-counter 10))
+         (counter)
+         (counter))),
+    BERT(
+        (begin
+         (define sum-to
+          (fn (n)
+           (define loop (fn (i total) (if (eq? i 0) total (loop (-:binary i 1) (+:binary total i)))))
+           (loop n 0)))
+         (sum-to 100))),
+    // Evaluate sees the local variables of the procedures it's called in.
+    "(begin (define x 1) ((fn (x) (evaluate (quote x))) 2))",
+    "((fn (a) ((fn (b) (evaluate (quote (-:binary a b)))) 1)) 10)",
+    "((fn (x) (evaluate (quote (set! x 3))) x) 1)",
+    // References cache the cells of global variables, which definitions and assignments update in place.
+    BERT(
+        (begin
+         (define f (fn () 1))
+         (define g (fn () (f)))
+         (g)
+         (define f (fn () 2))
+         (g))),
+    "(begin (define y 1) (define get (fn () y)) (get) (set! y 3) (get))",
+    "(begin (define h (fn () later)) (define later 5) (h))",
+  };
+  // With the JIT, the procedures which are called often enough are run as machine code.
+  b64 was_jit_enabled = IsJitEnabled();
+  for (u64 i = 0; i < sizeof(programs) / sizeof(programs[0]); ++i) {
+    // Analyzed, bytecode, and bytecode with the JIT.
+    Object values[3];
+    for (u64 config = 0; config < 3; ++config) {
+      SetEngine(config == 0 ? ENGINE_ANALYZE : ENGINE_BYTECODE);
+      EnableJit(was_jit_enabled && config == 2);
+      expression = ReadObject(programs[i], &error);
+      values[config] = EvaluateInAFreshEnvironment(expression);
+    }
+    LOG_OP(LOG_TEST, PrintlnObject(values[2]));
+    assert(values[0] == values[1] && values[1] == values[2]);
+  }
+  EnableJit(was_jit_enabled);
+  for (u64 config = 0; config < 2; ++config) {
+    SetEngine(config == 0 ? ENGINE_ANALYZE : ENGINE_BYTECODE);
+    expression = ReadObject("((fn (x) (evaluate (quote x))) 2)", &error);
+    assert(EvaluateInAFreshEnvironment(expression) == BoxFixnum(2));
+  }
+
+  // Errors are reported by the compiler, and by the machine.
+  SetEngine(ENGINE_BYTECODE);
+  expression = ReadObject("(begin (define x 1) (fn () (if x)))", &error);
+  LOG_OP(LOG_TEST, PrintlnObject(EvaluateInAFreshEnvironment(expression)));
+  expression = ReadObject("(begin (define x 1) (y x))", &error);
+  LOG_OP(LOG_TEST, PrintlnObject(EvaluateInAFreshEnvironment(expression)));
+  assert(StackSize() == 0);
+  // A procedure takes exactly one argument for each parameter. An extra one doesn't bind a variable of the body.
+  expression = ReadObject("((fn (x) (define y 2) y) 1 5)", &error);
+  assert(IsNil(EvaluateInAFreshEnvironment(expression)));
+  expression = ReadObject("((fn (x y) x) 1)", &error);
+  assert(IsNil(EvaluateInAFreshEnvironment(expression)));
+  assert(StackSize() == 0);
+
+  // Procedures made by either engine can be applied by the other.
+  SetEngine(ENGINE_ANALYZE);
+  EvaluateInAFreshEnvironment(ReadObject("(define twice (fn (x) (+:binary x x)))", &error));
+  SetEngine(ENGINE_BYTECODE);
+  assert(Evaluate(ReadObject("(twice 21)", &error)) == BoxFixnum(42));
+  Evaluate(ReadObject("(define add-twice (fn (x y) (+:binary x (twice y))))", &error));
+  assert(Evaluate(ReadObject("(+:binary (add-twice 1 2) 1)", &error)) == BoxFixnum(6));
+  SetEngine(ENGINE_ANALYZE);
+  assert(Evaluate(ReadObject("(add-twice 1 2)", &error)) == BoxFixnum(5));
+  // An error in the analyzed body leaves the machine's stack as it was.
+  SetEngine(ENGINE_BYTECODE);
+  assert(IsNil(Evaluate(ReadObject("(add-twice 1 (quote y))", &error))));
+  assert(StackSize() == 0);
+
+  expression = ReadObject("(fn (n) (if (eq? n 0) (quote done) (count-down (-:binary n 1))))", &error);
+  SetExpression(expression);
+  Compile(&error);
+  assert(!error);
+  LOG_OP(LOG_TEST, PrintBytecode(GetValue()));
+  SetEngine(ENGINE_ANALYZE);
   DestroyMemory();
 }
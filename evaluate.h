@@ -1,11 +1,31 @@
 #ifndef EVALUATE_H
 #define EVALUATE_H
 
+#include "error.h"
 #include "tag.h"
 
 // TODO: handle evaluating true/false
 Object Evaluate(Object expression);
 
+// The engine Evaluate uses.
+enum Engine {
+  // Analyze the expression, and evaluate the analyzed expression (see evaluate.c).
+  ENGINE_ANALYZE,
+  // Compile the expression to bytecode, and run it (see bytecode.h).
+  ENGINE_BYTECODE,
+};
+void SetEngine(enum Engine engine);
+
+// Apply a compound procedure made by the analyzing evaluator to the list of arguments, and return the value.
+// Lets the bytecode machine call procedures it didn't compile. REFERENCES INVALIDATED
+Object ApplyCompoundProcedure(Object procedure, Object arguments, enum ErrorCode *error);
+
+// The EvaluateFunction of bytecode: runs the code in REGISTER_EXPRESSION.
+void EvaluateBytecode();
+
+// Time each engine evaluating the same programs.
+void BenchmarkEvaluate();
+
 void TestEvaluate();
 
 #endif
@@ -91,7 +91,7 @@ void ExtractIfAlternatives(Object expression, Object *consequent, Object *altern
 
   // (if predicate consequent alternative ...)
   *alternative = First(expression);
-  ENSURE(IsNil(expression), ERROR_EVALUATE_IF_TOO_MANY_ARGUMENTS, error);
+  ENSURE(IsNil(Rest(expression)), ERROR_EVALUATE_IF_TOO_MANY_ARGUMENTS, error);
 }
 
 void ExtractAssignmentOrDefinitionArguments(Object expression, Object *variable, Object *value, 
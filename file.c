@@ -0,0 +1,54 @@
+#include "file.h"
+
+#include <assert.h>
+
+#include "allocation_profiler.h"
+#include "blob.h"
+#include "finalization.h"
+#include "log.h"
+#include "memory.h"
+
+static void FinalizeFile(void *stream);
+
+Object AllocateFile(FILE *stream, enum ErrorCode *error) {
+  u64 new_reference = AllocateBlob(sizeof(FILE*), error);
+  if (*error) return nil;
+  ProfileAllocation(TAG_FILE, NumObjectsPerBlob(sizeof(FILE*)), __builtin_return_address(0));
+  // [ ..., 8, free.. ]
+  memory.the_objects[new_reference + 1] = (Object)stream;
+  // [ ..., 8, FILE*, free.. ]
+  Object file = BoxFile(new_reference);
+  if (!RegisterFinalizer(file, FinalizeFile, stream)) {
+    *error = ERROR_COULD_NOT_ALLOCATE_HEAP_BUFFER;
+    return nil;
+  }
+  return file;
+}
+
+Object MoveFile(Object file) {
+  return BoxFile(MoveBlob(UnboxReference(file)));
+}
+
+FILE *FileStream(Object file) {
+  assert(IsFile(file));
+  return (FILE*)memory.the_objects[UnboxReference(file) + 1];
+}
+
+void CloseFile(Object file, enum ErrorCode *error) {
+  FILE *stream = FileStream(file);
+  if (!stream) return;
+  CancelFinalizer(stream);
+  memory.the_objects[UnboxReference(file) + 1] = 0;
+  if (fclose(stream)) *error = ERROR_COULD_NOT_CLOSE_FILE;
+}
+
+void PrintFile(Object file) {
+  FILE *stream = FileStream(file);
+  if (stream) printf("<file %p>", (void*)stream);
+  else printf("<closed file>");
+}
+
+static void FinalizeFile(void *stream) {
+  LOG(LOG_MEMORY, "Closing the FILE* of a collected file\n");
+  if (fclose((FILE*)stream)) LOG_ERROR("Could not close the FILE* of a collected file");
+}
@@ -0,0 +1,24 @@
+#ifndef FILE_H
+#define FILE_H
+
+#include <stdio.h>
+
+#include "error.h"
+#include "tag.h"
+
+// A File is a Blob holding a FILE*: [ 8, FILE* ]
+// The FILE* is closed when the file is closed explicitly, or else by a finalizer once the file is collected.
+// A closed file holds a null FILE*.
+
+// Allocate a file holding stream. On error, stream is left open.
+Object AllocateFile(FILE *stream, enum ErrorCode *error);
+Object MoveFile(Object file);
+
+// Returns the FILE* of file, or 0 if it has been closed.
+FILE *FileStream(Object file);
+// Close the FILE* of file, and cancel its finalizer.
+void CloseFile(Object file, enum ErrorCode *error);
+
+void PrintFile(Object file);
+
+#endif
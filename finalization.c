@@ -0,0 +1,91 @@
+#include "finalization.h"
+
+#include <stdlib.h>
+
+#include "log.h"
+#include "memory.h"
+
+struct FinalizableObject {
+  Object object;
+  Finalizer finalize;
+  void *resource;
+};
+
+// The objects with finalizers which may still be alive.
+static struct FinalizableObject *finalizable_objects;
+static u64 num_finalizable_objects;
+static u64 max_finalizable_objects;
+
+// The finalizers of dead objects, which haven't been run yet.
+// Objects only leave the table by dying, so the queue never holds more than the table did.
+static struct FinalizableObject *finalization_queue;
+static u64 num_queued_finalizers;
+
+b64 RegisterFinalizer(Object object, Finalizer finalize, void *resource) {
+  if (num_finalizable_objects == max_finalizable_objects) {
+    u64 new_max_finalizable_objects = max_finalizable_objects ? 2*max_finalizable_objects : 16;
+    struct FinalizableObject *new_finalizable_objects = (struct FinalizableObject *)realloc(
+        finalizable_objects, sizeof(struct FinalizableObject)*new_max_finalizable_objects);
+    if (!new_finalizable_objects) {
+      LOG_ERROR("Could not grow the finalizer table to %llu objects", new_max_finalizable_objects);
+      return 0;
+    }
+    finalizable_objects = new_finalizable_objects;
+    struct FinalizableObject *new_finalization_queue = (struct FinalizableObject *)realloc(
+        finalization_queue, sizeof(struct FinalizableObject)*new_max_finalizable_objects);
+    if (!new_finalization_queue) {
+      LOG_ERROR("Could not grow the finalization queue to %llu objects", new_max_finalizable_objects);
+      // The table has grown, which leaves the queue and the table as large as before.
+      return 0;
+    }
+    finalization_queue = new_finalization_queue;
+    max_finalizable_objects = new_max_finalizable_objects;
+  }
+  struct FinalizableObject *finalizable = &finalizable_objects[num_finalizable_objects++];
+  finalizable->object = object;
+  finalizable->finalize = finalize;
+  finalizable->resource = resource;
+  return 1;
+}
+
+void CancelFinalizer(void *resource) {
+  for (u64 i = 0; i < num_finalizable_objects; ++i) {
+    if (finalizable_objects[i].resource != resource) continue;
+    finalizable_objects[i] = finalizable_objects[--num_finalizable_objects];
+    return;
+  }
+}
+
+void UpdateFinalizers() {
+  u64 num_kept = 0;
+  for (u64 i = 0; i < num_finalizable_objects; ++i) {
+    struct FinalizableObject finalizable = finalizable_objects[i];
+    finalizable.object = SurvivingObject(finalizable.object);
+    if (IsNil(finalizable.object)) finalization_queue[num_queued_finalizers++] = finalizable;
+    else finalizable_objects[num_kept++] = finalizable;
+  }
+  LOG(LOG_MEMORY, "%llu of %llu finalizable objects survived\n", num_kept, num_finalizable_objects);
+  num_finalizable_objects = num_kept;
+}
+
+void RunFinalizers() {
+  if (num_queued_finalizers == 0) return;
+  LOG(LOG_MEMORY, "Running %llu finalizers\n", num_queued_finalizers);
+  for (u64 i = 0; i < num_queued_finalizers; ++i) {
+    finalization_queue[i].finalize(finalization_queue[i].resource);
+  }
+  num_queued_finalizers = 0;
+}
+
+void DestroyFinalizers() {
+  for (u64 i = 0; i < num_finalizable_objects; ++i) {
+    finalization_queue[num_queued_finalizers++] = finalizable_objects[i];
+  }
+  num_finalizable_objects = 0;
+  RunFinalizers();
+  free(finalizable_objects);
+  free(finalization_queue);
+  finalizable_objects = 0;
+  finalization_queue = 0;
+  max_finalizable_objects = 0;
+}
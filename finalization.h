@@ -0,0 +1,30 @@
+#ifndef FINALIZATION_H
+#define FINALIZATION_H
+
+#include "tag.h"
+
+// A finalizer releases a resource held outside of memory (e.g. a FILE*) once the object holding it is collected.
+//
+// Every finalizable object is recorded in a table, along with its finalizer and resource.
+// At the end of each collection, the table is used to update the references of the objects which moved,
+// and the finalizers of the objects which died are moved to the finalization queue.
+// The queue is run in a batch once the collection is complete, never while objects are being scanned.
+// A dead object's contents are garbage by then, so finalizers only receive the resource.
+//
+// Finalizers must not allocate.
+typedef void (*Finalizer)(void *resource);
+
+// Run finalize(resource) once object is collected. Returns false if the table couldn't grow.
+b64 RegisterFinalizer(Object object, Finalizer finalize, void *resource);
+// Forget the finalizer for resource, e.g. once the resource has been released explicitly.
+void CancelFinalizer(void *resource);
+
+// Collector internals.
+// Queue the finalizers of the recorded objects which died, once every reachable object has been moved.
+void UpdateFinalizers();
+// Run and empty the finalization queue.
+void RunFinalizers();
+// Run every finalizer, whether or not its object is reachable, and forget them.
+void DestroyFinalizers();
+
+#endif
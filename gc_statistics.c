@@ -0,0 +1,117 @@
+#include "gc_statistics.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "memory.h"
+#include "vector.h"
+
+struct GCStatistics gc_statistics;
+
+// The JSON-lines log of every collection, or 0 if it isn't open.
+static FILE *gc_log;
+
+static const char *CollectionKindString(enum CollectionKind kind);
+static void LogCollection(struct CollectionStatistics collection);
+
+void ResetGCStatistics() {
+  memset(&gc_statistics, 0, sizeof(gc_statistics));
+}
+
+void RecordPause(u64 nanoseconds) {
+  u64 bucket = nanoseconds ? 63 - __builtin_clzll(nanoseconds) : 0;
+  if (bucket >= NUM_PAUSE_BUCKETS) bucket = NUM_PAUSE_BUCKETS - 1;
+  ++gc_statistics.pause_histogram[bucket];
+  ++gc_statistics.num_pauses;
+  if (nanoseconds > gc_statistics.max_pause_nanoseconds) gc_statistics.max_pause_nanoseconds = nanoseconds;
+}
+
+void RecordCollection(struct CollectionStatistics collection) {
+  gc_statistics.last_collection = collection;
+  if (gc_log) LogCollection(collection);
+}
+
+b64 OpenGCLog(const u8 *path) {
+  CloseGCLog();
+  gc_log = fopen(path, "a");
+  if (!gc_log) {
+    LOG_ERROR("Could not open the GC log %s", path);
+    return 0;
+  }
+  return 1;
+}
+
+void CloseGCLog() {
+  if (gc_log) fclose(gc_log);
+  gc_log = 0;
+}
+
+u64 SurvivalPercent(struct CollectionStatistics collection) {
+  return collection.objects_condemned ? 100*collection.objects_survived / collection.objects_condemned : 0;
+}
+
+u64 AllocationRate(struct CollectionStatistics collection) {
+  if (collection.mutator_nanoseconds == 0) return 0;
+  return (u64)(collection.objects_allocated * 1e9 / collection.mutator_nanoseconds);
+}
+
+u64 PausePercentile(u64 percent) {
+  if (gc_statistics.num_pauses == 0) return 0;
+  // The number of pauses which must be at most the result.
+  u64 num_pauses = (gc_statistics.num_pauses*percent + 99) / 100;
+  u64 count = 0;
+  for (u64 bucket = 0; bucket < NUM_PAUSE_BUCKETS; ++bucket) {
+    count += gc_statistics.pause_histogram[bucket];
+    if (count >= num_pauses) return 1ull << (bucket + 1);
+  }
+  return gc_statistics.max_pause_nanoseconds;
+}
+
+Object GCStatisticsVector(enum ErrorCode *error) {
+  Object vector = AllocateVector(NUM_GC_STATISTICS_FIELDS, error);
+  if (*error) return nil;
+  struct CollectionStatistics last = gc_statistics.last_collection;
+  u64 fields[GC_STATISTICS_PAUSE_HISTOGRAM] = {
+    [GC_STATISTICS_COLLECTIONS]           = memory.num_collections,
+    [GC_STATISTICS_YOUNG_COLLECTIONS]     = memory.num_young_collections,
+    [GC_STATISTICS_GC_NANOSECONDS]        = memory.num_gc_nanoseconds,
+    [GC_STATISTICS_PAUSES]                = gc_statistics.num_pauses,
+    [GC_STATISTICS_MAX_PAUSE_NANOSECONDS] = gc_statistics.max_pause_nanoseconds,
+    [GC_STATISTICS_LAST_GC_NANOSECONDS]   = last.gc_nanoseconds,
+    [GC_STATISTICS_LAST_OBJECTS_BEFORE]   = last.objects_before,
+    [GC_STATISTICS_LAST_OBJECTS_AFTER]    = last.objects_after,
+    [GC_STATISTICS_LAST_SURVIVAL_PERCENT] = SurvivalPercent(last),
+    [GC_STATISTICS_LAST_ALLOCATION_RATE]  = AllocationRate(last),
+  };
+  for (u64 i = 0; i < GC_STATISTICS_PAUSE_HISTOGRAM; ++i) UnsafeVectorSet(vector, i, BoxFixnum(fields[i]));
+  for (u64 i = 0; i < NUM_PAUSE_BUCKETS; ++i) {
+    UnsafeVectorSet(vector, GC_STATISTICS_PAUSE_HISTOGRAM + i, BoxFixnum(gc_statistics.pause_histogram[i]));
+  }
+  return vector;
+}
+
+static const char *CollectionKindString(enum CollectionKind kind) {
+  switch (kind) {
+    case COLLECTION_YOUNG:       return "young";
+    case COLLECTION_FULL:        return "full";
+    case COLLECTION_INCREMENTAL: return "incremental";
+    case COLLECTION_COMPACTING:  return "compacting";
+  }
+  return "unknown";
+}
+
+static void LogCollection(struct CollectionStatistics collection) {
+  fprintf(gc_log,
+      "{\"collection\":%llu,\"kind\":\"%s\",\"gc_ns\":%llu,\"objects_before\":%llu,\"objects_after\":%llu,"
+      "\"objects_condemned\":%llu,\"objects_survived\":%llu,\"survival_percent\":%llu,"
+      "\"objects_allocated\":%llu,\"mutator_ns\":%llu,\"allocation_rate\":%llu}\n",
+      (unsigned long long)collection.number, CollectionKindString(collection.kind),
+      (unsigned long long)collection.gc_nanoseconds,
+      (unsigned long long)collection.objects_before, (unsigned long long)collection.objects_after,
+      (unsigned long long)collection.objects_condemned, (unsigned long long)collection.objects_survived,
+      (unsigned long long)SurvivalPercent(collection),
+      (unsigned long long)collection.objects_allocated, (unsigned long long)collection.mutator_nanoseconds,
+      (unsigned long long)AllocationRate(collection));
+  fflush(gc_log);
+}
@@ -0,0 +1,87 @@
+#ifndef GC_STATISTICS_H
+#define GC_STATISTICS_H
+
+#include "error.h"
+#include "tag.h"
+
+// Statistics are gathered for every collection, and for every pause.
+// A pause is a stretch of time the mutator is stopped to collect garbage: a whole young, full or compacting
+// collection, or a single step of an incremental collection.
+// Pause times are counted in a fixed-size histogram with a bucket per power of 2 nanoseconds.
+// Collections can also be logged as JSON lines, one line per collection.
+
+enum CollectionKind {
+  COLLECTION_YOUNG,
+  COLLECTION_FULL,
+  COLLECTION_INCREMENTAL,
+  COLLECTION_COMPACTING,
+};
+
+struct CollectionStatistics {
+  enum CollectionKind kind;
+  // The value of memory.num_collections for this collection.
+  u64 number;
+  // The time spent collecting. Incremental collections count each of their pauses.
+  u64 gc_nanoseconds;
+  // The objects in use by the nursery, the current space and the large object space, before and after the collection.
+  u64 objects_before;
+  u64 objects_after;
+  // The objects condemned by the collection, and the number of those which were moved or kept.
+  u64 objects_condemned;
+  u64 objects_survived;
+  // The objects allocated, and the time elapsed, between the end of the previous collection and the start of this one.
+  u64 objects_allocated;
+  u64 mutator_nanoseconds;
+};
+
+// pause_histogram[i] counts the pauses which took [2^i, 2^(i+1)) nanoseconds. Bucket 0 also counts pauses of 0.
+#define NUM_PAUSE_BUCKETS 48
+
+struct GCStatistics {
+  u64 pause_histogram[NUM_PAUSE_BUCKETS];
+  u64 num_pauses;
+  u64 max_pause_nanoseconds;
+  // The most recently completed collection.
+  struct CollectionStatistics last_collection;
+};
+extern struct GCStatistics gc_statistics;
+
+// The layout of the vector returned by GCStatisticsVector (and the gc-statistics primitive).
+enum GCStatisticsField {
+  GC_STATISTICS_COLLECTIONS,
+  GC_STATISTICS_YOUNG_COLLECTIONS,
+  GC_STATISTICS_GC_NANOSECONDS,
+  GC_STATISTICS_PAUSES,
+  GC_STATISTICS_MAX_PAUSE_NANOSECONDS,
+  GC_STATISTICS_LAST_GC_NANOSECONDS,
+  GC_STATISTICS_LAST_OBJECTS_BEFORE,
+  GC_STATISTICS_LAST_OBJECTS_AFTER,
+  GC_STATISTICS_LAST_SURVIVAL_PERCENT,
+  // Objects allocated per second between the last two collections.
+  GC_STATISTICS_LAST_ALLOCATION_RATE,
+  // Followed by the NUM_PAUSE_BUCKETS counts of the pause histogram.
+  GC_STATISTICS_PAUSE_HISTOGRAM,
+  NUM_GC_STATISTICS_FIELDS = GC_STATISTICS_PAUSE_HISTOGRAM + NUM_PAUSE_BUCKETS,
+};
+
+// Forget every pause and collection.
+void ResetGCStatistics();
+void RecordPause(u64 nanoseconds);
+// Record a completed collection, and log it if the GC log is open.
+void RecordCollection(struct CollectionStatistics collection);
+
+// Append a JSON line to the file at path for every collection. Returns false if the file couldn't be opened.
+b64 OpenGCLog(const u8 *path);
+void CloseGCLog();
+
+// The percentage of condemned objects which survived collection.
+u64 SurvivalPercent(struct CollectionStatistics collection);
+// The objects allocated per second before collection.
+u64 AllocationRate(struct CollectionStatistics collection);
+// Returns an upper bound on the time taken by percent% of the pauses.
+u64 PausePercentile(u64 percent);
+
+// Allocate a vector of fixnums laid out according to GCStatisticsField.
+Object GCStatisticsVector(enum ErrorCode *error);
+
+#endif
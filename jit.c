@@ -0,0 +1,537 @@
+#include "jit.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytecode.h"
+#include "environment.h"
+#include "log.h"
+#include "memory.h"
+#include "pair.h"
+#include "primitives.h"
+#include "root.h"
+#include "string.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+// The machine code of a translation is called with the address of the template to start at,
+// and returns the program counter of the instruction to leave to the machine:
+//   u64 (*)(const u8 *entry)
+// rbx holds &memory throughout, so the control stack is reached through memory.stack and memory.stack_size.
+// Nothing is kept in registers across the templates, or across calls into C.
+struct Translation {
+  u8 *machine_code;
+  u64 size;
+  // entries[pc] is the offset of the template of the instruction at pc.
+  u32 *entries;
+};
+
+// -1 until it is read from the environment.
+static int is_jit_enabled = -1;
+static u64 jit_threshold = 100;
+
+static struct Translation *translations;
+static u64 num_translations;
+static u64 max_translations;
+
+#if JIT_SUPPORTED
+
+// The machine code being assembled.
+struct Assembler {
+  u8 *bytes;
+  u64 size;
+  u64 max_size;
+  b64 is_out_of_memory;
+  // Jumps to the templates of instructions, and to the exits which return instructions to the machine.
+  // They are patched once every template has been assembled.
+  struct Fixup *fixups;
+  u64 num_fixups;
+  u64 max_fixups;
+};
+
+enum FixupKind {
+  FIXUP_ENTRY,
+  FIXUP_EXIT,
+};
+
+struct Fixup {
+  enum FixupKind kind;
+  // The offset of the rel32 to patch.
+  u64 offset;
+  u64 pc;
+};
+
+// x86-64 condition codes, for Jcc.
+enum Condition {
+  CONDITION_OVERFLOW       = 0x0,
+  CONDITION_ABOVE_OR_EQUAL = 0x3,
+  CONDITION_EQUAL          = 0x4,
+  CONDITION_NOT_EQUAL      = 0x5,
+  // Not a condition code: an unconditional jump.
+  CONDITION_ALWAYS         = 0x10,
+};
+
+// The offset of the epilogue, which returns eax.
+#define EPILOGUE_OFFSET 13
+// The NaN-box encoding (see tag.c).
+#define TAGGED_OBJECT_MASK 0xFFF8000000000000
+#define FIXNUM_METADATA    0xFFF9800000000000
+#define PAYLOAD_MASK       0x00007FFFFFFFFFFF
+// The top 17 bits of a fixnum.
+#define FIXNUM_METADATA_BITS (FIXNUM_METADATA >> 47)
+
+static void EmitBytes(struct Assembler *assembler, const u8 *bytes, u64 num_bytes);
+#define EMIT(assembler, bytes...) \
+  do { const u8 emitted[] = {bytes}; EmitBytes((assembler), emitted, sizeof(emitted)); } while (0)
+static void EmitU32(struct Assembler *assembler, u32 value);
+static void EmitU64(struct Assembler *assembler, u64 value);
+// A memory operand [rbx + offset] of memory's field.
+static void EmitMemoryField(struct Assembler *assembler, u64 offset);
+// Emit a jump with an unpatched rel32, and return the offset of the rel32.
+static u64 EmitJump(struct Assembler *assembler, enum Condition condition);
+// Point the jump whose rel32 is at offset to the next byte emitted.
+static void PatchJumpHere(struct Assembler *assembler, u64 offset);
+static void AddFixup(struct Assembler *assembler, enum FixupKind kind, u64 offset, u64 pc);
+// Leave the instruction at pc to the machine if condition holds.
+static void EmitExitIf(struct Assembler *assembler, enum Condition condition, u64 pc);
+// mov eax, pc; jmp epilogue
+static void EmitExit(struct Assembler *assembler, u64 pc);
+
+// The templates. Each is given the program counter of its instruction, to leave it to the machine.
+static void EmitPushRdx(struct Assembler *assembler, u64 pc);
+static void EmitCallHelper(struct Assembler *assembler, u64 (*helper)(u64 operand), u64 operand, u64 pc);
+static void EmitJumpIfFalse(struct Assembler *assembler, u64 target);
+// A call with two arguments of +:binary, -:binary, *:binary or eq? is inlined. Other procedures are left to the machine.
+static void EmitBinaryCall(struct Assembler *assembler, u64 pc);
+// rax = rsi op rdi, if both are fixnums or both are reals.
+static void EmitArithmetic(struct Assembler *assembler, u8 fixnum_opcode, u8 real_opcode, u64 pc);
+
+// Called from machine code with the operand of the instruction. Return false to leave the instruction to the machine.
+static u64 PushConstant(u64 index);
+static u64 PushVariableValue(u64 index);
+static u64 PushLocalValue(u64 address);
+
+// Map the assembled machine code executable.
+static u8 *MapMachineCode(const u8 *bytes, u64 size);
+static void WritePerfMap(Object code, const struct Translation *translation);
+
+#endif
+
+b64 IsJitEnabled() {
+#if JIT_SUPPORTED
+  if (is_jit_enabled < 0) {
+    const char *value = getenv("LISP_JIT");
+    is_jit_enabled = !(value && !strcmp(value, "0"));
+  }
+  return is_jit_enabled;
+#else
+  return 0;
+#endif
+}
+
+void EnableJit(b64 enable) { is_jit_enabled = enable; }
+u64 JitThreshold() { return jit_threshold; }
+void SetJitThreshold(u64 threshold) { jit_threshold = threshold; }
+
+u64 RunTranslation(s64 translation, u64 pc) {
+  const struct Translation *t = &translations[translation];
+  return ((u64 (*)(const u8 *entry))t->machine_code)(t->machine_code + t->entries[pc]);
+}
+
+#if JIT_SUPPORTED
+
+s64 TranslateBytecode(Object code) {
+  if (num_translations == max_translations) {
+    u64 new_max_translations = max_translations ? 2*max_translations : 64;
+    struct Translation *new_translations = realloc(translations, sizeof(struct Translation)*new_max_translations);
+    if (!new_translations) return -1;
+    translations = new_translations;
+    max_translations = new_max_translations;
+  }
+
+  const u8 *bytes = CodeBytes(code);
+  u64 num_bytes = CodeNumBytes(code);
+  struct Assembler assembler = {0};
+  u32 *entries = calloc(num_bytes, sizeof(u32));
+  u32 *exits = malloc(sizeof(u32)*num_bytes);
+  if (!entries || !exits) assembler.is_out_of_memory = 1;
+
+  // The prologue keeps rbx for the caller, and jumps to the entry.
+  EMIT(&assembler, 0x53);                    // push rbx
+  EMIT(&assembler, 0x48, 0xBB);              // mov rbx, &memory
+  EmitU64(&assembler, (u64)&memory);
+  EMIT(&assembler, 0xFF, 0xE7);              // jmp rdi
+  EMIT(&assembler, 0x5B, 0xC3);              // pop rbx; ret
+
+  for (u64 pc = 0; pc < num_bytes && !assembler.is_out_of_memory;) {
+    u64 instruction_pc = pc;
+    entries[pc] = assembler.size;
+    enum Opcode opcode = bytes[pc++];
+    u64 operand = (opcode == OP_POP || opcode == OP_RETURN) ? 0 : ReadOperand(bytes, &pc);
+    // The depth and index of a lexical address are passed to helpers as one operand.
+    if (opcode == OP_LOCAL || opcode == OP_SET_LOCAL) operand = operand << 16 | ReadOperand(bytes, &pc);
+    switch (opcode) {
+      case OP_CONSTANT: {
+        Object constant = CodeConstant(code, operand);
+        if (IsReference(constant)) {
+          EmitCallHelper(&assembler, PushConstant, operand, instruction_pc);
+        } else {
+          EMIT(&assembler, 0x48, 0xBA);      // mov rdx, constant
+          EmitU64(&assembler, constant);
+          EmitPushRdx(&assembler, instruction_pc);
+        }
+        break;
+      }
+      case OP_LOOKUP:
+        EmitCallHelper(&assembler, PushVariableValue, operand, instruction_pc);
+        break;
+      case OP_LOCAL:
+        EmitCallHelper(&assembler, PushLocalValue, operand, instruction_pc);
+        break;
+      case OP_POP:
+        EMIT(&assembler, 0x48, 0xFF, 0x8B);  // dec qword [rbx + stack_size]
+        EmitMemoryField(&assembler, offsetof(struct Memory, stack_size));
+        break;
+      case OP_JUMP:
+        AddFixup(&assembler, FIXUP_ENTRY, EmitJump(&assembler, CONDITION_ALWAYS), operand);
+        break;
+      case OP_JUMP_IF_FALSE:
+        EmitJumpIfFalse(&assembler, operand);
+        break;
+      case OP_CALL:
+      case OP_TAIL_CALL:
+        // A primitive's result is pushed, whether or not the call is in tail position.
+        if (operand == 2) EmitBinaryCall(&assembler, instruction_pc);
+        else EmitExit(&assembler, instruction_pc);
+        break;
+      case OP_ASSIGN:
+      case OP_DEFINE:
+      case OP_SET_LOCAL:
+      case OP_CLOSURE:
+      case OP_RETURN:
+      case NUM_OPCODES:
+        EmitExit(&assembler, instruction_pc);
+        break;
+    }
+  }
+
+  // Each exit returns its instruction to the machine. They're kept out of the way of the templates.
+  if (exits) memset(exits, 0xff, sizeof(u32)*num_bytes);
+  for (u64 i = 0; i < assembler.num_fixups && !assembler.is_out_of_memory; ++i) {
+    struct Fixup *fixup = &assembler.fixups[i];
+    if (fixup->kind != FIXUP_EXIT || exits[fixup->pc] != (u32)-1) continue;
+    exits[fixup->pc] = assembler.size;
+    EmitExit(&assembler, fixup->pc);
+  }
+  for (u64 i = 0; i < assembler.num_fixups && !assembler.is_out_of_memory; ++i) {
+    struct Fixup *fixup = &assembler.fixups[i];
+    u64 target = fixup->kind == FIXUP_ENTRY ? entries[fixup->pc] : exits[fixup->pc];
+    u32 rel32 = (u32)(target - (fixup->offset + 4));
+    memcpy(&assembler.bytes[fixup->offset], &rel32, 4);
+  }
+
+  u8 *machine_code = assembler.is_out_of_memory ? 0 : MapMachineCode(assembler.bytes, assembler.size);
+  free(assembler.bytes);
+  free(assembler.fixups);
+  free(exits);
+  if (!machine_code) {
+    LOG_ERROR("Could not translate code of %llu bytes", num_bytes);
+    free(entries);
+    return -1;
+  }
+
+  struct Translation *translation = &translations[num_translations];
+  translation->machine_code = machine_code;
+  translation->size = assembler.size;
+  translation->entries = entries;
+  LOG(LOG_EVALUATE, "Translated code of %llu bytes into %llu bytes of machine code at %p\n",
+      num_bytes, assembler.size, machine_code);
+  WritePerfMap(code, translation);
+  return num_translations++;
+}
+
+void DestroyJit() {
+  // munmap rounds the size up to the pages which MapMachineCode mapped.
+  for (u64 i = 0; i < num_translations; ++i) {
+    munmap(translations[i].machine_code, translations[i].size);
+    free(translations[i].entries);
+  }
+  free(translations);
+  translations = 0;
+  num_translations = 0;
+  max_translations = 0;
+}
+
+static void EmitBytes(struct Assembler *assembler, const u8 *bytes, u64 num_bytes) {
+  if (assembler->size + num_bytes > assembler->max_size) {
+    u64 new_max_size = assembler->max_size ? 2*assembler->max_size : 4096;
+    u8 *new_bytes = realloc(assembler->bytes, new_max_size);
+    if (!new_bytes) {
+      assembler->is_out_of_memory = 1;
+      return;
+    }
+    assembler->bytes = new_bytes;
+    assembler->max_size = new_max_size;
+  }
+  memcpy(&assembler->bytes[assembler->size], bytes, num_bytes);
+  assembler->size += num_bytes;
+}
+
+static void EmitU32(struct Assembler *assembler, u32 value) { EmitBytes(assembler, (const u8*)&value, 4); }
+static void EmitU64(struct Assembler *assembler, u64 value) { EmitBytes(assembler, (const u8*)&value, 8); }
+static void EmitMemoryField(struct Assembler *assembler, u64 offset) { EmitU32(assembler, offset); }
+
+static u64 EmitJump(struct Assembler *assembler, enum Condition condition) {
+  if (condition == CONDITION_ALWAYS) EMIT(assembler, 0xE9);
+  else EMIT(assembler, 0x0F, 0x80 | condition);
+  u64 offset = assembler->size;
+  EmitU32(assembler, 0);
+  return offset;
+}
+
+static void PatchJumpHere(struct Assembler *assembler, u64 offset) {
+  if (assembler->is_out_of_memory) return;
+  u32 rel32 = (u32)(assembler->size - (offset + 4));
+  memcpy(&assembler->bytes[offset], &rel32, 4);
+}
+
+static void AddFixup(struct Assembler *assembler, enum FixupKind kind, u64 offset, u64 pc) {
+  if (assembler->num_fixups == assembler->max_fixups) {
+    u64 new_max_fixups = assembler->max_fixups ? 2*assembler->max_fixups : 64;
+    struct Fixup *new_fixups = realloc(assembler->fixups, sizeof(struct Fixup)*new_max_fixups);
+    if (!new_fixups) {
+      assembler->is_out_of_memory = 1;
+      return;
+    }
+    assembler->fixups = new_fixups;
+    assembler->max_fixups = new_max_fixups;
+  }
+  assembler->fixups[assembler->num_fixups++] = (struct Fixup){kind, offset, pc};
+}
+
+static void EmitExitIf(struct Assembler *assembler, enum Condition condition, u64 pc) {
+  AddFixup(assembler, FIXUP_EXIT, EmitJump(assembler, condition), pc);
+}
+
+static void EmitExit(struct Assembler *assembler, u64 pc) {
+  EMIT(assembler, 0xB8);                     // mov eax, pc
+  EmitU32(assembler, pc);
+  EMIT(assembler, 0xE9);                     // jmp epilogue
+  EmitU32(assembler, (u32)(EPILOGUE_OFFSET - (s64)(assembler->size + 4)));
+}
+
+static void EmitPushRdx(struct Assembler *assembler, u64 pc) {
+  EMIT(assembler, 0x48, 0x8B, 0x83);         // mov rax, [rbx + stack_size]
+  EmitMemoryField(assembler, offsetof(struct Memory, stack_size));
+  EMIT(assembler, 0x48, 0x3B, 0x83);         // cmp rax, [rbx + max_stack_size]
+  EmitMemoryField(assembler, offsetof(struct Memory, max_stack_size));
+  // The machine grows the stack.
+  EmitExitIf(assembler, CONDITION_ABOVE_OR_EQUAL, pc);
+  EMIT(assembler, 0x48, 0x8B, 0x8B);         // mov rcx, [rbx + stack]
+  EmitMemoryField(assembler, offsetof(struct Memory, stack));
+  EMIT(assembler, 0x48, 0x89, 0x14, 0xC1);   // mov [rcx + rax*8], rdx
+  EMIT(assembler, 0x48, 0xFF, 0xC0);         // inc rax
+  EMIT(assembler, 0x48, 0x89, 0x83);         // mov [rbx + stack_size], rax
+  EmitMemoryField(assembler, offsetof(struct Memory, stack_size));
+}
+
+static void EmitCallHelper(struct Assembler *assembler, u64 (*helper)(u64 operand), u64 operand, u64 pc) {
+  EMIT(assembler, 0xBF);                     // mov edi, operand
+  EmitU32(assembler, operand);
+  EMIT(assembler, 0x48, 0xB8);               // mov rax, helper
+  EmitU64(assembler, (u64)helper);
+  EMIT(assembler, 0xFF, 0xD0);               // call rax
+  EMIT(assembler, 0x85, 0xC0);               // test eax, eax
+  EmitExitIf(assembler, CONDITION_EQUAL, pc);
+}
+
+static void EmitJumpIfFalse(struct Assembler *assembler, u64 target) {
+  EMIT(assembler, 0x48, 0x8B, 0x83);         // mov rax, [rbx + stack_size]
+  EmitMemoryField(assembler, offsetof(struct Memory, stack_size));
+  EMIT(assembler, 0x48, 0xFF, 0xC8);         // dec rax
+  EMIT(assembler, 0x48, 0x89, 0x83);         // mov [rbx + stack_size], rax
+  EmitMemoryField(assembler, offsetof(struct Memory, stack_size));
+  EMIT(assembler, 0x48, 0x8B, 0x8B);         // mov rcx, [rbx + stack]
+  EmitMemoryField(assembler, offsetof(struct Memory, stack));
+  EMIT(assembler, 0x48, 0x8B, 0x14, 0xC1);   // mov rdx, [rcx + rax*8]
+  EMIT(assembler, 0x49, 0xB8);               // mov r8, false
+  EmitU64(assembler, false);
+  EMIT(assembler, 0x4C, 0x39, 0xC2);         // cmp rdx, r8
+  AddFixup(assembler, FIXUP_ENTRY, EmitJump(assembler, CONDITION_EQUAL), target);
+}
+
+static void EmitBinaryCall(struct Assembler *assembler, u64 pc) {
+  // The procedure and its arguments are the top three objects of the stack.
+  EMIT(assembler, 0x48, 0x8B, 0x83);         // mov rax, [rbx + stack_size]
+  EmitMemoryField(assembler, offsetof(struct Memory, stack_size));
+  EMIT(assembler, 0x48, 0x8B, 0x8B);         // mov rcx, [rbx + stack]
+  EmitMemoryField(assembler, offsetof(struct Memory, stack));
+  EMIT(assembler, 0x48, 0x8D, 0x0C, 0xC1);   // lea rcx, [rcx + rax*8]
+  EMIT(assembler, 0x48, 0x8B, 0x51, 0xE8);   // mov rdx, [rcx - 24]
+  EMIT(assembler, 0x48, 0x8B, 0x71, 0xF0);   // mov rsi, [rcx - 16]
+  EMIT(assembler, 0x48, 0x8B, 0x79, 0xF8);   // mov rdi, [rcx - 8]
+
+  PrimitiveFunction primitives[] = {PrimitiveEq, PrimitiveBinaryAdd, PrimitiveBinarySubtract, PrimitiveBinaryMultiply};
+  u64 primitive_jumps[4];
+  for (u64 i = 0; i < 4; ++i) {
+    EMIT(assembler, 0x49, 0xB8);             // mov r8, primitive
+    EmitU64(assembler, BoxPrimitiveProcedure(primitives[i]));
+    EMIT(assembler, 0x4C, 0x39, 0xC2);       // cmp rdx, r8
+    primitive_jumps[i] = EmitJump(assembler, CONDITION_EQUAL);
+  }
+  EmitExitIf(assembler, CONDITION_ALWAYS, pc);
+
+  u64 store_jumps[4];
+  PatchJumpHere(assembler, primitive_jumps[0]);
+  EMIT(assembler, 0x48, 0xB8);               // mov rax, false
+  EmitU64(assembler, false);
+  EMIT(assembler, 0x49, 0xB8);               // mov r8, true
+  EmitU64(assembler, true);
+  EMIT(assembler, 0x48, 0x39, 0xFE);         // cmp rsi, rdi
+  EMIT(assembler, 0x49, 0x0F, 0x44, 0xC0);   // cmove rax, r8
+  store_jumps[0] = EmitJump(assembler, CONDITION_ALWAYS);
+
+  const u8 fixnum_opcodes[] = {0x01, 0x29, 0xAF};  // add, sub, imul
+  const u8 real_opcodes[] = {0x58, 0x5C, 0x59};    // addsd, subsd, mulsd
+  for (u64 i = 1; i < 4; ++i) {
+    PatchJumpHere(assembler, primitive_jumps[i]);
+    EmitArithmetic(assembler, fixnum_opcodes[i - 1], real_opcodes[i - 1], pc);
+    store_jumps[i] = EmitJump(assembler, CONDITION_ALWAYS);
+  }
+
+  for (u64 i = 0; i < 4; ++i) PatchJumpHere(assembler, store_jumps[i]);
+  EMIT(assembler, 0x48, 0x89, 0x41, 0xE8);   // mov [rcx - 24], rax
+  EMIT(assembler, 0x48, 0x83, 0xAB);         // sub qword [rbx + stack_size], 2
+  EmitMemoryField(assembler, offsetof(struct Memory, stack_size));
+  EMIT(assembler, 0x02);
+}
+
+static void EmitArithmetic(struct Assembler *assembler, u8 fixnum_opcode, u8 real_opcode, u64 pc) {
+  EMIT(assembler, 0x49, 0x89, 0xF0);         // mov r8, rsi
+  EMIT(assembler, 0x49, 0xC1, 0xE8, 0x2F);   // shr r8, 47
+  EMIT(assembler, 0x41, 0x81, 0xF8);         // cmp r8d, FIXNUM_METADATA_BITS
+  EmitU32(assembler, FIXNUM_METADATA_BITS);
+  u64 real_jump = EmitJump(assembler, CONDITION_NOT_EQUAL);
+
+  // Fixnums: unbox by sign-extending the 47-bit payloads, and box the result if it fits.
+  EMIT(assembler, 0x49, 0x89, 0xF8);         // mov r8, rdi
+  EMIT(assembler, 0x49, 0xC1, 0xE8, 0x2F);   // shr r8, 47
+  EMIT(assembler, 0x41, 0x81, 0xF8);         // cmp r8d, FIXNUM_METADATA_BITS
+  EmitU32(assembler, FIXNUM_METADATA_BITS);
+  EmitExitIf(assembler, CONDITION_NOT_EQUAL, pc);
+  EMIT(assembler, 0x48, 0x89, 0xF0);         // mov rax, rsi
+  EMIT(assembler, 0x48, 0xC1, 0xE0, 0x11);   // shl rax, 17
+  EMIT(assembler, 0x48, 0xC1, 0xF8, 0x11);   // sar rax, 17
+  EMIT(assembler, 0x49, 0x89, 0xF8);         // mov r8, rdi
+  EMIT(assembler, 0x49, 0xC1, 0xE0, 0x11);   // shl r8, 17
+  EMIT(assembler, 0x49, 0xC1, 0xF8, 0x11);   // sar r8, 17
+  if (fixnum_opcode == 0xAF) {
+    EMIT(assembler, 0x49, 0x0F, 0xAF, 0xC0); // imul rax, r8
+    EmitExitIf(assembler, CONDITION_OVERFLOW, pc);
+  } else {
+    EMIT(assembler, 0x4C, fixnum_opcode, 0xC0); // add/sub rax, r8
+  }
+  EMIT(assembler, 0x49, 0x89, 0xC0);         // mov r8, rax
+  EMIT(assembler, 0x49, 0xC1, 0xE0, 0x11);   // shl r8, 17
+  EMIT(assembler, 0x49, 0xC1, 0xF8, 0x11);   // sar r8, 17
+  EMIT(assembler, 0x49, 0x39, 0xC0);         // cmp r8, rax
+  EmitExitIf(assembler, CONDITION_NOT_EQUAL, pc);
+  EMIT(assembler, 0x49, 0xB8);               // mov r8, payload mask
+  EmitU64(assembler, PAYLOAD_MASK);
+  EMIT(assembler, 0x4C, 0x21, 0xC0);         // and rax, r8
+  EMIT(assembler, 0x49, 0xB8);               // mov r8, fixnum metadata
+  EmitU64(assembler, FIXNUM_METADATA);
+  EMIT(assembler, 0x4C, 0x09, 0xC0);         // or rax, r8
+  u64 done_jump = EmitJump(assembler, CONDITION_ALWAYS);
+
+  // Reals: neither argument, nor the result, may have the encoding of a tagged object.
+  PatchJumpHere(assembler, real_jump);
+  EMIT(assembler, 0x49, 0xB9);               // mov r9, tagged object mask
+  EmitU64(assembler, TAGGED_OBJECT_MASK);
+  EMIT(assembler, 0x49, 0x89, 0xF0);         // mov r8, rsi
+  EMIT(assembler, 0x4D, 0x21, 0xC8);         // and r8, r9
+  EMIT(assembler, 0x4D, 0x39, 0xC8);         // cmp r8, r9
+  EmitExitIf(assembler, CONDITION_EQUAL, pc);
+  EMIT(assembler, 0x49, 0x89, 0xF8);         // mov r8, rdi
+  EMIT(assembler, 0x4D, 0x21, 0xC8);         // and r8, r9
+  EMIT(assembler, 0x4D, 0x39, 0xC8);         // cmp r8, r9
+  EmitExitIf(assembler, CONDITION_EQUAL, pc);
+  EMIT(assembler, 0x66, 0x48, 0x0F, 0x6E, 0xC6);  // movq xmm0, rsi
+  EMIT(assembler, 0x66, 0x48, 0x0F, 0x6E, 0xCF);  // movq xmm1, rdi
+  EMIT(assembler, 0xF2, 0x0F, real_opcode, 0xC1); // addsd/subsd/mulsd xmm0, xmm1
+  EMIT(assembler, 0x66, 0x48, 0x0F, 0x7E, 0xC0);  // movq rax, xmm0
+  EMIT(assembler, 0x49, 0x89, 0xC0);         // mov r8, rax
+  EMIT(assembler, 0x4D, 0x21, 0xC8);         // and r8, r9
+  EMIT(assembler, 0x4D, 0x39, 0xC8);         // cmp r8, r9
+  EmitExitIf(assembler, CONDITION_EQUAL, pc);
+  PatchJumpHere(assembler, done_jump);
+}
+
+static u64 PushConstant(u64 index) {
+  enum ErrorCode error = NO_ERROR;
+  Push(CodeConstant(GetExpression(), index), &error);
+  return !error;
+}
+
+static u64 PushVariableValue(u64 index) {
+  Object cell = CodeGlobalCell(GetExpression(), index, GetEnvironment());
+  // The machine reports unbound variables.
+  if (IsNil(cell)) return 0;
+  enum ErrorCode error = NO_ERROR;
+  Push(CellValue(cell), &error);
+  return !error;
+}
+
+static u64 PushLocalValue(u64 address) {
+  enum ErrorCode error = NO_ERROR;
+  Push(LookupLexicalAddress(address >> 16, address & 0xffff, GetEnvironment()), &error);
+  return !error;
+}
+
+static u8 *MapMachineCode(const u8 *bytes, u64 size) {
+  u64 page_size = sysconf(_SC_PAGESIZE);
+  u64 mapped_size = (size + page_size - 1) / page_size * page_size;
+  u8 *machine_code = mmap(0, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (machine_code == MAP_FAILED) return 0;
+  memcpy(machine_code, bytes, size);
+  // The pages are never writable and executable at once.
+  if (mprotect(machine_code, mapped_size, PROT_READ | PROT_EXEC)) {
+    munmap(machine_code, mapped_size);
+    return 0;
+  }
+  return machine_code;
+}
+
+static void WritePerfMap(Object code, const struct Translation *translation) {
+  const char *value = getenv("LISP_JIT_PERF_MAP");
+  if (!value || strcmp(value, "1")) return;
+
+  char filename[64];
+  snprintf(filename, sizeof(filename), "/tmp/perf-%d.map", (int)getpid());
+  FILE *file = fopen(filename, "a");
+  if (!file) {
+    LOG_ERROR("Could not open %s", filename);
+    return;
+  }
+  // e.g. "7f0c2a4b1000 3c2 fn (n) #3"
+  fprintf(file, "%llx %llx fn (", (unsigned long long)translation->machine_code, (unsigned long long)translation->size);
+  for (Object parameters = CodeParameters(code); IsPair(parameters); parameters = Cdr(parameters))
+    fprintf(file, "%s%s", StringCharacterBuffer(Car(parameters)), IsPair(Cdr(parameters)) ? " " : "");
+  fprintf(file, ") #%llu\n", (unsigned long long)num_translations);
+  fclose(file);
+}
+
+#else
+
+s64 TranslateBytecode(Object code) { return -1; }
+void DestroyJit() {}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "tag.h"
+
+// A baseline template JIT for the bytecode machine (see bytecode.h), on x86-64 Linux.
+//
+// The machine counts the calls of each code object. Once code has been called JitThreshold() times,
+// each of its instructions is translated into a fixed template of machine code, in pages which are mapped executable.
+// The machine code keeps its operands on the control stack, just like the machine, so that the two can switch
+// at any instruction: the machine code runs the instructions it can, and returns the program counter of the first
+// it can't to the machine. The machine runs that instruction, and enters the machine code again at the next.
+//
+// Constants which are immediates, pops, jumps and calls of +:binary, -:binary, *:binary and eq? with fixnum or real
+// arguments are inlined, with the NaN-box tag checks. Other constants and variable lookups, local or global,
+// call into C, since loads from the heap pass through the read barrier.
+// Calls of other procedures, returns, definitions, assignments and lambdas are left to the machine,
+// as is anything unusual: a full stack, an unbound variable, arithmetic which overflows a fixnum,
+// or arguments which aren't both fixnums or both reals.
+//
+// The kill switch: the JIT is disabled by setting the environment variable LISP_JIT=0, or with EnableJit(0).
+// It is never enabled on other platforms.
+// If LISP_JIT_PERF_MAP=1, each translation is written to /tmp/perf-<pid>.map, so that profilers like perf
+// can symbolize the machine code.
+//
+// Translations are numbered in the code they were made for, so they belong to the heap of that code,
+// and are freed with it by DestroyJit.
+
+b64 IsJitEnabled();
+void EnableJit(b64 enable);
+// Code is translated once it has been called threshold times.
+u64 JitThreshold();
+void SetJitThreshold(u64 threshold);
+
+// Translate code into machine code. Returns the translation, or -1 if it couldn't be translated.
+s64 TranslateBytecode(Object code);
+// Run the translation from the instruction at pc, in REGISTER_EXPRESSION's code and REGISTER_ENVIRONMENT.
+// Returns the program counter of the first instruction which the machine has to run.
+u64 RunTranslation(s64 translation, u64 pc);
+// Free the machine code of every translation. Called by DestroyMemory.
+void DestroyJit();
+
+#endif
@@ -0,0 +1,219 @@
+#include "large_object_space.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "memory.h"
+
+enum LargeObjectState {
+  LARGE_OBJECT_UNMARKED,
+  // Reachable, but its references haven't been moved yet.
+  LARGE_OBJECT_MARKED,
+  LARGE_OBJECT_SCANNED,
+};
+
+struct LargeObject {
+  u64 start;
+  u64 num_objects;
+  u64 state;
+  // The number of times the large object has been pinned, less the number of times it has been unpinned.
+  u64 pin_count;
+};
+
+// The large objects, sorted by start.
+static struct LargeObject *large_objects;
+static u64 num_large_objects;
+static u64 max_large_objects;
+
+// The region of the_objects managed by the large object space.
+static u64 space_start;
+static u64 space_end;
+static u64 num_objects_used;
+// The number of large objects which are marked but not scanned.
+static u64 num_marked;
+// The marked large object being scanned, and its next slot. A scan can stop between any two slots, and resume there.
+// The large object stays marked until all of its slots are scanned.
+static b64 is_scanning;
+static u64 scanning_start;
+static u64 scanning_slot;
+
+// Returns the large object which starts at reference.
+static struct LargeObject *FindLargeObject(u64 reference);
+
+void InitializeLargeObjectSpace(u64 start, u64 num_objects, enum ErrorCode *error) {
+  space_start = start;
+  space_end = start + num_objects;
+  num_objects_used = 0;
+  num_marked = 0;
+  is_scanning = 0;
+  num_large_objects = 0;
+  max_large_objects = 16;
+  large_objects = (struct LargeObject *)malloc(sizeof(struct LargeObject)*max_large_objects);
+  if (!large_objects) *error = ERROR_COULD_NOT_ALLOCATE_HEAP_BUFFER;
+}
+
+void DestroyLargeObjectSpace() {
+  free(large_objects);
+  large_objects = 0;
+}
+
+b64 IsLargeObject(u64 reference) { return space_start <= reference && reference < space_end; }
+
+b64 AllocateLargeObject(u64 num_objects, u64 *reference) {
+  if (num_objects_used + num_objects > space_end - space_start) return 0;
+  if (num_large_objects == max_large_objects) {
+    u64 new_max_large_objects = 2*max_large_objects;
+    struct LargeObject *new_large_objects =
+      (struct LargeObject *)realloc(large_objects, sizeof(struct LargeObject)*new_max_large_objects);
+    if (!new_large_objects) {
+      LOG_ERROR("Could not grow the large object table to %llu objects", new_max_large_objects);
+      return 0;
+    }
+    large_objects = new_large_objects;
+    max_large_objects = new_max_large_objects;
+  }
+
+  // First fit: [ ..., previous, gap.., next, ... ]
+  u64 gap_start = space_start;
+  u64 index = 0;
+  for (; index < num_large_objects; ++index) {
+    if (gap_start + num_objects <= large_objects[index].start) break;
+    gap_start = large_objects[index].start + large_objects[index].num_objects;
+  }
+  if (gap_start + num_objects > space_end) return 0;
+
+  memmove(&large_objects[index + 1], &large_objects[index], (num_large_objects - index)*sizeof(struct LargeObject));
+  ++num_large_objects;
+  large_objects[index].start = gap_start;
+  large_objects[index].num_objects = num_objects;
+  large_objects[index].state = LARGE_OBJECT_UNMARKED;
+  large_objects[index].pin_count = 0;
+  num_objects_used += num_objects;
+
+  LOG(LOG_MEMORY, "Allocated large object of %llu objects at %llu\n", num_objects, gap_start);
+  *reference = gap_start;
+  return 1;
+}
+
+b64 FindLargeObjectContaining(u64 index, u64 *start) {
+  // The first large object which starts after index.
+  u64 low = 0;
+  u64 high = num_large_objects;
+  while (low < high) {
+    u64 middle = low + (high - low) / 2;
+    if (large_objects[middle].start <= index) low = middle + 1;
+    else high = middle;
+  }
+  if (low == 0) return 0;
+  struct LargeObject *large_object = &large_objects[low - 1];
+  if (index >= large_object->start + large_object->num_objects) return 0;
+  *start = large_object->start;
+  return 1;
+}
+
+u64 MarkLargeObject(u64 reference) {
+  struct LargeObject *large_object = FindLargeObject(reference);
+  u64 unmarked = LARGE_OBJECT_UNMARKED;
+  if (!__atomic_compare_exchange_n(&large_object->state, &unmarked, LARGE_OBJECT_MARKED,
+        0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    return 0;
+  }
+  LOG(LOG_MEMORY, "Marked large object at %llu\n", reference);
+  __atomic_fetch_add(&num_marked, 1, __ATOMIC_RELAXED);
+  return large_object->num_objects;
+}
+
+b64 IsLargeObjectMarked(u64 reference) {
+  return FindLargeObject(reference)->state != LARGE_OBJECT_UNMARKED;
+}
+
+void MarkLargeObjectScanned(u64 reference) {
+  struct LargeObject *large_object = FindLargeObject(reference);
+  if (large_object->state == LARGE_OBJECT_MARKED) --num_marked;
+  large_object->state = LARGE_OBJECT_SCANNED;
+}
+
+void PinLargeObject(u64 reference) { ++FindLargeObject(reference)->pin_count; }
+
+b64 UnpinLargeObject(u64 reference) {
+  struct LargeObject *large_object = FindLargeObject(reference);
+  if (large_object->pin_count == 0) return 0;
+  --large_object->pin_count;
+  return 1;
+}
+
+b64 IsLargeObjectPinned(u64 reference) { return FindLargeObject(reference)->pin_count > 0; }
+
+void MarkPinnedLargeObjects() {
+  for (u64 i = 0; i < num_large_objects; ++i) {
+    if (large_objects[i].pin_count > 0) MarkLargeObject(large_objects[i].start);
+  }
+}
+
+b64 ScanMarkedLargeObjects() { return ScanMarkedLargeObjectSlots(~0ull) > 0; }
+
+u64 ScanMarkedLargeObjectSlots(u64 num_slots) {
+  u64 num_scanned = 0;
+  while (num_scanned < num_slots) {
+    if (!is_scanning) {
+      if (num_marked == 0) break;
+      u64 i = 0;
+      while (large_objects[i].state != LARGE_OBJECT_MARKED) ++i;
+      is_scanning = 1;
+      scanning_start = scanning_slot = large_objects[i].start;
+    }
+    // Large objects allocated since the last call may have moved this one in the table.
+    struct LargeObject *large_object = FindLargeObject(scanning_start);
+    u64 end = large_object->start + large_object->num_objects;
+    for (; num_scanned < num_slots && scanning_slot < end; ++num_scanned) scanning_slot = ScanObject(scanning_slot);
+    if (scanning_slot < end) break;
+    // ScanObject marks large objects, but never allocates one, so large_object is still in the table.
+    large_object->state = LARGE_OBJECT_SCANNED;
+    --num_marked;
+    is_scanning = 0;
+  }
+  return num_scanned;
+}
+
+b64 HasMarkedLargeObjects() { return num_marked > 0; }
+
+void RescanMarkedLargeObjects() {
+  for (u64 i = 0; i < num_large_objects; ++i) {
+    struct LargeObject *large_object = &large_objects[i];
+    if (large_object->state == LARGE_OBJECT_UNMARKED) continue;
+    u64 end = large_object->start + large_object->num_objects;
+    for (u64 scan = large_object->start; scan < end;) scan = ScanObject(scan);
+  }
+}
+
+void SweepLargeObjects() {
+  assert(num_marked == 0 && !is_scanning);
+  u64 num_kept = 0;
+  for (u64 i = 0; i < num_large_objects; ++i) {
+    struct LargeObject large_object = large_objects[i];
+    if (large_object.state == LARGE_OBJECT_UNMARKED) {
+      LOG(LOG_MEMORY, "Freeing large object of %llu objects at %llu\n", large_object.num_objects, large_object.start);
+      num_objects_used -= large_object.num_objects;
+      continue;
+    }
+    large_object.state = LARGE_OBJECT_UNMARKED;
+    large_objects[num_kept++] = large_object;
+  }
+  num_large_objects = num_kept;
+}
+
+u64 LargeObjectSpaceUsed() { return num_objects_used; }
+
+static struct LargeObject *FindLargeObject(u64 reference) {
+  u64 low = 0;
+  u64 high = num_large_objects;
+  while (low < high) {
+    u64 middle = low + (high - low) / 2;
+    if (large_objects[middle].start < reference) low = middle + 1;
+    else high = middle;
+  }
+  assert(low < num_large_objects && large_objects[low].start == reference);
+  return &large_objects[low];
+}
@@ -0,0 +1,65 @@
+#ifndef LARGE_OBJECT_SPACE_H
+#define LARGE_OBJECT_SPACE_H
+
+#include "error.h"
+#include "tag.h"
+
+// The large object space holds vectors and blobs which are too large to copy on every collection.
+//
+// It is a region of the_objects which is never moved:
+//   [ nursery | large object space | spaces... ]
+// Large objects are allocated first-fit from the gaps between the existing large objects.
+// A large object is referenced with the same tags as any other object (TAG_VECTOR, TAG_STRING, ...)
+//
+// During a full collection, each large object reachable from the root is marked instead of moved,
+// and then scanned, a few slots at a time by an incremental collection.
+// Once the collection is complete, the unmarked large objects are freed individually.
+// Young collections don't need to visit the large object space, because stores into large objects
+// pass through the write barrier like any other old object.
+
+// Manage the region of num_objects objects starting at the_objects[start].
+void InitializeLargeObjectSpace(u64 start, u64 num_objects, enum ErrorCode *error);
+void DestroyLargeObjectSpace();
+
+// True if reference is in the large object space.
+b64 IsLargeObject(u64 reference);
+
+// Finds the large object which index is within. Returns false if index isn't within an allocated large object.
+b64 FindLargeObjectContaining(u64 index, u64 *start);
+
+// Allocates num_objects objects in the large object space.
+// Returns true and sets reference if there was room.
+b64 AllocateLargeObject(u64 num_objects, u64 *reference);
+
+// Mark the large object at reference as reachable. Safe to call from several collector threads.
+// Returns the number of objects in the large object if this call marked it, or 0 if it was already marked.
+u64 MarkLargeObject(u64 reference);
+// True if the large object at reference has been marked since the last sweep.
+b64 IsLargeObjectMarked(u64 reference);
+// Mark the large object at reference as reachable and scanned.
+void MarkLargeObjectScanned(u64 reference);
+// Pinned large objects are kept alive, even if they aren't reachable, until they are unpinned as often as they were pinned.
+void PinLargeObject(u64 reference);
+// Returns false if the large object wasn't pinned.
+b64 UnpinLargeObject(u64 reference);
+b64 IsLargeObjectPinned(u64 reference);
+// Mark every pinned large object. Called when a full collection begins.
+void MarkPinnedLargeObjects();
+// Scan the large objects which have been marked, but not scanned.
+// Returns true if any objects were scanned.
+b64 ScanMarkedLargeObjects();
+// Scan up to num_slots slots of the large objects which have been marked, but not scanned,
+// resuming where the last call stopped. Returns the number of slots scanned.
+u64 ScanMarkedLargeObjectSlots(u64 num_slots);
+// True until every marked large object has been scanned.
+b64 HasMarkedLargeObjects();
+// Scan every marked large object again, whether or not it has been scanned.
+// Used by the mark-compact collector to update references after marking.
+void RescanMarkedLargeObjects();
+// Free the unmarked large objects, and unmark the rest.
+void SweepLargeObjects();
+
+// The number of objects in use in the large object space.
+u64 LargeObjectSpaceUsed();
+
+#endif
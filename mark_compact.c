@@ -0,0 +1,360 @@
+#include "mark_compact.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "census.h"
+#include "conservative_roots.h"
+#include "large_object_space.h"
+#include "log.h"
+#include "memory.h"
+#include "type_descriptor.h"
+
+#define BLOCK_OBJECTS 64
+
+enum CompactionPhase {
+  NOT_COMPACTING,
+  MARKING,
+  UPDATING,
+};
+static enum CompactionPhase phase;
+
+// One bit per object in the_objects, set if the object is part of a live object.
+static u64 *live_bits;
+// The number of live objects before each block of BLOCK_OBJECTS objects.
+static u64 *block_offsets;
+static u64 num_blocks;
+
+// Live objects which haven't been scanned yet.
+static Object *mark_stack;
+static u64 mark_stack_size;
+static u64 max_mark_stack_size;
+// Set if a live object could not be pushed. Every live object must be scanned again.
+static b64 mark_stack_overflowed;
+
+// Where the live objects of the nursery slide to, after the live objects of the current space.
+static u64 nursery_destination;
+
+// True if the object at reference is in the nursery or the current space.
+static b64 IsCompacted(u64 reference);
+
+static b64 IsLive(u64 index);
+static void MarkLive(u64 start, u64 end);
+// Returns the index of the first live (or dead) object in [index, end), or end if there isn't one.
+static u64 NextLive(u64 index, u64 end);
+static u64 NextDead(u64 index, u64 end);
+// The number of live objects before index.
+static u64 LiveObjectsBefore(u64 index);
+
+static void Mark(Object object);
+static void PushMarkStack(Object object);
+static void DrainMarkStack();
+// Scan every live object in the nursery and the current space.
+static void ScanLiveObjects();
+// Mark everything reachable from the marked objects.
+static void MarkFromMarkedObjects();
+static void MarkReachableObjects();
+// Mark (or update) the objects referenced by reg.
+static void CompactRegister(enum Register reg);
+
+// Mark the objects pinned by the stack, and everything they reference.
+static void MarkStackPinnedObjects();
+
+static void ComputeBlockOffsets();
+// The start of the run of objects in the current space which slides down with reference:
+// the end of the last pinned object before it, or the start of the space.
+static u64 SegmentStart(u64 reference);
+static u64 NewReference(u64 reference);
+// Slide the live objects in [start, end) down to destination. Returns the end of the slid objects.
+static u64 SlideLiveObjects(u64 start, u64 end, u64 destination);
+// Slide the live objects of the current space down to its start, leaving the pinned objects where they are.
+// Returns the end of the slid objects.
+static u64 SlideSpace();
+// Slide the live objects of the nursery which aren't pinned to destination. Returns the end of the slid objects.
+static u64 SlideNursery(u64 destination);
+
+b64 ResizeCompactionTables(u64 num_objects) {
+  // One extra block, so that the offset of the block containing memory.free always exists.
+  u64 new_num_blocks = num_objects / BLOCK_OBJECTS + 1;
+  // The tables never shrink.
+  if (new_num_blocks <= num_blocks) return 1;
+  u64 *new_live_bits = (u64*)realloc(live_bits, sizeof(u64)*new_num_blocks);
+  if (!new_live_bits) {
+    LOG_ERROR("Could not resize the compaction tables to %llu objects", num_objects);
+    return 0;
+  }
+  live_bits = new_live_bits;
+  u64 *new_block_offsets = (u64*)realloc(block_offsets, sizeof(u64)*new_num_blocks);
+  if (!new_block_offsets) {
+    LOG_ERROR("Could not resize the compaction tables to %llu objects", num_objects);
+    // live_bits has grown, which leaves the tables as large as before.
+    return 0;
+  }
+  block_offsets = new_block_offsets;
+  for (u64 block = num_blocks; block < new_num_blocks; ++block) live_bits[block] = 0;
+  num_blocks = new_num_blocks;
+  return 1;
+}
+
+void DestroyCompactionTables() {
+  free(live_bits);
+  free(block_offsets);
+  free(mark_stack);
+  live_bits = 0;
+  block_offsets = 0;
+  mark_stack = 0;
+  num_blocks = 0;
+  mark_stack_size = 0;
+  max_mark_stack_size = 0;
+}
+
+u64 CompactObjects() {
+  assert(memory.free / BLOCK_OBJECTS < num_blocks);
+  LOG(LOG_MEMORY, "Compacting. Nursery free=%llu, Space=[%llu, %llu)\n",
+      memory.nursery_free, memory.space_start, memory.free);
+
+  phase = MARKING;
+  MarkReachableObjects();
+
+  ComputeBlockOffsets();
+  u64 last_segment_start = SegmentStart(memory.free);
+  nursery_destination = last_segment_start + LiveObjectsBefore(memory.free) - LiveObjectsBefore(last_segment_start);
+
+  // References are updated in place, before anything moves.
+  phase = UPDATING;
+  for (u64 reg = 0; reg < NUM_REGISTERS; ++reg) CompactRegister(reg);
+  ScanLiveObjects();
+  RescanMarkedLargeObjects();
+  UpdateWeakTables();
+  phase = NOT_COMPACTING;
+
+  // The space slides down first, so that the nursery slides into the space it vacated.
+  u64 free = SlideNursery(SlideSpace());
+  LOG(LOG_MEMORY, "Compacted %llu objects into [%llu, %llu)\n", free - memory.space_start, memory.space_start, free);
+
+  memset(live_bits, 0, sizeof(u64)*(memory.free / BLOCK_OBJECTS + 1));
+  memory.free = free;
+  return free - memory.space_start;
+}
+
+b64 IsCompacting() { return phase != NOT_COMPACTING; }
+
+b64 IsUpdatingReferences() { return phase == UPDATING; }
+
+u64 CompactedReference(u64 reference) {
+  return IsCompacted(reference) ? NewReference(reference) : reference;
+}
+
+Object CompactObject(Object object) {
+  if (!IsReference(object)) return object;
+  u64 reference = UnboxReference(object);
+  if (phase == MARKING) {
+    if (!IsLargeObject(reference)) Mark(object);
+    else if (IsTakingCensus()) CountCensusObjects(GetTag(object), MarkLargeObject(reference));
+    else MarkLargeObject(reference);
+    return object;
+  }
+  if (!IsCompacted(reference)) return object;
+  if (!IsLive(reference)) return nil;
+  // Replace the payload, keeping the tag.
+  return object - reference + NewReference(reference);
+}
+
+static b64 IsCompacted(u64 reference) {
+  return reference < memory.nursery_free
+    || (memory.space_start <= reference && reference < memory.free);
+}
+
+static b64 IsLive(u64 index) {
+  return (live_bits[index / BLOCK_OBJECTS] >> (index % BLOCK_OBJECTS)) & 1;
+}
+
+static void MarkLive(u64 start, u64 end) {
+  for (u64 index = start; index < end; ++index) {
+    live_bits[index / BLOCK_OBJECTS] |= 1ull << (index % BLOCK_OBJECTS);
+  }
+}
+
+static u64 NextLive(u64 index, u64 end) {
+  while (index < end) {
+    u64 bits = live_bits[index / BLOCK_OBJECTS] >> (index % BLOCK_OBJECTS);
+    if (bits) {
+      index += __builtin_ctzll(bits);
+      break;
+    }
+    index = (index / BLOCK_OBJECTS + 1) * BLOCK_OBJECTS;
+  }
+  return index < end ? index : end;
+}
+
+static u64 NextDead(u64 index, u64 end) {
+  while (index < end) {
+    u64 bits = ~live_bits[index / BLOCK_OBJECTS] >> (index % BLOCK_OBJECTS);
+    if (bits) {
+      index += __builtin_ctzll(bits);
+      break;
+    }
+    index = (index / BLOCK_OBJECTS + 1) * BLOCK_OBJECTS;
+  }
+  return index < end ? index : end;
+}
+
+static u64 LiveObjectsBefore(u64 index) {
+  u64 bits_before = live_bits[index / BLOCK_OBJECTS] & ((1ull << (index % BLOCK_OBJECTS)) - 1);
+  return block_offsets[index / BLOCK_OBJECTS] + __builtin_popcountll(bits_before);
+}
+
+static void Mark(Object object) {
+  u64 reference = UnboxReference(object);
+  if (!IsCompacted(reference) || IsLive(reference)) return;
+  u64 size = ObjectSize(object);
+  MarkLive(reference, reference + size);
+  if (IsTakingCensus()) CountCensusObjects(GetTag(object), size);
+  // Blobs don't hold references.
+  if (TypeDescriptorOf(GetTag(object))->layout != LAYOUT_BLOB) PushMarkStack(object);
+}
+
+static void PushMarkStack(Object object) {
+  if (mark_stack_size == max_mark_stack_size) {
+    u64 new_max_mark_stack_size = max_mark_stack_size ? 2*max_mark_stack_size : 256;
+    Object *new_mark_stack = (Object*)realloc(mark_stack, sizeof(Object)*new_max_mark_stack_size);
+    if (!new_mark_stack) {
+      LOG_ERROR("Could not grow the mark stack to %llu objects", new_max_mark_stack_size);
+      mark_stack_overflowed = 1;
+      return;
+    }
+    mark_stack = new_mark_stack;
+    max_mark_stack_size = new_max_mark_stack_size;
+  }
+  mark_stack[mark_stack_size++] = object;
+}
+
+static void DrainMarkStack() {
+  while (mark_stack_size > 0) {
+    u64 start, end;
+    ReferenceSlots(mark_stack[--mark_stack_size], &start, &end);
+    for (u64 scan = start; scan < end;) scan = ScanObject(scan);
+  }
+}
+
+static void ScanLiveObjects() {
+  // Live objects are contiguous runs of whole objects, so each run can be scanned like a to-space.
+  u64 regions[2][2] = {{0, memory.nursery_free}, {memory.space_start, memory.free}};
+  for (u64 i = 0; i < 2; ++i) {
+    u64 end = regions[i][1];
+    for (u64 start = NextLive(regions[i][0], end); start < end; start = NextLive(start, end)) {
+      u64 run_end = NextDead(start, end);
+      while (start < run_end) start = ScanObject(start);
+    }
+  }
+}
+
+static void MarkReachableObjects() {
+  mark_stack_overflowed = 0;
+  if (IsTakingCensus()) {
+    // Each register is traced on its own, so that the objects it retains are counted for it.
+    for (u64 reg = 0; reg < NUM_REGISTERS; ++reg) {
+      BeginCensusOfRegister(reg);
+      CompactRegister(reg);
+      MarkFromMarkedObjects();
+    }
+    BeginCensusOfRegister(NUM_REGISTERS);
+  }
+  MarkStackPinnedObjects();
+  for (u64 reg = 0; reg < NUM_REGISTERS; ++reg) CompactRegister(reg);
+  MarkFromMarkedObjects();
+}
+
+static void CompactRegister(enum Register reg) {
+  u64 num_roots;
+  Object *roots = RegisterRoots(reg, &num_roots);
+  for (u64 i = 0; i < num_roots; ++i) roots[i] = CompactObject(roots[i]);
+}
+
+static void MarkStackPinnedObjects() {
+  for (u64 i = 0; i < NumStackPins(); ++i) {
+    u64 start = StackPinStart(i);
+    u64 end = StackPinEnd(i);
+    if (IsLive(start)) continue;
+    // The pinned object may only appear to be referenced, so its tag isn't known. It is scanned as a run of objects.
+    MarkLive(start, end);
+    for (u64 scan = start; scan < end;) scan = ScanObject(scan);
+  }
+  MarkFromMarkedObjects();
+}
+
+static void MarkFromMarkedObjects() {
+  do {
+    DrainMarkStack();
+    while (mark_stack_overflowed) {
+      LOG(LOG_MEMORY, "The mark stack overflowed, scanning every live object again\n");
+      mark_stack_overflowed = 0;
+      ScanLiveObjects();
+      DrainMarkStack();
+    }
+  } while (ScanMarkedLargeObjects());
+}
+
+static void ComputeBlockOffsets() {
+  u64 num_live = 0;
+  for (u64 block = 0; block <= memory.free / BLOCK_OBJECTS; ++block) {
+    block_offsets[block] = num_live;
+    num_live += __builtin_popcountll(live_bits[block]);
+  }
+}
+
+static u64 SegmentStart(u64 reference) {
+  u64 index = StackPinIndex(reference);
+  if (index == 0 || StackPinStart(index - 1) < memory.space_start) return memory.space_start;
+  return StackPinEnd(index - 1);
+}
+
+static u64 NewReference(u64 reference) {
+  // Pinned objects stay where they are.
+  if (IsStackPinned(reference)) return reference;
+  if (reference < memory.nursery_free) {
+    // The nursery slides in after the live objects of the current space.
+    return nursery_destination + LiveObjectsBefore(reference) - StackPinnedObjectsBefore(reference);
+  }
+  u64 start = SegmentStart(reference);
+  return start + LiveObjectsBefore(reference) - LiveObjectsBefore(start);
+}
+
+static u64 SlideLiveObjects(u64 start, u64 end, u64 destination) {
+  while (start < end) {
+    u64 run_start = NextLive(start, end);
+    if (memory.mostly_copying) ClearObjectStarts(start, run_start);
+    if (run_start == end) break;
+    u64 run_end = NextDead(run_start, end);
+    // Runs only move down, but may overlap themselves.
+    memmove(&memory.the_objects[destination], &memory.the_objects[run_start], (run_end - run_start)*sizeof(Object));
+    if (memory.mostly_copying) MoveObjectStarts(run_start, run_end, destination);
+    destination += run_end - run_start;
+    start = run_end;
+  }
+  return destination;
+}
+
+static u64 SlideSpace() {
+  u64 start = memory.space_start;
+  u64 destination = memory.space_start;
+  for (u64 i = 0; i < NumStackPins(); ++i) {
+    if (StackPinStart(i) < memory.space_start) continue;
+    // [ ..., slid objects, filler, pinned object, ... ]
+    destination = SlideLiveObjects(start, StackPinStart(i), destination);
+    WriteFiller(destination, StackPinStart(i));
+    start = destination = StackPinEnd(i);
+  }
+  return SlideLiveObjects(start, memory.free, destination);
+}
+
+static u64 SlideNursery(u64 destination) {
+  // The pinned objects are left behind in the nursery.
+  u64 start = 0;
+  for (u64 i = 0; i < NumStackPins() && StackPinStart(i) < memory.nursery_free; ++i) {
+    destination = SlideLiveObjects(start, StackPinStart(i), destination);
+    start = StackPinEnd(i);
+  }
+  return SlideLiveObjects(start, memory.nursery_free, destination);
+}
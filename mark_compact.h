@@ -0,0 +1,44 @@
+#ifndef MARK_COMPACT_H
+#define MARK_COMPACT_H
+
+#include "error.h"
+#include "tag.h"
+
+// The mark-compact collector performs full collections in place, in a single space.
+//
+// Collection happens in four phases:
+//   Mark: Every object reachable from the root is marked in a bitmap, one bit per object (slot).
+//   Reachable large objects are marked in the large object space.
+//   Forward: The number of marked slots before each block of 64 slots is summed into a table.
+//   The new reference of an object is the number of marked slots before it, which is found by
+//   adding the popcount of the bits before it in its block to the table entry.
+//   Update: Every reference in the root, the marked objects, and the marked large objects is replaced by its new reference.
+//   The weak tables are updated as well.
+//   Slide: The marked slots of the current space are slid down to the start of the space, followed by
+//   the marked slots of the nursery. Objects keep their allocation order.
+//
+// The tables take 2 bits per object in the_objects, instead of a second space.
+//
+// Objects pinned by the C stack (see conservative_roots.h) are marked as roots, and stay where they are.
+// The objects of the current space slide down to the end of the last pinned object before them, and the gap
+// left before each pinned object is filled with a blob. Pinned objects in the nursery stay in the nursery.
+
+// Grow the tables to cover num_objects objects, if they don't already. Returns true on success.
+b64 ResizeCompactionTables(u64 num_objects);
+void DestroyCompactionTables();
+
+// Mark, update and slide every live object in the nursery and the current space.
+// Sets memory.free to the end of the compacted objects, and returns the number of objects kept.
+u64 CompactObjects();
+
+// True while between the phases of CompactObjects.
+b64 IsCompacting();
+// True while references are being updated, before anything slides.
+b64 IsUpdatingReferences();
+// The index the object (or slot) at reference will slide to. Only valid while updating references.
+u64 CompactedReference(u64 reference);
+
+// Mark the object referenced by object, or return its new reference (nil if it isn't live), depending on the phase.
+Object CompactObject(Object object);
+
+#endif
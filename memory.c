@@ -4,22 +4,35 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
+#include "allocation_profiler.h"
 #include "blob.h"
 #include "byte_vector.h"
+#include "census.h"
 #include "compound_procedure.h"
+#include "conservative_roots.h"
+#include "file.h"
+#include "finalization.h"
+#include "gc_statistics.h"
+#include "jit.h"
+#include "large_object_space.h"
 #include "log.h"
+#include "mark_compact.h"
 #include "pair.h"
+#include "parallel_collector.h"
 #include "root.h"
 #include "string.h"
 #include "symbol.h"
+#include "type_descriptor.h"
 #include "vector.h"
+#include "weak_reference.h"
 
-// Move an object from the_objects to new_objects.
-Object MoveObject(Object object); 
-
-// Functions for moving specific types of objects.
-Object MovePrimitive(Object object);
+// The most pairs of a cdr chain moved at once, which bounds the pause of a read barrier.
+#define MAX_CDR_CHAIN_PAIRS 64
 
 // Print an object, not following references.
 void PrintReference(Object object);
@@ -28,145 +41,1009 @@ void PrintlnReference(Object object);
 // Global memory storage
 struct Memory memory;
 
+// The region of the current space being collected. The nursery is always collected.
+static u64 condemned_start;
+static u64 condemned_end;
+// The number of objects condemned by the last full collection, and the number copied since.
+static u64 num_objects_condemned;
+static u64 num_objects_copied;
+// The next object to be scanned by an incremental collection.
+static u64 incremental_scan;
+// True during a full collection, when reachable large objects are marked.
+static b64 is_marking_large_objects;
+// The number of objects allocated in the large object space since the last full collection.
+static u64 num_large_objects_allocated;
+// True during a collection which pinned objects referenced from the C stack.
+// The old slots which reference the objects pinned in the nursery are remembered as they are updated.
+static b64 is_remembering_pinned_references;
+
+// Returns true if the object at reference is being collected, and needs to be moved.
+static b64 IsCondemned(u64 reference);
+// Scan over the freshly moved objects, starting at scan.
+static void ScanMovedObjects(u64 scan);
+// Start moving objects into the to-space, which ends at to_space_end.
+// Collections of num_objects_condemned objects may be performed in parallel.
+static void BeginMovingObjects(u64 num_objects_condemned, u64 to_space_end);
+// Scan the objects moved since scan, until every live object has been moved.
+static void FinishMovingObjects(u64 scan);
+// Move the objects referenced by reg.
+static void MoveRegister(enum Register reg);
+// Move the objects referenced by each register.
+static void MoveRegisters();
+// Move the objects reachable from each register in turn, counting them for the census.
+// Returns the index of the next object to scan.
+static u64 MoveRegistersForCensus(u64 scan);
+// Move an object which is being collected.
+static Object MoveCondemnedObject(Object object);
+// Remember slot if it is old, and references an object pinned in the nursery.
+static void RememberPinnedReference(u64 slot);
+
+// Condemn the nursery and the current space, and make the other space the current space.
+// Returns the start of the new current space.
+static u64 Flip();
+// Compact the nursery and the current space in place.
+static void CompactGarbage();
+static void FinishFullCollection();
+
+// Begin a full collection, which will be completed by allocations.
+static void BeginIncrementalCollection();
+// Scan up to num_objects objects of the incremental collection in progress.
+static void ScanIncrementally(u64 num_objects);
+// Scan the rest of the incremental collection in progress.
+static void FinishIncrementalCollection();
+static void CompleteIncrementalCollection();
+// Performs a full collection, incrementally if enabled.
+static void CollectOldGeneration();
+
+// The number of free objects in the current space, after reserving space to promote the nursery.
+static u64 SpaceRoom();
+static b64 NurseryHasRoom(u64 num_objects);
+static b64 SpaceHasRoom(u64 num_objects);
+static b64 HasEnoughMemory(u64 num_objects);
+// True if num_objects are allocated in the nursery, once there is enough memory for them.
+static b64 IsAllocatedInNursery(u64 num_objects);
+// True if num_objects can be allocated in the to-space of an incremental collection.
+static b64 ToSpaceHasRoom(u64 num_objects);
+
+static void Remember(u64 index);
+static void ForgetRememberedSet();
+
+// The index of the lowest space, after the nursery and the large object space.
+static u64 SpacesStart();
+// Allocate num_objects in the large object space, collecting garbage if it is full.
+static b64 AllocateInLargeObjectSpace(u64 num_objects, u64 *reference);
+
+// Reserve address space for num_objects objects, without backing it with memory.
+// Pages are zeroed by the operating system when they are first touched.
+static Object *ReserveArena(u64 num_objects, b64 huge_pages);
+// Return the whole pages of the_objects in [start, end) to the operating system. Their contents are lost.
+static void ReleaseObjects(u64 start, u64 end);
+// The number of objects left in the reservation made by ReserveObjects.
+static u64 num_objects_reserved;
+static b64 is_reservation_in_nursery;
+
+// The number of objects reserved for the_objects, which it can never grow past.
+static u64 num_reserved_objects;
+static u64 page_objects;
+
+// The index of the next to-space, given spaces of space_objects objects.
+static u64 ToSpace(u64 space_objects);
+// Resize the spaces to space_objects objects, within the reserved objects. Returns true on success.
+static b64 ResizeSpaces(u64 space_objects);
+// Resize the spaces, based on the last full collection.
+static void AdjustSpaceSize();
+// Grow the current space so that num_objects can be allocated, if it is allowed to grow.
+static void GrowSpace(u64 num_objects);
+
+static u64 Nanoseconds();
+// Time spent collecting garbage is measured between StartTiming and StopTiming. Calls may be nested.
+static void StartTiming();
+static void StopTiming();
+// The time spent collecting, including the collection in progress.
+static u64 GCNanoseconds();
+static u64 timing_depth;
+static u64 timing_start;
+
+// Statistics of the collection in progress.
+static struct CollectionStatistics collection;
+static u64 collection_start_gc_nanoseconds;
+static u64 collection_start_objects_moved;
+// The time, and the number of objects allocated, when the last collection ended.
+static u64 last_collection_end_nanoseconds;
+static u64 last_collection_end_objects_allocated;
+// The objects in use by the nursery, the current space and the large object space.
+static u64 ObjectsInUse();
+// Begin gathering statistics for a collection which condemns objects_condemned objects.
+static void BeginCollectionStatistics(enum CollectionKind kind, u64 objects_condemned);
+static void EndCollectionStatistics();
+// The time, and the time spent collecting, when the spaces were last resized.
+static u64 last_resize_nanoseconds;
+static u64 last_resize_gc_nanoseconds;
+
 void CollectGarbage() {
+  if (memory.is_collecting_incrementally) {
+    // The collection in progress is already a full collection.
+    FinishIncrementalCollection();
+    return;
+  }
+  if (memory.census) BeginCensus(memory.num_collections + 1);
+  if (memory.mark_compact) {
+    CompactGarbage();
+    return;
+  }
+  StartTiming();
+  BeginCollectionStatistics(COLLECTION_FULL, memory.nursery_free + memory.free - memory.space_start);
+  u64 to_space = Flip();
+  u64 scan = to_space;
+  // A census traces the registers in turn, which the parallel collector can't do.
+  if (IsTakingCensus()) {
+    scan = MoveRegistersForCensus(scan);
+  } else {
+    BeginMovingObjects(num_objects_condemned, to_space + memory.space_objects);
+    MoveRegisters();
+  }
+
+  LOG(LOG_MEMORY, "Moved registers. Free=%llu Beginning scan.\n", memory.free);
+  FinishMovingObjects(scan);
+  FinishFullCollection();
+  StopTiming();
+}
+
+static u64 Flip() {
   ++memory.num_collections;
   LOG(LOG_MEMORY, "Beginning a garbage collection number %d\n", memory.num_collections);
-  // DEBUGGING: Clear unused objects to nil
-  for (u64 i = 0; i < memory.max_objects; ++i) memory.new_objects[i] = nil;
-  LOG(LOG_MEMORY, "resetting the free pointer to 0\n");
+  u64 to_space = ToSpace(memory.space_objects);
+  assert(to_space + memory.space_objects <= memory.num_arena_objects);
+  LOG(LOG_MEMORY, "resetting the free pointer to %llu\n", to_space);
+
+  // Condemn the nursery and the current space.
+  condemned_start = memory.space_start;
+  condemned_end = memory.free;
+  num_objects_condemned = memory.nursery_free + condemned_end - condemned_start;
+  num_objects_copied = 0;
+  is_marking_large_objects = 1;
+  MarkPinnedLargeObjects();
+
+  // Reset the free pointer to the start of the to-space
+  memory.free = to_space;
+  memory.space_start = to_space;
+  // Remembered slots are in the condemned space.
+  ForgetRememberedSet();
+  return to_space;
+}
+
+static void CompactGarbage() {
+  StartTiming();
+  BeginCollectionStatistics(COLLECTION_COMPACTING, memory.nursery_free + memory.free - memory.space_start);
+  ++memory.num_collections;
+  LOG(LOG_MEMORY, "Beginning a compacting garbage collection number %d\n", memory.num_collections);
+  num_objects_condemned = memory.nursery_free + memory.free - memory.space_start;
+  is_marking_large_objects = 1;
+  MarkPinnedLargeObjects();
+  // Every object is traced, so the remembered set isn't needed. Slots which reference pinned objects are remembered again.
+  ForgetRememberedSet();
+  if (memory.mostly_copying) FindStackPins(1);
+  is_remembering_pinned_references = NumStackPins() > 0;
+  u64 old_free = memory.free;
+  memory.num_objects_moved += CompactObjects();
+  ReleaseObjects(memory.free, old_free);
+  FinishFullCollection();
+  StopTiming();
+}
+
+static void FinishFullCollection() {
+  // The mark-compact collector updates the weak tables before the objects slide.
+  if (!memory.mark_compact) UpdateWeakTables();
+  // The condemned space is empty until the next flip.
+  if (!memory.mark_compact) ReleaseObjects(condemned_start, condemned_end);
+  // Every object is old, so there are no old->young references to remember,
+  // except to the objects pinned in the nursery, which were remembered as they were updated.
+  memory.nursery_free = memory.mostly_copying ? FillNurseryAroundStackPins(memory.nursery_free) : 0;
+  if (!is_remembering_pinned_references) ForgetRememberedSet();
+  is_remembering_pinned_references = 0;
+  ForgetStackPins();
+  is_marking_large_objects = 0;
+  SweepLargeObjects();
+  num_large_objects_allocated = 0;
+  AdjustSpaceSize();
+  EndCollectionStatistics();
+  if (IsTakingCensus()) EndCensus();
+  RunFinalizers();
+}
+
+static void BeginIncrementalCollection() {
+  StartTiming();
+  BeginCollectionStatistics(COLLECTION_INCREMENTAL, memory.nursery_free + memory.free - memory.space_start);
+  ++memory.num_incremental_collections;
+  u64 to_space = Flip();
+  LOG(LOG_MEMORY, "Beginning incremental collection. Moving the registers\n");
+  // The registers don't pass through the read barrier, so they are moved all at once.
+  MoveRegisters();
+  incremental_scan = to_space;
+  memory.is_collecting_incrementally = 1;
+  StopTiming();
+}
+
+static void ScanIncrementally(u64 num_objects) {
+  StartTiming();
+  LOG(LOG_MEMORY, "Scanning up to %llu objects from %llu. Free=%llu\n", num_objects, incremental_scan, memory.free);
+  // Once the to-space has caught up, the marked large objects are scanned from the same budget,
+  // which may move more objects into the to-space.
+  for (;;) {
+    for (; num_objects > 0 && incremental_scan < memory.free; --num_objects) {
+      incremental_scan = ScanObject(incremental_scan);
+    }
+    if (num_objects == 0 || !HasMarkedLargeObjects()) break;
+    num_objects -= ScanMarkedLargeObjectSlots(num_objects);
+  }
+  if (incremental_scan == memory.free && !HasMarkedLargeObjects()) CompleteIncrementalCollection();
+  StopTiming();
+}
+
+static void FinishIncrementalCollection() {
+  StartTiming();
+  LOG(LOG_MEMORY, "Finishing incremental collection from %llu. Free=%llu\n", incremental_scan, memory.free);
+  ScanMovedObjects(incremental_scan);
+  CompleteIncrementalCollection();
+  StopTiming();
+}
+
+static void CompleteIncrementalCollection() {
+  memory.is_collecting_incrementally = 0;
+  memory.num_objects_moved += num_objects_copied;
+  FinishFullCollection();
+}
 
-  // Reset the free pointer to the start of the new_objects
-  memory.free = 0;
+static void CollectOldGeneration() {
+  if (memory.incremental_scan_ratio > 0) {
+    BeginIncrementalCollection();
+  } else {
+    CollectGarbage();
+  }
+}
+
+void CollectYoungGarbage() {
+  if (memory.is_collecting_incrementally) {
+    // Nothing is allocated in the nursery during an incremental collection. Finishing it empties the nursery.
+    FinishIncrementalCollection();
+    return;
+  }
+  if (memory.remembered_set_overflowed) {
+    LOG(LOG_MEMORY, "The remembered set is incomplete, performing a full collection\n");
+    CollectGarbage();
+    return;
+  }
+  StartTiming();
+  BeginCollectionStatistics(COLLECTION_YOUNG, memory.nursery_free);
+  ++memory.num_collections;
+  ++memory.num_young_collections;
+  LOG(LOG_MEMORY, "Beginning young garbage collection number %d\n", memory.num_young_collections);
+
+  // Condemn only the nursery. Survivors are promoted to the end of the current space.
+  condemned_start = condemned_end = 0;
+  if (memory.mostly_copying) FindStackPins(0);
+  is_remembering_pinned_references = NumStackPins() > 0;
+  u64 promoted = memory.free;
+  BeginMovingObjects(memory.nursery_free, memory.space_start + memory.space_objects);
+
+  // Stores into the registers are not remembered, so they are always moved.
+  MoveRegisters();
+
+  // Objects pinned by the stack stay in the nursery, and their slots are roots.
+  for (u64 i = 0; i < NumStackPins(); ++i) {
+    for (u64 scan = StackPinStart(i); scan < StackPinEnd(i);) scan = ScanObject(scan);
+  }
+
+  // Slots remembered during the collection are added after the slots which are moved.
+  u64 num_remembered = memory.num_remembered;
+  LOG(LOG_MEMORY, "Moving %llu remembered slots\n", num_remembered);
+  for (u64 i = 0; i < num_remembered; ++i) {
+    u64 slot = memory.remembered[i];
+    memory.the_objects[slot] = MoveObject(memory.the_objects[slot]);
+    if (is_remembering_pinned_references) RememberPinnedReference(slot);
+  }
+
+  FinishMovingObjects(promoted);
+  UpdateWeakTables();
+
+  memory.nursery_free = memory.mostly_copying ? FillNurseryAroundStackPins(memory.nursery_free) : 0;
+  if (is_remembering_pinned_references) {
+    // The pinned objects are still young, so the slots which reference them stay remembered.
+    memory.num_remembered -= num_remembered;
+    memmove(memory.remembered, &memory.remembered[num_remembered], sizeof(u64)*memory.num_remembered);
+  } else {
+    ForgetRememberedSet();
+  }
+  is_remembering_pinned_references = 0;
+  ForgetStackPins();
+  EndCollectionStatistics();
+  RunFinalizers();
+  StopTiming();
+}
 
-  // Move the root from the_objects to new_objects.
-  LOG(LOG_MEMORY, "Moving the root object: ");
-  LOG_OP(LOG_MEMORY, PrintlnObject(memory.root));
-  memory.root = MoveObject(memory.root);
+void TakeHeapCensus() {
+  // The census traces from the root, so the collection in progress can't be used.
+  if (memory.is_collecting_incrementally) FinishIncrementalCollection();
+  b64 census = memory.census;
+  memory.census = 1;
+  CollectGarbage();
+  memory.census = census;
+}
 
-  LOG(LOG_MEMORY, "Moved root. Free=%llu Beginning scan.\n", memory.free);
+static void ScanMovedObjects(u64 scan) {
   // Scan over the freshly moved objects
   //  if a reference to an old object is encountered, move it
-  // when scan catches up to free, the entire memory has been scanned/moved.
-  for (u64 scan = 0; scan < memory.free;) {
-    LOG(LOG_MEMORY, "Scanning object at %llu. Free=%llu\n", scan, memory.free);
-    Object object = memory.new_objects[scan];
-
-    // If the object is a blob, we can't scan its contents
-    if (IsBlobHeader(object)) {
-      u64 num_objects = NumObjectsPerBlob(UnboxBlobHeader(object));
-      scan += num_objects;
-      LOG(LOG_MEMORY, "Encountered blob of size %llu objects. Scan=%llu\n", num_objects, scan);
-    } else {
-      memory.new_objects[scan] = MoveObject(object);
-      ++scan;
-    }
+  // when scan catches up to free, and every marked large object has been scanned,
+  // the entire memory has been scanned/moved.
+  do {
+    while (scan < memory.free) scan = ScanObject(scan);
+  } while (ScanMarkedLargeObjects());
+}
+
+static void MoveRegister(enum Register reg) {
+  u64 num_roots;
+  Object *roots = RegisterRoots(reg, &num_roots);
+  for (u64 i = 0; i < num_roots; ++i) roots[i] = MoveObject(roots[i]);
+}
+
+static void MoveRegisters() {
+  for (u64 reg = 0; reg < NUM_REGISTERS; ++reg) MoveRegister(reg);
+}
+
+static u64 MoveRegistersForCensus(u64 scan) {
+  for (u64 reg = 0; reg < NUM_REGISTERS; ++reg) {
+    BeginCensusOfRegister(reg);
+    MoveRegister(reg);
+    ScanMovedObjects(scan);
+    memory.num_objects_moved += memory.free - scan;
+    scan = memory.free;
+  }
+  BeginCensusOfRegister(NUM_REGISTERS);
+  return scan;
+}
+
+static void BeginMovingObjects(u64 num_objects_condemned, u64 to_space_end) {
+  if (ShouldCollectInParallel(num_objects_condemned, to_space_end - memory.free)) {
+    ++memory.num_parallel_collections;
+    BeginParallelCollection(to_space_end);
+  }
+}
+
+static void FinishMovingObjects(u64 scan) {
+  if (IsCollectingInParallel()) {
+    FinishParallelCollection();
+    memory.num_objects_moved += ParallelObjectsMoved();
+    // The marked large objects are scanned by the collecting thread.
+    scan = memory.free;
+    ScanMovedObjects(scan);
+    memory.num_objects_moved += memory.free - scan;
+  } else {
+    ScanMovedObjects(scan);
+    memory.num_objects_moved += memory.free - scan;
+  }
+}
+
+u64 ScanObject(u64 scan) {
+  LOG(LOG_MEMORY, "Scanning object at %llu. Free=%llu\n", scan, memory.free);
+  Object object = memory.the_objects[scan];
+
+  // If the object is a blob, we can't scan its contents
+  if (IsBlobHeader(object)) {
+    u64 num_objects = NumObjectsPerBlob(UnboxBlobHeader(object));
+    LOG(LOG_MEMORY, "Encountered blob of size %llu objects. Scan=%llu\n", num_objects, scan + num_objects);
+    return scan + num_objects;
   }
-  memory.num_objects_moved += memory.free;
+  // Immediates, including the length of a vector, don't refer to anything.
+  if (!IsReference(object)) return scan + 1;
+  memory.the_objects[scan] = IsCompacting() ? CompactObject(object) : MoveObject(object);
+  if (is_remembering_pinned_references) RememberPinnedReference(scan);
+  return scan + 1;
+}
 
-  // Flip
-  Object *temp = memory.the_objects;
-  memory.the_objects = memory.new_objects;
-  memory.new_objects = temp;
+static void RememberPinnedReference(u64 slot) {
+  Object object = memory.the_objects[slot];
+  // Once a reference has been moved, it can only refer to the nursery if it refers to a pinned object.
+  if (!IsReference(object) || UnboxReference(object) >= memory.nursery_objects) return;
+  if (IsCompacting()) {
+    // References are updated before the objects slide, so the slot is remembered where it will be.
+    if (!IsUpdatingReferences()) return;
+    slot = CompactedReference(slot);
+  }
+  if (slot >= memory.nursery_objects) Remember(slot);
 }
 
+static b64 IsCondemned(u64 reference) {
+  // Objects referenced from the C stack stay where they are.
+  if (memory.mostly_copying && IsStackPinned(reference)) return 0;
+  return reference < memory.nursery_free
+    || (condemned_start <= reference && reference < condemned_end);
+}
 
 Object MoveObject(Object object) {
   LOG(LOG_MEMORY, "moving object: ");
   LOG_OP(LOG_MEMORY, PrintlnReference(object));
-  // If it isn't tagged, it's a double float.
-  if (!IsTagged(object)) {
-    return MovePrimitive(object);
+  // Immediates and doubles are stored in the Object itself.
+  if (!IsReference(object)) return object;
+  // Large objects are marked instead of moved.
+  if (IsLargeObject(UnboxReference(object))) {
+    if (is_marking_large_objects) {
+      u64 num_objects_marked = MarkLargeObject(UnboxReference(object));
+      if (IsTakingCensus()) CountCensusObjects(GetTag(object), num_objects_marked);
+    }
+    return object;
+  }
+  // Objects which aren't being collected stay where they are.
+  if (!IsCondemned(UnboxReference(object))) return object;
+  if (!IsTakingCensus()) return MoveCondemnedObject(object);
+  // Objects which have already been moved don't move the free pointer.
+  u64 free = memory.free;
+  Object new_object = MoveCondemnedObject(object);
+  CountCensusObjects(GetTag(object), memory.free - free);
+  return new_object;
+}
+
+static Object MoveCondemnedObject(Object object) {
+  Object (*move)(Object object) = TypeDescriptorOf(GetTag(object))->move;
+  assert(move && "Error: unrecognized object");
+  return move(object);
+}
+
+Object SurvivingObject(Object object) {
+  if (!IsReference(object)) return object;
+  u64 reference = UnboxReference(object);
+  if (IsLargeObject(reference)) {
+    return !is_marking_large_objects || IsLargeObjectMarked(reference) ? object : nil;
   }
-  switch (GetTag(object)) {
-    case TAG_NIL:
-    case TAG_TRUE:
-    case TAG_FALSE:
-    case TAG_FIXNUM:
-    case TAG_PRIMITIVE_PROCEDURE:
-      return MovePrimitive(object);
+  if (IsCompacting()) return CompactObject(object);
+  if (!IsCondemned(reference)) return object;
+  Object header = memory.the_objects[reference];
+  if (!IsBrokenHeart(header)) return nil;
+  // Replace the payload, keeping the tag.
+  return object - reference + UnboxReference(header);
+}
+
+Object MoveList(Object pair) {
+  Object new_pair = MovePair(pair);
+  // Parallel workers may scan the new pair while it is being linked.
+  if (memory.copy_order != COPY_CDR_FIRST || IsCollectingInParallel()) return new_pair;
 
-    // Reference Objects
-    case TAG_PAIR:               return MovePair(object);
-    case TAG_STRING:             return MoveString(object);
-    case TAG_SYMBOL:             return MoveSymbol(object);
-    case TAG_VECTOR:             return MoveVector(object);
-    case TAG_BYTE_VECTOR:        return MoveByteVector(object);
-    case TAG_COMPOUND_PROCEDURE: return MoveCompoundProcedure(object);
+  Object last = new_pair;
+  for (u64 i = 0; i < MAX_CDR_CHAIN_PAIRS; ++i) {
+    u64 cdr_index = UnboxReference(last) + 1;
+    Object cdr = memory.the_objects[cdr_index];
+    // Stop at the end of the list, or where the rest of it has already been moved.
+    if (!IsPair(cdr) || !IsCondemned(UnboxReference(cdr))) break;
+    if (IsBrokenHeart(memory.the_objects[UnboxReference(cdr)])) break;
+    last = MovePair(cdr);
+    memory.the_objects[cdr_index] = last;
   }
+  return new_pair;
+}
+
+Object LoadHeader(u64 reference) {
+  return IsCollectingInParallel() ? ParallelLoadHeader(reference) : memory.the_objects[reference];
+}
+
+u64 MoveObjects(u64 reference, Object header, u64 num_objects) {
+  if (IsCollectingInParallel()) return ParallelMoveObjects(reference, header, num_objects);
 
-  assert(!"Error: unrecognized object");
-  return 0;
+  u64 new_reference = memory.free;
+  memory.the_objects[new_reference] = header;
+  memcpy(&memory.the_objects[new_reference + 1], &memory.the_objects[reference + 1], (num_objects - 1)*sizeof(Object));
+  memory.free += num_objects;
+  num_objects_copied += num_objects;
+  if (memory.mostly_copying) RecordObjectStart(new_reference);
+  memory.the_objects[reference] = BoxBrokenHeart(new_reference);
+  return new_reference;
 }
 
-Object MovePrimitive(Object object) { return object; }
+struct MemoryOptions DefaultMemoryOptions(u64 space_objects) {
+  struct MemoryOptions options;
+  options.space_objects = space_objects;
+  options.min_space_objects = space_objects;
+  options.max_space_objects = 64*space_objects;
+  options.max_growth_objects = 4*space_objects;
+  options.target_survival_percent = 50;
+  options.target_gc_time_percent = 10;
+  options.nursery_objects = space_objects / 4;
+  options.large_object_space_objects = space_objects;
+  options.large_object_threshold = 256;
+  options.num_gc_threads = 1;
+  options.incremental_scan_ratio = 0;
+  options.mark_compact = 0;
+  options.huge_pages = 0;
+  options.copy_order = COPY_BREADTH_FIRST;
+  options.gc_log_path = 0;
+  options.allocation_sample_interval = 0;
+  options.census = 0;
+  options.mostly_copying = 0;
+  return options;
+}
+
+void InitializeMemory(u64 space_objects, enum ErrorCode *error) {
+  InitializeMemoryWithOptions(DefaultMemoryOptions(space_objects), error);
+}
 
-void InitializeMemory(u64 max_objects, enum ErrorCode *error) {
-  memory.max_objects = max_objects;
+void InitializeMemoryWithOptions(struct MemoryOptions options, enum ErrorCode *error) {
+  assert(options.min_space_objects <= options.space_objects);
+  assert(options.space_objects <= options.max_space_objects);
+  memory.space_objects = options.space_objects;
+  memory.min_space_objects = options.min_space_objects;
+  memory.max_space_objects = options.max_space_objects;
+  memory.max_growth_objects = options.max_growth_objects;
+  memory.target_survival_percent = options.target_survival_percent;
+  memory.target_gc_time_percent = options.target_gc_time_percent;
+  memory.nursery_objects = options.nursery_objects;
+  memory.large_object_space_objects = options.large_object_space_objects;
+  memory.large_object_threshold = options.large_object_threshold;
+  is_marking_large_objects = 0;
+  num_large_objects_allocated = 0;
+  memory.mostly_copying = options.mostly_copying;
+  // Pinned objects can only be kept in place by the serial collectors, and by the compactor during full collections.
+  memory.num_gc_threads = memory.mostly_copying ? 1 : options.num_gc_threads;
+  memory.mark_compact = memory.mostly_copying || options.mark_compact;
+  memory.copy_order = options.copy_order;
+  memory.census = options.census;
+  // Incremental collection relies on a to-space.
+  memory.incremental_scan_ratio = memory.mark_compact ? 0 : options.incremental_scan_ratio;
+  memory.is_collecting_incrementally = 0;
+  memory.num_incremental_collections = 0;
   memory.num_collections = 0;
+  memory.num_young_collections = 0;
+  memory.num_parallel_collections = 0;
   memory.num_objects_allocated = 0;
   memory.num_objects_moved = 0;
-  u64 n_bytes = sizeof(Object)*memory.max_objects;
+  memory.num_gc_nanoseconds = 0;
+  timing_depth = 0;
+  ResetGCStatistics();
+  last_collection_end_nanoseconds = Nanoseconds();
+  last_collection_end_objects_allocated = 0;
+  last_resize_nanoseconds = Nanoseconds();
+  last_resize_gc_nanoseconds = 0;
+  // [ nursery | large object space | space 0 | space 1 ], or a single space when compacting in place.
+  u64 num_objects = SpacesStart() + (memory.mark_compact ? 1 : 2)*memory.space_objects;
+  memory.num_arena_objects = num_objects;
 
-  memory.the_objects = (Object*)malloc(n_bytes);
+  // The to-space may be placed above a current space which begins at most 2 spaces above the start,
+  // so the spaces never need more than 3 of the largest spaces.
+  num_reserved_objects = SpacesStart() + (memory.mark_compact ? 1 : 3)*memory.max_space_objects;
+  memory.the_objects = ReserveArena(num_reserved_objects, options.huge_pages);
   if (!memory.the_objects) {
     *error = ERROR_COULD_NOT_ALLOCATE_HEAP;
     return;
   }
-  assert(memory.the_objects);
+  if (options.gc_log_path && !OpenGCLog(options.gc_log_path)) {
+    *error = ERROR_COULD_NOT_OPEN_GC_LOG;
+    return;
+  }
 
-  memory.new_objects = (Object*)malloc(n_bytes);
-  if (!memory.the_objects) {
+  memory.num_remembered = 0;
+  memory.max_remembered = 256;
+  memory.remembered_set_overflowed = 0;
+  memory.remembered = (u64*)malloc(sizeof(u64)*memory.max_remembered);
+  if (!memory.remembered) {
+    *error = ERROR_COULD_NOT_ALLOCATE_HEAP_BUFFER;
+    return;
+  }
+  assert(memory.remembered);
+
+  InitializeParallelCollector(memory.num_gc_threads, error);
+  if (*error) return;
+  InitializeLargeObjectSpace(memory.nursery_objects, memory.large_object_space_objects, error);
+  if (*error) return;
+  if (memory.mark_compact && !ResizeCompactionTables(num_objects)) {
     *error = ERROR_COULD_NOT_ALLOCATE_HEAP_BUFFER;
     return;
   }
-  assert(memory.new_objects);
+  if (memory.mostly_copying) {
+    InitializeConservativeRoots(num_reserved_objects, error);
+    if (*error) return;
+  }
 
-  for (u64 i = 0; i < memory.max_objects; ++i) memory.the_objects[i] = nil;
-  memory.free = 0;
+  memory.nursery_free = 0;
+  memory.space_start = SpacesStart();
+  memory.free = memory.space_start;
 
   InitializeRoot(error);
+  if (*error) return;
+  // Samples record the procedure register, so sampling begins once the root exists.
+  ResetAllocationProfile();
+  SetAllocationSampleInterval(options.allocation_sample_interval);
 }
 
 void DestroyMemory() {
-  free(memory.the_objects);
-  free(memory.new_objects);
+  munmap(memory.the_objects, sizeof(Object)*num_reserved_objects);
+  free(memory.remembered);
+  DestroyRoot();
+  DestroyParallelCollector();
+  DestroyLargeObjectSpace();
+  DestroyCompactionTables();
+  DestroyConservativeRoots();
+  DestroyWeakReferences();
+  DestroyFinalizers();
+  DestroyJit();
+  CloseGCLog();
+  SetAllocationSampleInterval(0);
+  DestroyAllocationProfile();
+}
+
+static u64 SpaceRoom() {
+  return memory.space_start + memory.space_objects - memory.free - memory.nursery_free;
 }
 
-b64 HasEnoughMemory(u64 num_objects_required) {
-  return memory.free + num_objects_required <= memory.max_objects;
+static b64 NurseryHasRoom(u64 num_objects_required) {
+  // The nursery can't hold more than could be promoted into the current space.
+  return memory.nursery_free + num_objects_required <= memory.nursery_objects
+    && num_objects_required <= SpaceRoom();
+}
+
+static b64 SpaceHasRoom(u64 num_objects_required) {
+  return num_objects_required <= SpaceRoom();
+}
+
+static b64 ToSpaceHasRoom(u64 num_objects_required) {
+  // Reserve room for the condemned objects which haven't been copied yet.
+  u64 num_objects_uncopied = num_objects_condemned - num_objects_copied;
+  return memory.free + num_objects_required + num_objects_uncopied <= memory.space_start + memory.space_objects;
+}
+
+static b64 IsAllocatedInNursery(u64 num_objects) {
+  return num_objects <= memory.nursery_objects && !memory.is_collecting_incrementally
+    && memory.nursery_free + num_objects <= memory.nursery_objects;
+}
+
+static b64 HasEnoughMemory(u64 num_objects_required) {
+  if (memory.is_collecting_incrementally) return ToSpaceHasRoom(num_objects_required);
+  return num_objects_required <= memory.nursery_objects
+    ? NurseryHasRoom(num_objects_required)
+    : SpaceHasRoom(num_objects_required);
 }
 
 void EnsureEnoughMemory(u64 num_objects_required, enum ErrorCode *error) {
-  if (!HasEnoughMemory(num_objects_required)) {
-    CollectGarbage();
+  if (HasEnoughMemory(num_objects_required)) return;
+
+  if (memory.is_collecting_incrementally) {
+    LOG(LOG_MEMORY, "The to-space is full before the incremental scan, finishing the collection\n");
+    FinishIncrementalCollection();
+    if (HasEnoughMemory(num_objects_required)) return;
   }
 
+  if (num_objects_required <= memory.nursery_objects) {
+    CollectYoungGarbage();
+    // Promotion fills the current space. Reclaim it while the nursery is empty.
+    if (SpaceRoom() < memory.nursery_objects) CollectOldGeneration();
+  } else {
+    CollectOldGeneration();
+  }
+
+  // The incremental collection couldn't free enough memory in time.
+  if (!HasEnoughMemory(num_objects_required) && memory.is_collecting_incrementally) FinishIncrementalCollection();
+
+  // Objects pinned in the nursery may leave it without room, even after a collection.
+  // Small objects are then allocated directly into the current space.
+  if (!HasEnoughMemory(num_objects_required) && memory.nursery_free > 0 && SpaceHasRoom(num_objects_required)) return;
+
+  if (!HasEnoughMemory(num_objects_required)) GrowSpace(num_objects_required);
+
   if (!HasEnoughMemory(num_objects_required)) {
     *error = ERROR_OUT_OF_MEMORY;
   }
 }
 
+u64 AllocateObjects(u64 num_objects, enum ErrorCode *error) {
+  // The allocation may collect garbage, which ends the reservation.
+  num_objects_reserved = 0;
+
+  // The pause for each allocation is bounded by the amount allocated.
+  if (memory.is_collecting_incrementally) ScanIncrementally(num_objects * memory.incremental_scan_ratio);
+
+  u64 new_reference;
+  if (num_objects >= memory.large_object_threshold && AllocateInLargeObjectSpace(num_objects, &new_reference)) {
+    memory.num_objects_allocated += num_objects;
+    return new_reference;
+  }
+
+  // Objects pinned in the nursery leave holes between them, which small objects fill before the rest of the nursery.
+  if (memory.mostly_copying && num_objects <= memory.nursery_objects && AllocateInNurseryHole(num_objects, &new_reference)) {
+    memory.num_objects_allocated += num_objects;
+    return new_reference;
+  }
+
+  EnsureEnoughMemory(num_objects, error);
+  if (*error) return 0;
+
+  if (IsAllocatedInNursery(num_objects)) {
+    // Small objects are allocated in the nursery
+    new_reference = memory.nursery_free;
+    memory.nursery_free += num_objects;
+  } else {
+    // Objects too large for the nursery, and objects allocated during an incremental collection,
+    // are allocated directly into the old generation.
+    new_reference = memory.free;
+    memory.free += num_objects;
+  }
+  if (memory.mostly_copying) RecordObjectStart(new_reference);
+  memory.num_objects_allocated += num_objects;
+  return new_reference;
+}
+
+void ReserveObjects(u64 num_objects, enum ErrorCode *error) {
+  num_objects_reserved = 0;
+  if (memory.is_collecting_incrementally) ScanIncrementally(num_objects * memory.incremental_scan_ratio);
+  EnsureEnoughMemory(num_objects, error);
+  if (*error) return;
+  num_objects_reserved = num_objects;
+  // EnsureEnoughMemory made room where AllocateObjects would have put the reserved objects.
+  is_reservation_in_nursery = IsAllocatedInNursery(num_objects);
+}
+
+u64 AllocateReservedObjects(u64 num_objects) {
+  assert(num_objects <= num_objects_reserved);
+  num_objects_reserved -= num_objects;
+  u64 new_reference;
+  if (is_reservation_in_nursery) {
+    new_reference = memory.nursery_free;
+    memory.nursery_free += num_objects;
+  } else {
+    new_reference = memory.free;
+    memory.free += num_objects;
+  }
+  if (memory.mostly_copying) RecordObjectStart(new_reference);
+  memory.num_objects_allocated += num_objects;
+  return new_reference;
+}
+
+u64 AllocatePinnableObjects(u64 num_objects, enum ErrorCode *error) {
+  if (memory.is_collecting_incrementally) ScanIncrementally(num_objects * memory.incremental_scan_ratio);
+  u64 new_reference;
+  if (!AllocateInLargeObjectSpace(num_objects, &new_reference)) {
+    LOG_ERROR("Could not allocate %llu pinnable objects in the large object space", num_objects);
+    *error = ERROR_OUT_OF_MEMORY;
+    return 0;
+  }
+  memory.num_objects_allocated += num_objects;
+  return new_reference;
+}
+
+void PinObject(Object object, enum ErrorCode *error) {
+  if (!IsReference(object) || !IsLargeObject(UnboxReference(object))) {
+    *error = ERROR_OBJECT_CANNOT_BE_PINNED;
+    return;
+  }
+  PinLargeObject(UnboxReference(object));
+  // The collection in progress may not have reached the object, and the caller may be its only holder.
+  if (is_marking_large_objects) MarkLargeObject(UnboxReference(object));
+}
+
+void UnpinObject(Object object, enum ErrorCode *error) {
+  if (!IsPinned(object) || !UnpinLargeObject(UnboxReference(object))) *error = ERROR_OBJECT_IS_NOT_PINNED;
+}
+
+b64 IsPinned(Object object) {
+  return IsReference(object) && IsLargeObject(UnboxReference(object)) && IsLargeObjectPinned(UnboxReference(object));
+}
+
+Object ReadBarrier(u64 index) {
+  Object object = memory.the_objects[index];
+  if (!memory.is_collecting_incrementally || !IsReference(object)) return object;
+  if (IsLargeObject(UnboxReference(object))) {
+    // The mutator may store the reference into an object which has already been scanned.
+    MarkLargeObject(UnboxReference(object));
+    return object;
+  }
+  if (!IsCondemned(UnboxReference(object))) return object;
+  // Move the object before the mutator can see its old reference, and update the slot.
+  object = MoveObject(object);
+  memory.the_objects[index] = object;
+  return object;
+}
+
+void WriteBarrier(u64 index, Object value) {
+  // Stores into young objects, and of non-young values, don't need to be remembered.
+  if (index < memory.nursery_objects) return;
+  if (!IsReference(value) || UnboxReference(value) >= memory.nursery_objects) return;
+  Remember(index);
+}
+
+static u64 SpacesStart() { return memory.nursery_objects + memory.large_object_space_objects; }
+
+static b64 AllocateInLargeObjectSpace(u64 num_objects, u64 *reference) {
+  if (!AllocateLargeObject(num_objects, reference)) {
+    // Nothing can have died in the large object space without allocating into it since the last full collection.
+    if (num_large_objects_allocated == 0 || num_objects > memory.large_object_space_objects) return 0;
+    // Free the unreachable large objects, and try again.
+    CollectGarbage();
+    if (!AllocateLargeObject(num_objects, reference)) return 0;
+  }
+  num_large_objects_allocated += num_objects;
+  // Objects allocated during an incremental collection are already scanned.
+  if (memory.is_collecting_incrementally) MarkLargeObjectScanned(*reference);
+  return 1;
+}
+
+static u64 ToSpace(u64 space_objects) {
+  // The mark-compact collector collects the current space in place.
+  if (memory.mark_compact) return memory.space_start;
+  return SpacesStart() + space_objects <= memory.space_start
+    ? SpacesStart()
+    : memory.space_start + space_objects;
+}
+
+static b64 ResizeSpaces(u64 space_objects) {
+  // The current space can't shrink past its objects, or the room reserved to promote the nursery.
+  u64 num_objects_used = memory.free - memory.space_start + memory.nursery_free;
+  if (space_objects < num_objects_used) space_objects = num_objects_used;
+
+  // [ nursery | ..., current space, ... ] with room for the next to-space
+  u64 num_arena_objects = ToSpace(space_objects) + space_objects;
+  if (num_arena_objects < memory.space_start + space_objects) num_arena_objects = memory.space_start + space_objects;
+
+  if (num_arena_objects > num_reserved_objects) {
+    LOG_ERROR("Could not resize the heap to %llu objects, only %llu are reserved", num_arena_objects, num_reserved_objects);
+    return 0;
+  }
+  if (num_arena_objects != memory.num_arena_objects) {
+    if (memory.mark_compact && !ResizeCompactionTables(num_arena_objects)) return 0;
+    ReleaseObjects(num_arena_objects, memory.num_arena_objects);
+    memory.num_arena_objects = num_arena_objects;
+  }
+  LOG(LOG_MEMORY, "Resized the spaces from %llu to %llu objects\n", memory.space_objects, space_objects);
+  memory.space_objects = space_objects;
+  return 1;
+}
+
+static void AdjustSpaceSize() {
+  u64 now = Nanoseconds();
+  u64 gc_nanoseconds = GCNanoseconds();
+  u64 elapsed = now - last_resize_nanoseconds;
+  u64 gc_time_percent = elapsed ? 100*(gc_nanoseconds - last_resize_gc_nanoseconds) / elapsed : 0;
+  last_resize_nanoseconds = now;
+  last_resize_gc_nanoseconds = gc_nanoseconds;
+
+  u64 live = memory.free - memory.space_start;
+  u64 survival_percent = num_objects_condemned ? 100*live / num_objects_condemned : 0;
+  // Leave room to allocate as much as survived, and to promote a full nursery.
+  u64 num_objects_needed = 2*live + memory.nursery_objects;
+
+  u64 space_objects = memory.space_objects;
+  if (num_objects_needed > space_objects
+      || survival_percent > memory.target_survival_percent
+      || gc_time_percent > memory.target_gc_time_percent) {
+    space_objects = 2*space_objects;
+    if (space_objects < num_objects_needed) space_objects = num_objects_needed;
+    if (space_objects > memory.space_objects + memory.max_growth_objects) {
+      space_objects = memory.space_objects + memory.max_growth_objects;
+    }
+  } else if (2*num_objects_needed < space_objects
+      && 4*survival_percent < memory.target_survival_percent
+      && 4*gc_time_percent < memory.target_gc_time_percent) {
+    space_objects = space_objects / 2;
+    if (space_objects < num_objects_needed) space_objects = num_objects_needed;
+  }
+  if (space_objects < memory.min_space_objects) space_objects = memory.min_space_objects;
+  if (space_objects > memory.max_space_objects) space_objects = memory.max_space_objects;
+
+  LOG(LOG_MEMORY, "%llu%% survived, %llu%% of the time was spent collecting\n", survival_percent, gc_time_percent);
+  // The next to-space may not fit in the_objects, even if the size of the spaces hasn't changed.
+  if (!ResizeSpaces(space_objects)) ResizeSpaces(memory.space_objects);
+}
+
+static void GrowSpace(u64 num_objects_required) {
+  if (memory.space_objects == memory.max_space_objects) return;
+  // Leave room to promote a full nursery after the allocation.
+  u64 room_required = num_objects_required + memory.nursery_objects;
+  u64 room = SpaceRoom();
+  u64 space_objects = memory.space_objects + memory.max_growth_objects;
+  if (room < room_required && space_objects < memory.space_objects + room_required - room) {
+    // Grow by more than a single step, rather than failing an allocation which is within bounds.
+    space_objects = memory.space_objects + room_required - room;
+  }
+  if (space_objects > memory.max_space_objects) space_objects = memory.max_space_objects;
+  ResizeSpaces(space_objects);
+}
+
+static Object *ReserveArena(u64 num_objects, b64 huge_pages) {
+  page_objects = sysconf(_SC_PAGESIZE) / sizeof(Object);
+  void *the_objects = mmap(0, sizeof(Object)*num_objects, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (the_objects == MAP_FAILED) {
+    LOG_ERROR("Could not reserve %llu objects", num_objects);
+    return 0;
+  }
+#ifdef MADV_HUGEPAGE
+  if (huge_pages) madvise(the_objects, sizeof(Object)*num_objects, MADV_HUGEPAGE);
+#endif
+  return (Object*)the_objects;
+}
+
+static void ReleaseObjects(u64 start, u64 end) {
+  // Round inwards to whole pages. the_objects begins on a page boundary.
+  start = (start + page_objects - 1) / page_objects * page_objects;
+  end = end / page_objects * page_objects;
+  if (start >= end) return;
+  LOG(LOG_MEMORY, "Releasing objects [%llu, %llu)\n", start, end);
+  madvise(&memory.the_objects[start], sizeof(Object)*(end - start), MADV_DONTNEED);
+}
+
+static u64 Nanoseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (u64)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void StartTiming() {
+  if (timing_depth++ == 0) timing_start = Nanoseconds();
+}
+
+static void StopTiming() {
+  if (--timing_depth > 0) return;
+  u64 pause = Nanoseconds() - timing_start;
+  memory.num_gc_nanoseconds += pause;
+  RecordPause(pause);
+}
+
+static u64 GCNanoseconds() {
+  return memory.num_gc_nanoseconds + (timing_depth > 0 ? Nanoseconds() - timing_start : 0);
+}
+
+void UpdateWeakTables() {
+  UpdateWeakReferences();
+  UpdateFinalizers();
+  UpdateAllocationProfile();
+}
+
+static u64 ObjectsInUse() {
+  return memory.nursery_free + memory.free - memory.space_start + LargeObjectSpaceUsed();
+}
+
+static void BeginCollectionStatistics(enum CollectionKind kind, u64 objects_condemned) {
+  u64 now = Nanoseconds();
+  collection.kind = kind;
+  collection.number = memory.num_collections + 1;
+  collection.objects_before = ObjectsInUse();
+  collection.objects_condemned = objects_condemned;
+  collection.objects_allocated = memory.num_objects_allocated - last_collection_end_objects_allocated;
+  collection.mutator_nanoseconds = now - last_collection_end_nanoseconds;
+  collection_start_gc_nanoseconds = GCNanoseconds();
+  collection_start_objects_moved = memory.num_objects_moved;
+}
+
+static void EndCollectionStatistics() {
+  collection.gc_nanoseconds = GCNanoseconds() - collection_start_gc_nanoseconds;
+  collection.objects_after = ObjectsInUse();
+  collection.objects_survived = memory.num_objects_moved - collection_start_objects_moved;
+  RecordCollection(collection);
+  last_collection_end_nanoseconds = Nanoseconds();
+  last_collection_end_objects_allocated = memory.num_objects_allocated;
+}
+
+static void Remember(u64 index) {
+  if (memory.num_remembered == memory.max_remembered) {
+    u64 max_remembered = 2*memory.max_remembered;
+    u64 *remembered = (u64*)realloc(memory.remembered, sizeof(u64)*max_remembered);
+    if (!remembered) {
+      LOG_ERROR("Could not grow the remembered set to %llu slots", max_remembered);
+      memory.remembered_set_overflowed = 1;
+      return;
+    }
+    memory.remembered = remembered;
+    memory.max_remembered = max_remembered;
+  }
+  memory.remembered[memory.num_remembered++] = index;
+}
+
+static void ForgetRememberedSet() {
+  memory.num_remembered = 0;
+  memory.remembered_set_overflowed = 0;
+}
+
 void PrintObject(Object object) {
   if (IsReal64(object)) { 
     printf("%llf", UnboxReal64(object));
     return;
   }
-  switch (GetTag(object)) {
-    // Primitives
-    case TAG_NIL:    printf("nil"); break;
-    case TAG_TRUE:   printf("#t");  break;
-    case TAG_FALSE:  printf("#f");  break;
-    case TAG_FIXNUM: printf("%lld", UnboxFixnum(object)); break;
-    case TAG_PRIMITIVE_PROCEDURE: printf("<procedure %x>", UnboxPrimitiveProcedure(object)); break;
-
-    // Reference Objects
-    case TAG_PAIR:               PrintPair(object);              break;
-    case TAG_VECTOR:             PrintVector(object);            break;
-    case TAG_STRING:             PrintString(object);            break;
-    case TAG_SYMBOL:             PrintSymbol(object);            break;
-    case TAG_BYTE_VECTOR:        PrintByteVector(object);        break;
-    case TAG_COMPOUND_PROCEDURE: PrintCompoundProcedure(object); break;
-  }
+  void (*print)(Object object) = TypeDescriptorOf(GetTag(object))->print;
+  if (print) print(object);
 }
 
 void PrintlnObject(Object object) {
@@ -182,30 +1059,33 @@ void PrintlnReference(Object object) {
 void PrintReference(Object object) {
   if (IsReal64(object)) {
     printf("%llf", UnboxReal64(object));
-  } else {
-    switch (GetTag(object)) {
-      case TAG_NIL:    printf("nil");   break;
-      case TAG_TRUE:   printf("true");  break;
-      case TAG_FALSE:  printf("false"); break;
-      case TAG_FIXNUM: printf("%lld", UnboxFixnum(object)); break;
-      // Reference Objects
-      case TAG_PAIR:               printf("<Pair %llu>",              UnboxReference(object)); break;
-      case TAG_STRING:             printf("<String %llu>",            UnboxReference(object)); break;
-      case TAG_SYMBOL:             printf("<Symbol %llu>",            UnboxReference(object)); break;
-      case TAG_VECTOR:             printf("<Vector %llu>",            UnboxReference(object)); break;
-      case TAG_BYTE_VECTOR:        printf("<ByteVector %llu>",        UnboxReference(object)); break;
-      case TAG_COMPOUND_PROCEDURE: printf("<CompoundProcedure %llu>", UnboxReference(object)); break;
-    }
+  } else if (IsReference(object)) {
+    printf("<%s %llu>", TypeDescriptorOf(GetTag(object))->reference_name, (unsigned long long)UnboxReference(object));
+  } else if (IsFixnum(object)) {
+    printf("%lld", (long long)UnboxFixnum(object));
+  } else if (IsNil(object) || IsBoolean(object)) {
+    // Spelled out, to stand apart from the objects around it.
+    printf("%s", TypeDescriptorOf(GetTag(object))->name);
   }
 }
 
 void PrintMemory() {
-  printf("Free=%llu, Root=", memory.free);
-  PrintlnObject(memory.root);
-  printf("0:");
+  printf("Free=%llu, Registers=(", (unsigned long long)memory.free);
+  for (u64 reg = 0; reg < NUM_REGISTERS; ++reg) {
+    if (reg > 0) printf(" ");
+    PrintReference(memory.registers[reg]);
+  }
+  printf(")\n");
   const int width = 8;
-  for (u64 i = 0; i < memory.max_objects; ++i) {
-    if (i > 0 && i % width == 0) printf(" |\n%d:", i);
+  printf("Nursery:\n0:");
+  for (u64 i = 0; i < memory.nursery_free; ++i) {
+    if (i > 0 && i % width == 0) printf(" |\n%llu:", (unsigned long long)i);
+    printf(" | ");
+    PrintReference(memory.the_objects[i]);
+  }
+  printf(" |\nSpace:\n%llu:", (unsigned long long)memory.space_start);
+  for (u64 i = memory.space_start; i < memory.free; ++i) {
+    if (i > memory.space_start && (i - memory.space_start) % width == 0) printf(" |\n%llu:", (unsigned long long)i);
     printf(" | ");
     PrintReference(memory.the_objects[i]);
   }
@@ -222,9 +1102,14 @@ static Object MakePair(Object car, Object cdr, enum ErrorCode *error) {
   return pair;
 }
 
+static void CountFinalization(void *count) { ++*(u64*)count; }
+
 void TestMemory() {
   enum ErrorCode error = NO_ERROR;
-  InitializeMemory(128, &error);
+  // The nursery is large enough that the unsafe setup below doesn't collect.
+  struct MemoryOptions options = DefaultMemoryOptions(128);
+  options.nursery_objects = 128;
+  InitializeMemoryWithOptions(options, &error);
   MakePair(BoxFixnum(4), BoxFixnum(2), &error);
   Object string = AllocateString("Hello", &error);
 
@@ -256,9 +1141,9 @@ void TestMemory() {
   }
   LOG(LOG_TEST, "Root: ");
   LOG_OP(LOG_TEST, PrintlnObject(GetRegister(REGISTER_EXPRESSION)));
-  LOG(LOG_TEST, "Allocated %llu objects, performed %llu garbage collections, moved %llu objects,\n"
+  LOG(LOG_TEST, "Allocated %llu objects, performed %llu garbage collections (%llu young), moved %llu objects,\n"
       "on average: %llf objects allocated/collection, %llf objects moved/collection\n",
-      memory.num_objects_allocated, memory.num_collections, memory.num_objects_moved,
+      memory.num_objects_allocated, memory.num_collections, memory.num_young_collections, memory.num_objects_moved,
       memory.num_objects_allocated * 1.0 / memory.num_collections,
       memory.num_objects_moved * 1.0 / memory.num_collections);
 
@@ -266,5 +1151,574 @@ void TestMemory() {
   SetRegister(REGISTER_EXPRESSION, AllocateVector(30 - NUM_REGISTERS, &error));
   LOG(LOG_TEST, "Root: ");
   LOG_OP(LOG_TEST, PrintlnObject(GetRegister(REGISTER_EXPRESSION)));
+
+  // A young object referenced only by an old object survives a young collection.
+  SetRegister(REGISTER_EXPRESSION, MakePair(nil, nil, &error));
+  CollectGarbage();
+  assert(UnboxReference(GetRegister(REGISTER_EXPRESSION)) >= memory.nursery_objects);
+  string = AllocateString("young", &error);
+  assert(UnboxReference(string) < memory.nursery_objects);
+  SetCar(GetRegister(REGISTER_EXPRESSION), string);
+  assert(memory.num_remembered == 1);
+  CollectYoungGarbage();
+  assert(!error);
+  assert(memory.nursery_free == 0);
+  assert(memory.num_remembered == 0);
+  string = Car(GetRegister(REGISTER_EXPRESSION));
+  assert(UnboxReference(string) >= memory.nursery_objects);
+  assert(!strcmp("young", StringCharacterBuffer(string)));
+  DestroyMemory();
+
+  // Collections of a large heap are shared between several threads.
+  options = DefaultMemoryOptions(1 << 16);
+  options.nursery_objects = 1 << 14;
+  options.num_gc_threads = 4;
+  InitializeMemoryWithOptions(options, &error);
+  const u64 num_pairs = 4000;
+  for (u64 i = 0; i < num_pairs; ++i) {
+    Object pair = AllocatePair(&error);
+    SetCdr(pair, GetRegister(REGISTER_EXPRESSION));
+    SetRegister(REGISTER_EXPRESSION, pair);
+    Object car = i % 2 ? BoxFixnum(i) : AllocateString("parallel", &error);
+    SetCar(GetRegister(REGISTER_EXPRESSION), car);
+  }
+  assert(!error);
+  CollectYoungGarbage();
+  CollectGarbage();
+  assert(memory.num_parallel_collections == 2);
+  u64 i = num_pairs;
+  for (Object list = GetRegister(REGISTER_EXPRESSION); IsPair(list); list = Cdr(list)) {
+    --i;
+    if (i % 2) assert(UnboxFixnum(Car(list)) == i);
+    else assert(!strcmp("parallel", StringCharacterBuffer(Car(list))));
+  }
+  assert(i == 0);
+  DestroyMemory();
+
+  // An incremental collection is completed by later allocations, and the list stays intact throughout.
+  options = DefaultMemoryOptions(256);
+  options.nursery_objects = 32;
+  options.incremental_scan_ratio = 2;
+  InitializeMemoryWithOptions(options, &error);
+  for (u64 i = 0; i < 1000; ++i) {
+    Object pair = AllocatePair(&error);
+    SetCar(pair, BoxFixnum(i));
+    SetCdr(pair, GetRegister(REGISTER_EXPRESSION));
+    SetRegister(REGISTER_EXPRESSION, pair);
+    // Keep the 20 most recent pairs.
+    Object list = GetRegister(REGISTER_EXPRESSION);
+    for (u64 j = 0; j < 19 && IsPair(Cdr(list)); ++j) list = Cdr(list);
+    SetCdr(list, nil);
+
+    u64 expected = i;
+    for (list = GetRegister(REGISTER_EXPRESSION); IsPair(list); list = Cdr(list)) {
+      assert(UnboxFixnum(Car(list)) == expected--);
+    }
+  }
+  assert(!error);
+  assert(memory.num_incremental_collections > 0);
+  DestroyMemory();
+
+  // The spaces grow to fit the live objects, up to max_space_objects.
+  options = DefaultMemoryOptions(64);
+  options.nursery_objects = 16;
+  options.max_space_objects = 1024;
+  InitializeMemoryWithOptions(options, &error);
+  for (u64 i = 0; i < 400; ++i) {
+    Object pair = AllocatePair(&error);
+    SetCar(pair, BoxFixnum(i));
+    SetCdr(pair, GetRegister(REGISTER_EXPRESSION));
+    SetRegister(REGISTER_EXPRESSION, pair);
+  }
+  assert(!error);
+  assert(memory.space_objects > 64);
+  assert(memory.space_objects <= 1024);
+  u64 expected = 400;
+  for (Object list = GetRegister(REGISTER_EXPRESSION); IsPair(list); list = Cdr(list)) {
+    assert(UnboxFixnum(Car(list)) == --expected);
+  }
+  assert(expected == 0);
+  AllocateVector(1024, &error);
+  assert(error == ERROR_OUT_OF_MEMORY);
+  DestroyMemory();
+
+  // Large objects aren't moved, and are freed once they are unreachable.
+  error = NO_ERROR;
+  options = DefaultMemoryOptions(1024);
+  options.large_object_threshold = 256;
+  InitializeMemoryWithOptions(options, &error);
+  SetRegister(REGISTER_EXPRESSION, AllocateVector(300, &error));
+  u64 large_reference = UnboxReference(GetRegister(REGISTER_EXPRESSION));
+  assert(IsLargeObject(large_reference));
+  string = AllocateString("referenced by a large object", &error);
+  UnsafeVectorSet(GetRegister(REGISTER_EXPRESSION), 299, string);
+  AllocateByteVector(4096, &error);
+  assert(!error);
+  assert(LargeObjectSpaceUsed() == 301 + 513);
+  CollectGarbage();
+  assert(UnboxReference(GetRegister(REGISTER_EXPRESSION)) == large_reference);
+  assert(LargeObjectSpaceUsed() == 301);
+  string = UnsafeVectorRef(GetRegister(REGISTER_EXPRESSION), 299);
+  assert(!strcmp("referenced by a large object", StringCharacterBuffer(string)));
+  DestroyMemory();
+
+  // An incremental collection scans a large object a few slots at a time, so no allocation moves all it references.
+  options = DefaultMemoryOptions(4096);
+  options.nursery_objects = 32;
+  options.incremental_scan_ratio = 2;
+  InitializeMemoryWithOptions(options, &error);
+  SetRegister(REGISTER_EXPRESSION, AllocateVector(300, &error));
+  for (u64 i = 0; i < 300; ++i) {
+    Object pair = AllocatePair(&error);
+    SetCar(pair, BoxFixnum(i));
+    UnsafeVectorSet(GetRegister(REGISTER_EXPRESSION), i, pair);
+  }
+  CollectGarbage();
+  BeginIncrementalCollection();
+  u64 num_allocations = 0;
+  for (; memory.is_collecting_incrementally; ++num_allocations) {
+    u64 copied = num_objects_copied;
+    AllocatePair(&error);
+    assert(num_objects_copied - copied < 100);
+  }
+  assert(!error);
+  assert(num_allocations > 10);
+  for (u64 i = 0; i < 300; ++i) {
+    assert(UnboxFixnum(Car(UnsafeVectorRef(GetRegister(REGISTER_EXPRESSION), i))) == i);
+  }
+  DestroyMemory();
+
+  // Compaction slides the live objects in place, in the order they were allocated.
+  options = DefaultMemoryOptions(1024);
+  options.nursery_objects = 64;
+  options.large_object_space_objects = 512;
+  options.mark_compact = 1;
+  InitializeMemoryWithOptions(options, &error);
+  assert(memory.num_arena_objects == memory.space_start + memory.space_objects);
+  SetRegister(REGISTER_EXPRESSION, AllocateVector(300, &error));
+  assert(IsLargeObject(UnboxReference(GetRegister(REGISTER_EXPRESSION))));
+  for (u64 i = 0; i < 1000; ++i) {
+    Object pair = AllocatePair(&error);
+    SetCar(pair, BoxFixnum(i));
+    SetCdr(pair, GetRegister(REGISTER_VALUE));
+    SetRegister(REGISTER_VALUE, pair);
+    // Keep the 20 most recent pairs, and strings referenced by a large object.
+    Object list = GetRegister(REGISTER_VALUE);
+    for (u64 j = 0; j < 19 && IsPair(Cdr(list)); ++j) list = Cdr(list);
+    SetCdr(list, nil);
+    string = AllocateString("compacted", &error);
+    UnsafeVectorSet(GetRegister(REGISTER_EXPRESSION), i % 300, string);
+  }
+  assert(memory.num_collections > memory.num_young_collections);
+  assert(!error);
+  CollectGarbage();
+  u64 old_references[20];
+  i = 0;
+  for (Object list = GetRegister(REGISTER_VALUE); IsPair(list); list = Cdr(list)) old_references[i++] = UnboxReference(list);
+  assert(i == 20);
+  for (u64 i = 0; i < 100; ++i) AllocatePair(&error);
+  CollectGarbage();
+  assert(memory.num_arena_objects == memory.space_start + memory.space_objects);
+  assert(memory.nursery_free == 0);
+  expected = 1000;
+  i = 0;
+  u64 previous = 0;
+  for (Object list = GetRegister(REGISTER_VALUE); IsPair(list); list = Cdr(list), ++i) {
+    assert(UnboxFixnum(Car(list)) == --expected);
+    // The pairs slid down, without changing places.
+    u64 reference = UnboxReference(list);
+    assert(reference <= old_references[i]);
+    if (i > 0) assert((reference < previous) == (old_references[i] < old_references[i - 1]));
+    previous = reference;
+  }
+  assert(expected == 980);
+  for (u64 i = 0; i < 300; ++i) {
+    string = UnsafeVectorRef(GetRegister(REGISTER_EXPRESSION), i);
+    assert(!strcmp("compacted", StringCharacterBuffer(string)));
+  }
+  DestroyMemory();
+
+  // A weak reference's target is cleared once it is only reachable through weak references.
+  options = DefaultMemoryOptions(256);
+  options.nursery_objects = 64;
+  InitializeMemoryWithOptions(options, &error);
+  SetRegister(REGISTER_EXPRESSION, AllocateWeakReference(&error));
+  SetRegister(REGISTER_VALUE, AllocateWeakReference(&error));
+  string = AllocateString("dies", &error);
+  SetWeakReferenceTarget(GetRegister(REGISTER_EXPRESSION), string);
+  SetRegister(REGISTER_ARGUMENT_LIST, AllocateString("lives", &error));
+  SetWeakReferenceTarget(GetRegister(REGISTER_VALUE), GetRegister(REGISTER_ARGUMENT_LIST));
+  assert(!error);
+  CollectYoungGarbage();
+  assert(WeakReferenceTarget(GetRegister(REGISTER_EXPRESSION)) == nil);
+  assert(WeakReferenceTarget(GetRegister(REGISTER_VALUE)) == GetRegister(REGISTER_ARGUMENT_LIST));
+  SetRegister(REGISTER_ARGUMENT_LIST, nil);
+  CollectGarbage();
+  assert(WeakReferenceTarget(GetRegister(REGISTER_VALUE)) == nil);
+  DestroyMemory();
+
+  // Each collection is recorded in the statistics, and logged as a JSON line.
+  remove("test_gc_log.jsonl");
+  options = DefaultMemoryOptions(256);
+  options.nursery_objects = 64;
+  options.gc_log_path = "test_gc_log.jsonl";
+  InitializeMemoryWithOptions(options, &error);
+  SetRegister(REGISTER_VALUE, AllocatePair(&error));
+  for (u64 i = 0; i < 100; ++i) AllocatePair(&error);
+  assert(!error);
+  CollectGarbage();
+  struct CollectionStatistics last = gc_statistics.last_collection;
+  assert(last.kind == (memory.mark_compact ? COLLECTION_COMPACTING : COLLECTION_FULL));
+  assert(last.number == memory.num_collections);
+  assert(last.objects_survived < last.objects_condemned && last.objects_after < last.objects_before);
+  assert(last.objects_allocated > 0);
+  assert(gc_statistics.num_pauses == memory.num_collections);
+  assert(PausePercentile(50) <= PausePercentile(100) && gc_statistics.max_pause_nanoseconds <= PausePercentile(100));
+  Object statistics = GCStatisticsVector(&error);
+  assert(!error);
+  assert(UnboxFixnum(UnsafeVectorRef(statistics, GC_STATISTICS_COLLECTIONS)) == memory.num_collections);
+  assert(UnboxFixnum(UnsafeVectorRef(statistics, GC_STATISTICS_LAST_OBJECTS_AFTER)) == last.objects_after);
+  u64 num_pauses = 0;
+  for (u64 i = 0; i < NUM_PAUSE_BUCKETS; ++i) {
+    num_pauses += UnboxFixnum(UnsafeVectorRef(statistics, GC_STATISTICS_PAUSE_HISTOGRAM + i));
+  }
+  assert(num_pauses == gc_statistics.num_pauses);
+  u64 num_collections = memory.num_collections;
+  DestroyMemory();
+  FILE *gc_log = fopen("test_gc_log.jsonl", "r");
+  assert(gc_log);
+  u64 num_lines = 0;
+  for (int c; (c = fgetc(gc_log)) != EOF;) num_lines += c == '\n';
+  fclose(gc_log);
+  remove("test_gc_log.jsonl");
+  assert(num_lines == num_collections);
+
+  // A census counts the live objects by tag, and for the first register which reaches them.
+  for (u64 mark_compact = 0; mark_compact < 2; ++mark_compact) {
+    options = DefaultMemoryOptions(1024);
+    options.nursery_objects = 64;
+    options.mark_compact = mark_compact;
+    InitializeMemoryWithOptions(options, &error);
+    for (u64 i = 0; i < 10; ++i) {
+      Object pair = AllocatePair(&error);
+      SetCdr(pair, GetRegister(REGISTER_VALUE));
+      SetRegister(REGISTER_VALUE, pair);
+      AllocatePair(&error);
+    }
+    SetRegister(REGISTER_ARGUMENT_LIST, Cdr(GetRegister(REGISTER_VALUE)));
+    SetRegister(REGISTER_EXPRESSION, AllocateString("census", &error));
+    // A large object.
+    SetRegister(REGISTER_PRIMITIVE_A, AllocateVector(300, &error));
+    assert(!error);
+    TakeHeapCensus();
+    assert(heap_census.collection == memory.num_collections);
+    assert(heap_census.count_by_tag[TAG_PAIR] == 10 && heap_census.objects_by_tag[TAG_PAIR] == 20);
+    assert(heap_census.objects_by_register[REGISTER_VALUE][TAG_PAIR] == 20);
+    assert(heap_census.objects_by_register[REGISTER_ARGUMENT_LIST][TAG_PAIR] == 0);
+    assert(heap_census.objects_by_register[REGISTER_EXPRESSION][TAG_STRING] == NumObjectsPerBlob(strlen("census") + 1));
+    assert(heap_census.objects_by_register[REGISTER_PRIMITIVE_A][TAG_VECTOR] == 301);
+    // The registers aren't in the heap.
+    assert(heap_census.objects_by_tag[TAG_VECTOR] == 301);
+    LOG_OP(LOG_TEST, PrintHeapCensus());
+    // The census doesn't change the collection.
+    u64 length = 0;
+    for (Object list = GetRegister(REGISTER_VALUE); IsPair(list); list = Cdr(list)) ++length;
+    assert(length == 10 && heap_census.num_objects == memory.free - memory.space_start + LargeObjectSpaceUsed());
+    DestroyMemory();
+  }
+
+  // A pinned byte vector keeps its buffer, and stays alive, until it is unpinned.
+  for (u64 mode = 0; mode < 3; ++mode) {
+    options = DefaultMemoryOptions(1024);
+    options.nursery_objects = 64;
+    options.mark_compact = mode == 1;
+    options.incremental_scan_ratio = mode == 2 ? 2 : 0;
+    InitializeMemoryWithOptions(options, &error);
+    // Only C holds the byte vector.
+    Object pinned = AllocatePinnedByteVector(100, &error);
+    u8 *buffer = ByteVectorBuffer(pinned);
+    buffer[99] = 42;
+    for (u64 i = 0; i < 2000; ++i) AllocatePair(&error);
+    CollectGarbage();
+    assert(!error && IsPinned(pinned) && ByteVectorBuffer(pinned) == buffer && buffer[99] == 42);
+    // Objects which may move can't be pinned.
+    PinObject(AllocateByteVector(8, &error), &error);
+    assert(error == ERROR_OBJECT_CANNOT_BE_PINNED);
+    error = NO_ERROR;
+    // The collection in progress began while the byte vector was pinned.
+    if (memory.is_collecting_incrementally) CollectGarbage();
+    u64 large_objects_used = LargeObjectSpaceUsed();
+    UnpinObject(pinned, &error);
+    assert(!error && !IsPinned(pinned));
+    UnpinObject(pinned, &error);
+    assert(error == ERROR_OBJECT_IS_NOT_PINNED);
+    error = NO_ERROR;
+    CollectGarbage();
+    assert(LargeObjectSpaceUsed() == large_objects_used - NumObjectsPerBlob(100));
+    DestroyMemory();
+  }
+
+  // A reservation collects garbage at most once, and the objects allocated from it aren't moved.
+  for (u64 mode = 0; mode < 2; ++mode) {
+    options = DefaultMemoryOptions(256);
+    options.nursery_objects = 32;
+    options.incremental_scan_ratio = mode == 1 ? 2 : 0;
+    InitializeMemoryWithOptions(options, &error);
+    for (u64 i = 0; i < 200; ++i) {
+      ReserveObjects(6, &error);
+      assert(!error);
+      u64 num_collections = memory.num_collections;
+      Object list = AllocateReservedPair();
+      SetCdr(list, AllocateReservedPair());
+      SetCdr(Cdr(list), AllocateReservedPair());
+      assert(memory.num_collections == num_collections);
+      SetCar(Cdr(Cdr(list)), BoxFixnum(i));
+      assert(UnboxFixnum(Car(Cdr(Cdr(list)))) == i);
+    }
+    DestroyMemory();
+  }
+
+  // The descriptor of each type gives the size of its objects, and which of their Objects may be references.
+  InitializeMemory(256, &error);
+  {
+    u64 start, end;
+    Object pair = AllocatePair(&error);
+    ReferenceSlots(pair, &start, &end);
+    assert(ObjectSize(pair) == 2 && start == UnboxReference(pair) && end == start + 2);
+    Object vector = AllocateVector(3, &error);
+    ReferenceSlots(vector, &start, &end);
+    assert(ObjectSize(vector) == 4 && start == UnboxReference(vector) + 1 && end == start + 3);
+    Object byte_vector = AllocateByteVector(20, &error);
+    ReferenceSlots(byte_vector, &start, &end);
+    assert(ObjectSize(byte_vector) == NumObjectsPerBlob(20) && start == end);
+    assert(!error && !strcmp(TypeDescriptorOf(TAG_BYTE_VECTOR)->name, "byte-vector"));
+  }
+  DestroyMemory();
+
+  // With mostly_copying, objects held only by C variables survive collections, and stay where they are.
+  options = DefaultMemoryOptions(1024);
+  options.nursery_objects = 64;
+  options.mostly_copying = 1;
+  InitializeMemoryWithOptions(options, &error);
+  {
+    Object list = nil;
+    for (u64 i = 0; i < 100; ++i) {
+      Object pair = AllocatePair(&error);
+      SetCar(pair, BoxFixnum(i));
+      SetCdr(pair, list);
+      list = pair;
+    }
+    Object string = AllocateString("pinned", &error);
+    const u8 *characters = StringCharacterBuffer(string);
+    for (u64 i = 0; i < 2000; ++i) AllocatePair(&error);
+    CollectGarbage();
+    assert(!error && memory.num_young_collections > 0);
+    assert(StringCharacterBuffer(string) == characters && !strcmp(characters, "pinned"));
+
+    // An object in the current space stays where it is while the space is compacted around it.
+    Object old = list;
+    while (UnboxReference(old) < memory.space_start) old = Cdr(old);
+    Object next = Cdr(old);
+    for (u64 i = 0; i < 2000; ++i) AllocatePair(&error);
+    CollectGarbage();
+    assert(!error && Cdr(old) == next);
+
+    u64 length = 0;
+    u64 sum = 0;
+    for (Object pair = list; IsPair(pair); pair = Cdr(pair), ++length) sum += UnboxFixnum(Car(pair));
+    assert(length == 100 && sum == 99*100/2);
+    // The garbage was collected.
+    assert(memory.nursery_free + memory.free - memory.space_start < 600);
+  }
   DestroyMemory();
+
+  // Saved registers survive collections, and no collection is performed to save them.
+  options = DefaultMemoryOptions(256);
+  options.nursery_objects = 64;
+  InitializeMemoryWithOptions(options, &error);
+  SetRegister(REGISTER_VALUE, AllocateString("saved", &error));
+  for (u64 i = 0; i < 1000; ++i) Save(REGISTER_VALUE, &error);
+  assert(!error && memory.num_collections == 0);
+  SetRegister(REGISTER_VALUE, nil);
+  CollectYoungGarbage();
+  CollectGarbage();
+  for (u64 i = 0; i < 1000; ++i) {
+    Restore(REGISTER_VALUE);
+    assert(!strcmp("saved", StringCharacterBuffer(GetRegister(REGISTER_VALUE))));
+  }
+  // The stack is limited by the size of the heap.
+  ClearStack();
+  while (!error) Save(REGISTER_VALUE, &error);
+  assert(error == ERROR_STACK_OVERFLOW && memory.stack_size == memory.max_space_objects);
+  error = NO_ERROR;
+  DestroyMemory();
+
+  // Sampled allocations are attributed to their tag, and to the procedure in REGISTER_PROCEDURE.
+  options = DefaultMemoryOptions(256);
+  options.nursery_objects = 64;
+  options.allocation_sample_interval = 10;
+  InitializeMemoryWithOptions(options, &error);
+  SetRegister(REGISTER_PROCEDURE, AllocateCompoundProcedure(&error));
+  for (u64 i = 0; i < 100; ++i) AllocatePair(&error);
+  assert(!error);
+  assert(TagAllocationCount(TAG_PAIR).num_samples == 20 && TagAllocationCount(TAG_PAIR).num_objects == 200);
+  assert(TagAllocationCount(TAG_COMPOUND_PROCEDURE).num_samples == 0);
+  // The procedure moved during young collections, and is still recorded.
+  assert(memory.num_young_collections > 0);
+  assert(ProcedureAllocationCount(GetRegister(REGISTER_PROCEDURE)).num_samples == 20);
+  SetRegister(REGISTER_PROCEDURE, nil);
+  CollectGarbage();
+  assert(ProcedureAllocationCount(nil).num_samples == 0);
+  LOG_OP(LOG_MEMORY, PrintAllocationProfile());
+  DestroyMemory();
+
+  // The registers are moved when an incremental collection begins, so samples during it are counted for the
+  // procedure's new copy. They are added to the procedure's samples once the collection completes.
+  options = DefaultMemoryOptions(256);
+  options.nursery_objects = 32;
+  options.incremental_scan_ratio = 2;
+  options.allocation_sample_interval = 1;
+  InitializeMemoryWithOptions(options, &error);
+  SetRegister(REGISTER_PROCEDURE, AllocateCompoundProcedure(&error));
+  for (u64 i = 0; i < 2000 && (memory.num_incremental_collections < 3 || memory.is_collecting_incrementally); ++i) {
+    Object pair = AllocatePair(&error);
+    SetCdr(pair, GetRegister(REGISTER_EXPRESSION));
+    SetRegister(REGISTER_EXPRESSION, pair);
+    // Keep the 20 most recent pairs.
+    Object list = GetRegister(REGISTER_EXPRESSION);
+    for (u64 j = 0; j < 19 && IsPair(Cdr(list)); ++j) list = Cdr(list);
+    SetCdr(list, nil);
+  }
+  assert(!error);
+  assert(memory.num_incremental_collections == 3 && !memory.is_collecting_incrementally);
+  assert(ProcedureAllocationCount(GetRegister(REGISTER_PROCEDURE)).num_samples == TagAllocationCount(TAG_PAIR).num_samples);
+  DestroyMemory();
+
+  // Finalizers run after the collection in which their objects die, and never after being cancelled.
+  for (u64 mark_compact = 0; mark_compact < 2; ++mark_compact) {
+    options = DefaultMemoryOptions(256);
+    options.nursery_objects = 64;
+    options.mark_compact = mark_compact;
+    InitializeMemoryWithOptions(options, &error);
+    u64 num_young_finalized = 0, num_old_finalized = 0, num_cancelled_finalized = 0;
+    RegisterFinalizer(AllocatePair(&error), CountFinalization, &num_young_finalized);
+    SetRegister(REGISTER_VALUE, AllocatePair(&error));
+    RegisterFinalizer(GetRegister(REGISTER_VALUE), CountFinalization, &num_old_finalized);
+    RegisterFinalizer(AllocatePair(&error), CountFinalization, &num_cancelled_finalized);
+    CancelFinalizer(&num_cancelled_finalized);
+    assert(!error);
+    CollectYoungGarbage();
+    assert(num_young_finalized == 1 && num_old_finalized == 0);
+    CollectGarbage();
+    assert(num_old_finalized == 0);
+    SetRegister(REGISTER_VALUE, nil);
+    CollectGarbage();
+    assert(num_young_finalized == 1 && num_old_finalized == 1 && num_cancelled_finalized == 0);
+
+    // A file which is dropped without being closed is closed once it is collected.
+    FILE *stream = fopen("memory.h", "rb");
+    assert(stream);
+    int descriptor = fileno(stream);
+    SetRegister(REGISTER_VALUE, AllocateFile(stream, &error));
+    assert(!error && FileStream(GetRegister(REGISTER_VALUE)) == stream);
+    CollectGarbage();
+    assert(fcntl(descriptor, F_GETFD) != -1);
+    SetRegister(REGISTER_VALUE, nil);
+    CollectGarbage();
+    assert(fcntl(descriptor, F_GETFD) == -1);
+    DestroyMemory();
+  }
+
+  // Copying cdr-first lays out each list in order, even when the lists were allocated interleaved.
+  options = DefaultMemoryOptions(1024);
+  options.copy_order = COPY_CDR_FIRST;
+  // Parallel collections copy in the order the workers scan.
+  options.num_gc_threads = 1;
+  InitializeMemoryWithOptions(options, &error);
+  for (u64 i = 0; i < 100; ++i) {
+    Object pair = AllocatePair(&error);
+    SetCdr(pair, GetRegister(i % 2 ? REGISTER_EXPRESSION : REGISTER_VALUE));
+    SetRegister(i % 2 ? REGISTER_EXPRESSION : REGISTER_VALUE, pair);
+  }
+  assert(!error);
+  CollectGarbage();
+  for (Object list = GetRegister(REGISTER_EXPRESSION); IsPair(Cdr(list)); list = Cdr(list)) {
+    assert(UnboxReference(Cdr(list)) == UnboxReference(list) + 2);
+  }
+  DestroyMemory();
+
+  // Large heaps are reserved rather than allocated, and the condemned space is released after a collection.
+  options = DefaultMemoryOptions(1 << 24);
+  options.nursery_objects = 0;
+  options.large_object_space_objects = 0;
+  options.huge_pages = 1;
+  InitializeMemoryWithOptions(options, &error);
+  assert(!error);
+  SetRegister(REGISTER_EXPRESSION, AllocateVector(1 << 16, &error));
+  for (u64 i = 0; i < 1 << 16; ++i) AllocatePair(&error);
+  assert(!error);
+  u64 condemned = memory.space_start;
+  assert(memory.the_objects[condemned + (1 << 16)] == nil);
+  CollectGarbage();
+  assert(memory.space_start != condemned);
+  assert(memory.the_objects[condemned + (1 << 16)] == 0);
+  DestroyMemory();
+}
+
+static void BenchmarkCopyOrder(const char *name, enum CopyOrder copy_order, u64 num_lists, u64 list_length) {
+  const u64 num_walks = 16;
+  enum ErrorCode error = NO_ERROR;
+  struct MemoryOptions options = DefaultMemoryOptions(4*num_lists*list_length);
+  options.copy_order = copy_order;
+  InitializeMemoryWithOptions(options, &error);
+  SetRegister(REGISTER_EXPRESSION, AllocateVector(num_lists, &error));
+  // The lists grow a pair at a time, in turn, so their pairs are interleaved when they are allocated.
+  for (u64 i = 0; i < list_length; ++i) {
+    for (u64 list = 0; list < num_lists; ++list) {
+      Object pair = AllocatePair(&error);
+      SetCar(pair, BoxFixnum(i));
+      SetCdr(pair, UnsafeVectorRef(GetRegister(REGISTER_EXPRESSION), list));
+      UnsafeVectorSet(GetRegister(REGISTER_EXPRESSION), list, pair);
+    }
+  }
+  CollectGarbage();
+  assert(!error);
+
+  // A step to the next pair misses when it leaves the cache line of the previous pair.
+  u64 num_steps = 0;
+  u64 num_misses = 0;
+  for (u64 list = 0; list < num_lists; ++list) {
+    u64 line = ~0ull;
+    for (Object pair = UnsafeVectorRef(GetRegister(REGISTER_EXPRESSION), list); IsPair(pair); pair = Cdr(pair)) {
+      u64 pair_line = (u64)&memory.the_objects[UnboxReference(pair)] / 64;
+      if (pair_line != line) ++num_misses;
+      line = pair_line;
+      ++num_steps;
+    }
+  }
+
+  s64 sum = 0;
+  u64 start = Nanoseconds();
+  for (u64 walk = 0; walk < num_walks; ++walk) {
+    for (u64 list = 0; list < num_lists; ++list) {
+      for (Object pair = UnsafeVectorRef(GetRegister(REGISTER_EXPRESSION), list); IsPair(pair); pair = Cdr(pair)) {
+        sum += UnboxFixnum(Car(pair));
+      }
+    }
+  }
+  u64 elapsed = Nanoseconds() - start;
+  assert(sum == num_walks * num_lists * list_length * (list_length - 1) / 2);
+  printf("%-20s %6.2f%% of steps miss a cache line, %6.2f ns per pair, %llu collections\n",
+      name, 100.0 * num_misses / num_steps, 1.0 * elapsed / (num_walks * num_steps),
+      (unsigned long long)memory.num_collections);
+  DestroyMemory();
+}
+
+void BenchmarkMemory() {
+  const u64 num_lists = 256;
+  const u64 list_length = 2048;
+  printf("Walking %llu interleaved lists of %llu pairs after a full collection:\n",
+      (unsigned long long)num_lists, (unsigned long long)list_length);
+  BenchmarkCopyOrder("breadth-first", COPY_BREADTH_FIRST, num_lists, list_length);
+  BenchmarkCopyOrder("cdr-first", COPY_CDR_FIRST, num_lists, list_length);
 }
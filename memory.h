@@ -2,19 +2,31 @@
 #define MEMORY_H
 
 #include "error.h"
+#include "root.h"
 #include "tag.h"
 
-// Memory is managed using a stop-and-copy garbage collection algorithm.
+// Memory is managed using a generational stop-and-copy garbage collection algorithm.
 //
-// The root references the live objects in the system. Anything not reachable from the root is considered garbage.
-// Memory consists of two regions:
-//   the_objects: a mixture the current (live) objects and discarded (garbage) objects in the system.
-//   new_objects: during GC, live/reachable objects are moved from the_objects into new_objects.
-//      when complete, the new_objects and the_objects are swapped
+// The registers (see root.h) reference the live objects in the system. Anything not reachable from them is considered garbage.
+// All objects live in a single array, the_objects, and references are indices into it.
+// the_objects consists of three regions:
+//   [ nursery | large object space | space 0 | space 1 ]
+//   nursery: the young generation. Small objects are allocated here.
+//   large object space: large vectors and blobs, which are marked instead of moved (see large_object_space.h).
+//   space 0/1: the old generation is kept in one of the two semispaces (the current space).
+//      Objects too large for the nursery are allocated directly into the current space.
+//      The other space is placed below the current space if it fits there, otherwise above it.
+//      With the mark-compact collector, there is only space 0.
+//
+// A Young Collection (minor) moves the live objects in the nursery to the end of the current space,
+// leaving the nursery empty. Only the nursery is scanned, so the cost is proportional to
+// the number of surviving young objects.
+// A Full Collection (major) moves the live objects from the nursery and the current space into the
+// other space. When complete, the other space becomes the current space.
 //
 // A Garbage Collection occurs when the system attempts to Allocate and there is not enough memory.
 // If there is still not enough memory after GC, the system fails.
-// A collection can be invoked early with CollectGarbage();
+// A collection can be invoked early with CollectGarbage() or CollectYoungGarbage();
 
 // Memory Layouts During GC:
 //
@@ -28,43 +40,276 @@
 // BLOB     | ceiling(nBytes, 8) + 1 |[ ..., nBytes, byte0, byte1, .., byteN, pad.., ... ]    |[ ..., <BH new>, byte0, ... ]  |
 
 // Blobs are padded to the nearest Object boundary.
-// <BH new>: A Broken Heart points to the newly moved structure in new_objects at index new.
+// <BH new>: A Broken Heart points to the newly moved structure in the to-space at index new.
+// The layout, move and print functions of each type are found by tag in a table (see type_descriptor.h).
+// Pairs don't have a header, so the to-space is scanned one Object at a time, skipping blobs and immediates.
+
+// Write Barrier:
+// A young collection does not scan the old generation, so every store of a young reference into
+// an old object must be recorded in the remembered set. The remembered set holds the indices
+// of those old slots, and is used as an additional root during a young collection.
+// Accessors which store into existing objects (SetCar, UnsafeVectorSet, ...) call WriteBarrier.
+// The registers and the saved registers are roots of every collection, so stores into them are not recorded.
+
+// Mark-Compact Collection:
+// With mark_compact set, a full collection slides the live objects of the current space down to its start,
+// followed by the live objects of the nursery, instead of copying them into the other space
+// (see mark_compact.h). Objects keep their allocation order, and the other space is never allocated,
+// so twice the live objects fit in the same memory. Full collections can't be performed incrementally.
+
+// Copy Order:
+// Cheney's scan copies objects in breadth-first order, which scatters the pairs of a list across the to-space.
+// With copy_order set to COPY_CDR_FIRST, moving a pair also moves the pairs of its cdr chain right after it,
+// so lists and environments are laid out in order, and walking them touches consecutive objects.
+// Run the test program with the "benchmark" argument to compare the orders.
+
+// Parallel Collection:
+// With more than one collector thread, the scan of a large collection is shared between the threads
+// (see parallel_collector.h). Collections which are small, or which might not fit in the to-space
+// with the parallel collector's chunk overhead, are performed by the collecting thread alone.
+
+// Incremental Collection:
+// With a non-zero incremental_scan_ratio, full collections are performed incrementally (Baker's algorithm).
+// The collection begins by moving the registers' objects into the to-space. After that, every allocation scans
+// incremental_scan_ratio objects per object allocated, so the pause is proportional to the allocation.
+// Objects allocated during the collection go into the to-space, and the nursery is unused until it finishes.
+// The mutator must never see a reference into the condemned regions, so accessors which load
+// from existing objects (Car, UnsafeVectorRef, ...) pass through the ReadBarrier, which moves the object.
+// If the to-space would fill up before the scan completes, the rest of the collection is performed at once.
+
+// Heap Sizing:
+// The spaces are resized after every full collection, between min_space_objects and max_space_objects.
+// A space grows when too many of the condemned objects survive, or when too much time is spent collecting,
+// by at most max_growth_objects at a time. It shrinks when both are well below their targets.
+// If there still isn't enough memory after a collection, the current space grows in place before
+// the allocation fails.
+// Address space for the largest spaces is reserved up front with mmap, so the_objects never moves.
+// Pages are only backed by memory once they are touched, and are zeroed by the operating system,
+// so initialization doesn't depend on the size of the heap. After a full collection, the condemned space
+// (or the freed end of the compacted space) is handed back with madvise, so the memory in use tracks the live objects.
+
+// Pinning:
+// Objects in the large object space are never moved. Pinning one of them also keeps it alive
+// until it is unpinned, so C code can hold its address across allocations (e.g. a buffer for I/O).
+// Pinned objects are marked at the start of every full collection, like roots.
+
+// Mostly-Copying Collection:
+// Every allocation may move any object, so C code normally keeps its objects in the root registers across allocations.
+// With mostly_copying set, each collection also scans the C stack and registers conservatively (see conservative_roots.h).
+// The objects they appear to reference are pinned where they are, and everything else is moved as usual,
+// so C code may keep Objects in local variables across allocations.
+// Young collections leave the pinned objects in the nursery. Full collections use the mark-compact collector,
+// which slides objects up to each pinned object instead of over it. Collections are serial, and never incremental.
+
+// Weak References:
+// A weak reference (see weak_reference.h) doesn't keep its target alive. Weak references are recorded in a table,
+// which is walked at the end of every collection to update or clear their targets.
+
+// Finalization:
+// Objects which hold resources outside of memory, like files (see file.h), register a finalizer (see finalization.h).
+// After each collection, the finalizers of the registered objects which died are queued, and the queue is run
+// once the collection is complete.
+
+// Statistics:
+// Each pause, and each collection, is recorded (see gc_statistics.h): the time spent collecting,
+// the objects in use before and after, the fraction of condemned objects which survived,
+// and the allocation rate since the previous collection.
+// Allocations can also be sampled, to find the sites, types and procedures which allocate the most (see allocation_profiler.h).
+// A full collection can take a census of what is live: the objects of each type, and the register which retains them (see census.h).
+
+enum CopyOrder {
+  // Objects are copied in the order they are scanned (Cheney's algorithm).
+  COPY_BREADTH_FIRST,
+  // Each moved pair is followed by the pairs of its cdr chain.
+  COPY_CDR_FIRST,
+};
 
-// TODO: Weak References
+struct MemoryOptions {
+  // The initial number of objects in each space.
+  u64 space_objects;
+  // Bounds on the number of objects in each space.
+  u64 min_space_objects;
+  u64 max_space_objects;
+  // The most objects a space can grow by after a single collection.
+  u64 max_growth_objects;
+  // The spaces grow when more than this percentage of condemned objects survive a full collection,
+  u64 target_survival_percent;
+  // or when more than this percentage of the time since the last full collection was spent collecting.
+  u64 target_gc_time_percent;
+  // The number of objects in the nursery. 0 disables the young generation.
+  u64 nursery_objects;
+  // The number of objects in the large object space. 0 disables the large object space.
+  u64 large_object_space_objects;
+  // Objects of at least this many objects are allocated in the large object space, if there is room.
+  u64 large_object_threshold;
+  // The number of threads which perform collections, including the allocating thread.
+  u64 num_gc_threads;
+  // The number of objects scanned per object allocated during an incremental collection.
+  // 0 disables incremental collection.
+  u64 incremental_scan_ratio;
+  // If true, full collections compact a single space in place, instead of copying between two spaces.
+  // Incremental collection is disabled.
+  b64 mark_compact;
+  // If true, ask for the_objects to be backed by transparent huge pages, where they are supported.
+  b64 huge_pages;
+  // The order objects are copied in by serial collections.
+  enum CopyOrder copy_order;
+  // If set, a JSON line describing each collection is appended to the file at this path (see gc_statistics.h).
+  const u8 *gc_log_path;
+  // If non-zero, an allocation is sampled every allocation_sample_interval objects (see allocation_profiler.h).
+  u64 allocation_sample_interval;
+  // If true, every full collection which isn't incremental takes a census of the live objects (see census.h).
+  b64 census;
+  // If true, objects referenced from the C stack are pinned during collections.
+  // Implies mark_compact, a single collector thread, and no incremental collection.
+  b64 mostly_copying;
+};
 
 struct Memory {
-  // The live objects
+  // The objects of every region.
   Object *the_objects;
-  // The swap buffer for use during collection.
-  Object *new_objects;
 
-  // Index to the first free Object in the_objects.
+  // The number of objects in the nursery, which begins at index 0.
+  u64 nursery_objects;
+  // Index to the first free Object in the nursery.
+  u64 nursery_free;
+
+  // The number of objects in the large object space, which follows the nursery.
+  u64 large_object_space_objects;
+  // Objects of at least this many objects are allocated in the large object space.
+  u64 large_object_threshold;
+
+  // Index to the start of the current space.
+  u64 space_start;
+  // Index to the first free Object in the current space.
   u64 free;
-  // The root object.
-  Object root;
-  // The maximum number of objects which can be allocated in memory.
-  u64 max_objects;
+  // The registers, which are the roots of every collection.
+  Object registers[NUM_REGISTERS];
+  // The control stack of saved registers, oldest first. Its objects are also roots.
+  Object *stack;
+  u64 stack_size;
+  u64 max_stack_size;
+  // The number of objects in each space.
+  u64 space_objects;
+  // The number of objects of the_objects in use by the nursery, the large object space and the spaces.
+  u64 num_arena_objects;
+
+  // See MemoryOptions.
+  u64 min_space_objects;
+  u64 max_space_objects;
+  u64 max_growth_objects;
+  u64 target_survival_percent;
+  u64 target_gc_time_percent;
+
+  // Indices of old slots which may hold young references.
+  u64 *remembered;
+  u64 num_remembered;
+  u64 max_remembered;
+  // Set if a slot could not be remembered. The next collection must be a full collection.
+  b64 remembered_set_overflowed;
+
+  // The number of threads which perform collections.
+  u64 num_gc_threads;
+
+  // The number of objects scanned per object allocated during an incremental collection.
+  u64 incremental_scan_ratio;
+  // True while an incremental collection is in progress.
+  b64 is_collecting_incrementally;
+
+  // True if full collections compact the current space in place.
+  b64 mark_compact;
+  // The order objects are copied in by serial collections.
+  enum CopyOrder copy_order;
+  // True if full collections take a census of the live objects.
+  b64 census;
+  // True if objects referenced from the C stack are pinned during collections.
+  b64 mostly_copying;
 
   // The number of times a Garbage collection has been performed.
   u64 num_collections;
+  // The number of those collections which were young collections.
+  u64 num_young_collections;
+  // The number of those collections which were performed in parallel.
+  u64 num_parallel_collections;
+  // The number of those collections which were performed incrementally.
+  u64 num_incremental_collections;
   // The total number of object allocations that have occurred
   u64 num_objects_allocated;
   // The total number of objects that have been copied due to GCs.
   u64 num_objects_moved;
+  // The total time spent collecting garbage.
+  u64 num_gc_nanoseconds;
 };
 extern struct Memory memory;
 
-// Allocate memory needed to store up to max_objects.
-void InitializeMemory(u64 max_objects, enum ErrorCode *error);
+// Returns the default options for spaces which start with space_objects objects.
+// The spaces may grow up to 64 times larger, but never shrink below space_objects.
+struct MemoryOptions DefaultMemoryOptions(u64 space_objects);
+
+// Allocate memory needed to store space_objects objects, using the default options.
+void InitializeMemory(u64 space_objects, enum ErrorCode *error);
+void InitializeMemoryWithOptions(struct MemoryOptions options, enum ErrorCode *error);
 void DestroyMemory();
 
-// Perform a compacting garbage collection on the objects in memory
+// Perform a full compacting garbage collection on the objects in memory.
+// Finishes the incremental collection in progress, if there is one.
 void CollectGarbage();
+// Move the live objects in the nursery into the old generation.
+// Performs a full collection instead if the remembered set is incomplete.
+void CollectYoungGarbage();
+// Perform a full collection which takes a census of the live objects, into heap_census.
+void TakeHeapCensus();
 
 // Performs a garbage collection if there isn't enough memory.
 // If there still isn't enough memory, returns an out of memory error.
 void EnsureEnoughMemory(u64 num_objects_required, enum ErrorCode *error);
 
+// Reserves num_objects contiguous objects, performing a garbage collection if necessary.
+// Returns the index of the first object. The contents of the objects are undefined.
+// If there isn't enough memory, returns 0 and sets the error code.
+u64 AllocateObjects(u64 num_objects, enum ErrorCode *error);
+
+// Ensures that the next num_objects objects can be allocated with AllocateReservedObjects,
+// collecting garbage here if necessary, and nowhere else.
+// Objects held in C variables stay valid until the reservation is used up, or until any other allocation.
+void ReserveObjects(u64 num_objects, enum ErrorCode *error);
+// Allocates num_objects objects out of the reservation, without checking for room or collecting garbage.
+u64 AllocateReservedObjects(u64 num_objects);
+
+// Reserves num_objects contiguous objects in the large object space, where they can be pinned.
+// Returns the index of the first object, or 0 and sets the error code if there isn't room.
+u64 AllocatePinnableObjects(u64 num_objects, enum ErrorCode *error);
+// Pin an object in the large object space. Fails for any other object, which may be moved.
+void PinObject(Object object, enum ErrorCode *error);
+// Fails if the object isn't pinned.
+void UnpinObject(Object object, enum ErrorCode *error);
+b64 IsPinned(Object object);
+
+// Returns the object stored in the_objects[index].
+// During an incremental collection, a condemned object is moved first, and the slot is updated.
+Object ReadBarrier(u64 index);
+// Record the store of value into the_objects[index], if it creates an old->young reference.
+void WriteBarrier(u64 index, Object value);
+
+// Collector internals, used by the Move functions of each type and by the parallel collector.
+// Move an object from the condemned regions to the to-space.
+Object MoveObject(Object object);
+// Move a pair. When copying cdr-first, the unmoved pairs of its cdr chain are moved right after it.
+Object MoveList(Object pair);
+// Move the objects referenced by the object at scan, and return the index of the next object.
+u64 ScanObject(u64 scan);
+// Load the first object of a condemned object, which is a broken heart if the object has been moved.
+Object LoadHeader(u64 reference);
+// Copy num_objects objects at reference to the to-space, and leave a broken heart in their place.
+// header is the first object, as returned by LoadHeader. Returns the new reference.
+u64 MoveObjects(u64 reference, Object header, u64 num_objects);
+// Returns the reference object will have once the collection is complete, or nil if it didn't survive.
+// Only valid once every reachable object has been moved or marked.
+Object SurvivingObject(Object object);
+// Update the tables which refer to objects without keeping them alive:
+// weak references, finalizers and the procedures of the allocation profile.
+void UpdateWeakTables();
+
 // Warning: Every time you Allocate, all references in C code may be invalid.
 
 // Print an object, following references.
@@ -73,5 +318,7 @@ void PrintObject(Object object);
 void PrintlnObject(Object object);
 
 void TestMemory();
+// Compare the layout of lists, and the time to walk them, after collections with each copy order.
+void BenchmarkMemory();
 
 #endif
@@ -3,36 +3,42 @@
 #include <assert.h>
 #include <stdio.h>
 
+#include "allocation_profiler.h"
 #include "log.h"
 #include "memory.h"
 #include "root.h"
 
 // TODO: Fixed-size Allocations (Pair, Procedure)
 Object AllocatePair(enum ErrorCode *error) {
-  EnsureEnoughMemory(2, error);
+  u64 new_reference = AllocateObjects(2, error);
   if (*error) {
     LOG_ERROR("Not enough memory to allocate pair");
     return nil;
   }
+  ProfileAllocation(TAG_PAIR, 2, __builtin_return_address(0));
 
   // [ ..., free.. ]
-  u64 new_reference = memory.free;
-  memory.the_objects[memory.free++] = nil;
-  memory.the_objects[memory.free++] = nil;
-  memory.num_objects_allocated += 2;
+  memory.the_objects[new_reference] = nil;
+  memory.the_objects[new_reference+1] = nil;
   // [ ..., car, cdr, free.. ]
   return BoxPair(new_reference);
 }
 
+Object AllocateReservedPair() {
+  u64 new_reference = AllocateReservedObjects(2);
+  ProfileAllocation(TAG_PAIR, 2, __builtin_return_address(0));
+  memory.the_objects[new_reference] = nil;
+  memory.the_objects[new_reference+1] = nil;
+  return BoxPair(new_reference);
+}
+
 Object MovePair(Object pair) {
   u64 ref = UnboxReference(pair);
   // New: [ ..., free... ]
   // Old: [ ..., car, cdr, ...] OR
   //      [ ..., <BH new>, ... ]
-  u64 new_reference = memory.free;
-
-  LOG(LOG_MEMORY, "moving from %llu in the_objects to %llu in new_objects\n", ref, new_reference);
-  Object old_car = memory.the_objects[ref];
+  LOG(LOG_MEMORY, "moving from %llu\n", ref);
+  Object old_car = LoadHeader(ref);
   if (IsBrokenHeart(old_car)) {
     // The pair has already been moved. Return the updated reference.
     // Old: [ ..., <BH new>, ... ]
@@ -40,32 +46,31 @@ Object MovePair(Object pair) {
     return BoxPair(UnboxReference(old_car));
   }
 
-  LOG(LOG_MEMORY, "Moving from the_objects to new_objects, leaving a broken heart at %llu pointing to %llu\n", ref, new_reference);
-  Object moved_pair = BoxPair(new_reference);
   // Old: [ ..., car, cdr, ... ]
-  memory.new_objects[memory.free++] = old_car;
-  memory.new_objects[memory.free++] = memory.the_objects[ref+1];
+  u64 new_reference = MoveObjects(ref, old_car, 2);
   // New: [ ..., car, cdr, free.. ]
-  memory.the_objects[ref] = BoxBrokenHeart(new_reference);
   // Old: [ ...,  <BH new>, ... ]
-  return moved_pair;
+  LOG(LOG_MEMORY, "Moved to the to-space, leaving a broken heart at %llu pointing to %llu\n", ref, new_reference);
+  return BoxPair(new_reference);
 }
 
 Object Car(Object pair) {
   assert(IsPair(pair));
-  return memory.the_objects[UnboxReference(pair)];
+  return ReadBarrier(UnboxReference(pair));
 }
 Object Cdr(Object pair) {
   assert(IsPair(pair));
-  return memory.the_objects[UnboxReference(pair) + 1];
+  return ReadBarrier(UnboxReference(pair) + 1);
 }
 
 void SetCar(Object pair, Object value) {
   assert(IsPair(pair));
+  WriteBarrier(UnboxReference(pair), value);
   memory.the_objects[UnboxReference(pair)] = value;
 }
 void SetCdr(Object pair, Object value) {
   assert(IsPair(pair));
+  WriteBarrier(UnboxReference(pair) + 1, value);
   memory.the_objects[UnboxReference(pair) + 1] = value;
 }
 
@@ -73,7 +78,6 @@ Object First(Object pair) { return Car(pair); }
 Object Rest(Object pair) { return Cdr(pair); }
 
 void PrintPair(Object pair) {
-  u64 reference = UnboxReference(pair);
   printf("(");
   PrintObject(First(pair));
 
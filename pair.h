@@ -11,10 +11,13 @@
 
 // Allocate a pair of 2 objects.
 Object AllocatePair(enum ErrorCode *error);
-// Move a pair from the_objects to new_objects
+// Allocate a pair out of the reservation made by ReserveObjects. Can't collect garbage.
+Object AllocateReservedPair();
+// Move a pair from the from-space to the to-space
 Object MovePair(Object pair);
 
 // Crash if !IsPair(pair)
+// SetCar and SetCdr pass through the write barrier.
 Object Car(Object pair);
 Object Cdr(Object pair);
 void SetCar(Object pair, Object value);
@@ -0,0 +1,338 @@
+#include "parallel_collector.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blob.h"
+#include "log.h"
+#include "memory.h"
+
+// The number of objects claimed from the to-space at a time.
+#define CHUNK_OBJECTS 1024
+// Objects larger than this are given their own region of the to-space, so that
+// retiring a chunk never wastes more than this many objects.
+#define DEDICATED_OBJECTS (CHUNK_OBJECTS / 8)
+// An unscanned region at least this large is shared when other workers are idle.
+#define SHARE_OBJECTS 64
+// Collections which condemn fewer objects than this aren't worth starting threads for.
+#define MINIMUM_PARALLEL_OBJECTS (4 * CHUNK_OBJECTS)
+
+// A range of the to-space which has been copied into, but not scanned.
+struct Region {
+  u64 start;
+  u64 end;
+};
+
+// A deque of regions. The owner pushes and pops at the bottom, and thieves steal from the top.
+struct Deque {
+  pthread_mutex_t mutex;
+  struct Region *regions;
+  u64 top;
+  u64 bottom;
+  u64 max_regions;
+};
+
+struct Worker {
+  pthread_t thread;
+  // The chunk being copied into: [ ..., scan.., free.., end ]
+  u64 scan;
+  u64 free;
+  u64 end;
+  struct Deque deque;
+  u64 num_objects_moved;
+};
+
+static struct Worker *workers;
+static u64 num_workers;
+// The worker state of the calling thread, or 0 if not collecting in parallel.
+static _Thread_local struct Worker *worker;
+
+// Stored in place of an object's first slot while it is being moved, to claim it: a broken heart to the largest
+// reference a payload can hold, far past the end of any heap. It can't equal a real first slot: until the object
+// has moved, that is an object or blob header, never a broken heart, and a moved object's broken heart points
+// into the to-space.
+static Object busy;
+
+// The next unclaimed object in the to-space, and its end.
+static u64 to_space_free;
+static u64 to_space_end;
+// The number of workers which are looking for work.
+static u64 num_active_workers;
+
+static void *RunWorker(void *argument);
+static void ScanRegions(struct Worker *worker);
+static void ScanOwnChunk(struct Worker *worker);
+static void ScanRegion(struct Region region);
+static b64 StealRegion(struct Worker *thief, struct Region *region);
+
+static u64 ClaimToSpace(u64 num_objects);
+static u64 AllocateFromChunk(struct Worker *worker, u64 num_objects);
+static void RetireChunk(struct Worker *worker);
+// Overwrite num_objects objects at reference with a blob, so scans skip over them.
+static void Fill(u64 reference, u64 num_objects);
+
+static void PushRegion(struct Worker *worker, u64 start, u64 end);
+static b64 PopRegion(struct Worker *worker, struct Region *region);
+
+void InitializeParallelCollector(u64 num_threads, enum ErrorCode *error) {
+  assert(num_threads > 0);
+  num_workers = num_threads;
+  // BoxBrokenHeart masks the reference to the payload, so this is the largest one.
+  busy = BoxBrokenHeart(~0ull);
+  assert(IsBrokenHeart(busy) && UnboxReference(busy) >= memory.max_space_objects);
+  workers = (struct Worker *)calloc(num_workers, sizeof(struct Worker));
+  if (!workers) {
+    *error = ERROR_COULD_NOT_ALLOCATE_HEAP_BUFFER;
+    return;
+  }
+  for (u64 i = 0; i < num_workers; ++i) {
+    struct Deque *deque = &workers[i].deque;
+    pthread_mutex_init(&deque->mutex, 0);
+    deque->max_regions = 64;
+    deque->regions = (struct Region *)malloc(sizeof(struct Region)*deque->max_regions);
+    if (!deque->regions) {
+      *error = ERROR_COULD_NOT_ALLOCATE_HEAP_BUFFER;
+      return;
+    }
+  }
+}
+
+void DestroyParallelCollector() {
+  if (!workers) return;
+  for (u64 i = 0; i < num_workers; ++i) {
+    pthread_mutex_destroy(&workers[i].deque.mutex);
+    free(workers[i].deque.regions);
+  }
+  free(workers);
+  workers = 0;
+  num_workers = 0;
+}
+
+b64 ShouldCollectInParallel(u64 num_objects_condemned, u64 to_space_room) {
+  if (num_workers < 2 || num_objects_condemned < MINIMUM_PARALLEL_OBJECTS) return 0;
+  // Retired chunks waste less than 1/8 of each chunk, and every worker leaves a partial chunk.
+  u64 worst_case = num_objects_condemned + num_objects_condemned / 8 + (num_workers + 1) * CHUNK_OBJECTS;
+  return worst_case <= to_space_room;
+}
+
+b64 IsCollectingInParallel() { return worker != 0; }
+
+void BeginParallelCollection(u64 end) {
+  LOG(LOG_MEMORY, "Beginning a parallel collection with %llu workers\n", num_workers);
+  to_space_free = memory.free;
+  to_space_end = end;
+
+  for (u64 i = 0; i < num_workers; ++i) {
+    struct Worker *w = &workers[i];
+    w->scan = w->free = w->end = 0;
+    w->deque.top = w->deque.bottom = 0;
+    w->num_objects_moved = 0;
+  }
+  num_active_workers = num_workers;
+  worker = &workers[0];
+}
+
+void FinishParallelCollection() {
+  for (u64 i = 1; i < num_workers; ++i) {
+    if (pthread_create(&workers[i].thread, 0, RunWorker, &workers[i])) {
+      // The collecting thread can do all of the work by itself.
+      LOG_ERROR("Could not start garbage collection worker %llu", i);
+      workers[i].thread = 0;
+      __atomic_fetch_sub(&num_active_workers, 1, __ATOMIC_SEQ_CST);
+    }
+  }
+  RunWorker(&workers[0]);
+  for (u64 i = 1; i < num_workers; ++i) {
+    if (workers[i].thread) pthread_join(workers[i].thread, 0);
+  }
+
+  // Every chunk has been scanned. Fill in the unused tails of the last chunks.
+  for (u64 i = 0; i < num_workers; ++i) {
+    struct Worker *w = &workers[i];
+    assert(w->scan == w->free);
+    Fill(w->free, w->end - w->free);
+  }
+  memory.free = to_space_free;
+  worker = 0;
+}
+
+u64 ParallelObjectsMoved() {
+  u64 num_objects_moved = 0;
+  for (u64 i = 0; i < num_workers; ++i) num_objects_moved += workers[i].num_objects_moved;
+  return num_objects_moved;
+}
+
+Object ParallelLoadHeader(u64 reference) {
+  Object header;
+  // Wait for the worker which claimed the object to finish moving it.
+  while ((header = __atomic_load_n(&memory.the_objects[reference], __ATOMIC_ACQUIRE)) == busy) sched_yield();
+  return header;
+}
+
+u64 ParallelMoveObjects(u64 reference, Object header, u64 num_objects) {
+  // Claim the object, so that it is only copied once.
+  Object expected = header;
+  if (!__atomic_compare_exchange_n(&memory.the_objects[reference], &expected, busy,
+        0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+    // Another worker claimed the object first. Use its copy.
+    LOG(LOG_MEMORY, "Lost the race to move %llu\n", reference);
+    Object broken_heart = ParallelLoadHeader(reference);
+    assert(IsBrokenHeart(broken_heart));
+    return UnboxReference(broken_heart);
+  }
+
+  b64 is_dedicated = num_objects > DEDICATED_OBJECTS;
+  u64 new_reference = is_dedicated
+    ? ClaimToSpace(num_objects)
+    : AllocateFromChunk(worker, num_objects);
+  memory.the_objects[new_reference] = header;
+  memcpy(&memory.the_objects[new_reference + 1], &memory.the_objects[reference + 1], (num_objects - 1)*sizeof(Object));
+  __atomic_store_n(&memory.the_objects[reference], BoxBrokenHeart(new_reference), __ATOMIC_RELEASE);
+
+  worker->num_objects_moved += num_objects;
+  // A dedicated region isn't part of a chunk, so it needs to be scanned separately.
+  if (is_dedicated) PushRegion(worker, new_reference, new_reference + num_objects);
+  return new_reference;
+}
+
+static void *RunWorker(void *argument) {
+  worker = (struct Worker *)argument;
+  ScanRegions(worker);
+  return 0;
+}
+
+static void ScanRegions(struct Worker *worker) {
+  struct Region region;
+  for (;;) {
+    ScanOwnChunk(worker);
+    if (PopRegion(worker, &region)) {
+      ScanRegion(region);
+      continue;
+    }
+
+    // Out of work. Steal until every worker is out of work.
+    __atomic_fetch_sub(&num_active_workers, 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+      __atomic_fetch_add(&num_active_workers, 1, __ATOMIC_SEQ_CST);
+      if (StealRegion(worker, &region)) break;
+      if (__atomic_sub_fetch(&num_active_workers, 1, __ATOMIC_SEQ_CST) == 0) return;
+      sched_yield();
+    }
+    ScanRegion(region);
+  }
+}
+
+static void ScanOwnChunk(struct Worker *worker) {
+  while (worker->scan < worker->free) {
+    u64 scan = worker->scan;
+    Object object = memory.the_objects[scan];
+    // Claim the object before scanning it, in case moving its references retires the chunk.
+    worker->scan = IsBlobHeader(object)
+      ? scan + NumObjectsPerBlob(UnboxBlobHeader(object))
+      : scan + 1;
+    ScanObject(scan);
+
+    u64 num_idle = num_workers - __atomic_load_n(&num_active_workers, __ATOMIC_RELAXED);
+    if (num_idle > 0 && worker->free - worker->scan >= SHARE_OBJECTS) {
+      PushRegion(worker, worker->scan, worker->free);
+      worker->scan = worker->free;
+    }
+  }
+}
+
+static void ScanRegion(struct Region region) {
+  for (u64 scan = region.start; scan < region.end;) scan = ScanObject(scan);
+}
+
+static u64 ClaimToSpace(u64 num_objects) {
+  u64 reference = __atomic_fetch_add(&to_space_free, num_objects, __ATOMIC_RELAXED);
+  assert(reference + num_objects <= to_space_end);
+  return reference;
+}
+
+static u64 AllocateFromChunk(struct Worker *worker, u64 num_objects) {
+  if (worker->free + num_objects > worker->end) RetireChunk(worker);
+  u64 reference = worker->free;
+  worker->free += num_objects;
+  return reference;
+}
+
+static void RetireChunk(struct Worker *worker) {
+  // [ ..., scan.., free.., end ]
+  if (worker->scan < worker->free) PushRegion(worker, worker->scan, worker->free);
+  Fill(worker->free, worker->end - worker->free);
+
+  u64 chunk = ClaimToSpace(CHUNK_OBJECTS);
+  worker->scan = worker->free = chunk;
+  worker->end = chunk + CHUNK_OBJECTS;
+}
+
+static void Fill(u64 reference, u64 num_objects) {
+  if (num_objects == 0) return;
+  // [ ..., nBytes, pad.., ... ]
+  memory.the_objects[reference] = BoxBlobHeader((num_objects - 1)*sizeof(Object));
+}
+
+static void PushRegion(struct Worker *worker, u64 start, u64 end) {
+  struct Deque *deque = &worker->deque;
+  pthread_mutex_lock(&deque->mutex);
+  if (deque->bottom == deque->max_regions) {
+    if (deque->top > 0) {
+      // Reclaim the space left by stolen regions.
+      memmove(deque->regions, &deque->regions[deque->top], (deque->bottom - deque->top)*sizeof(struct Region));
+      __atomic_store_n(&deque->bottom, deque->bottom - deque->top, __ATOMIC_RELAXED);
+      __atomic_store_n(&deque->top, 0, __ATOMIC_RELAXED);
+    }
+    if (deque->bottom == deque->max_regions) {
+      u64 max_regions = 2*deque->max_regions;
+      struct Region *regions = (struct Region *)realloc(deque->regions, sizeof(struct Region)*max_regions);
+      if (!regions) {
+        // Scan the region now instead of sharing it.
+        pthread_mutex_unlock(&deque->mutex);
+        ScanRegion((struct Region){start, end});
+        return;
+      }
+      deque->regions = regions;
+      deque->max_regions = max_regions;
+    }
+  }
+  deque->regions[deque->bottom].start = start;
+  deque->regions[deque->bottom].end = end;
+  __atomic_store_n(&deque->bottom, deque->bottom + 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&deque->mutex);
+}
+
+static b64 PopRegion(struct Worker *worker, struct Region *region) {
+  struct Deque *deque = &worker->deque;
+  b64 found = 0;
+  pthread_mutex_lock(&deque->mutex);
+  if (deque->top < deque->bottom) {
+    *region = deque->regions[deque->bottom - 1];
+    __atomic_store_n(&deque->bottom, deque->bottom - 1, __ATOMIC_RELAXED);
+    found = 1;
+  }
+  pthread_mutex_unlock(&deque->mutex);
+  return found;
+}
+
+static b64 StealRegion(struct Worker *thief, struct Region *region) {
+  u64 first = thief - workers;
+  for (u64 i = 1; i <= num_workers; ++i) {
+    struct Deque *deque = &workers[(first + i) % num_workers].deque;
+    if (__atomic_load_n(&deque->top, __ATOMIC_RELAXED) == __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED))
+      continue;
+    b64 found = 0;
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->top < deque->bottom) {
+      *region = deque->regions[deque->top];
+      __atomic_store_n(&deque->top, deque->top + 1, __ATOMIC_RELAXED);
+      found = 1;
+    }
+    pthread_mutex_unlock(&deque->mutex);
+    if (found) return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef PARALLEL_COLLECTOR_H
+#define PARALLEL_COLLECTOR_H
+
+#include "error.h"
+#include "tag.h"
+
+// The parallel collector performs the scan of a collection with several threads.
+//
+// Each thread copies objects into its own chunk of the to-space, and scans its chunk
+// Cheney-style. Unscanned regions of the to-space that a thread can't get to right away
+// (a retired chunk, a large object, or work for idle threads) are pushed onto the thread's deque.
+// Idle threads steal regions from the other threads' deques.
+//
+// An object is claimed by replacing its first slot with a busy marker using an atomic compare-and-swap,
+// before it is copied. A thread which loses the race waits for the winner's broken heart.
+//
+// The unused tails of chunks are left in the to-space as filler blobs, so that
+// the to-space can still be scanned linearly.
+
+// Create the worker state for num_threads threads (including the collecting thread).
+void InitializeParallelCollector(u64 num_threads, enum ErrorCode *error);
+void DestroyParallelCollector();
+
+// Returns true if a collection which condemns num_objects_condemned objects
+// should be performed in parallel, given to_space_room free objects in the to-space.
+b64 ShouldCollectInParallel(u64 num_objects_condemned, u64 to_space_room);
+
+// Begin copying into the to-space from memory.free up to end, using the collecting thread as the first worker.
+// Roots may be moved between BeginParallelCollection and FinishParallelCollection.
+void BeginParallelCollection(u64 end);
+// Scan every moved object with all of the workers. Leaves memory.free at the end of the to-space.
+void FinishParallelCollection();
+
+// True while between BeginParallelCollection and FinishParallelCollection.
+b64 IsCollectingInParallel();
+
+// Load the first slot of a condemned object, waiting if another worker is moving it.
+Object ParallelLoadHeader(u64 reference);
+// Atomically move num_objects objects at reference to the calling worker's to-space.
+// header is the first object, as returned by ParallelLoadHeader.
+// Returns the new reference (the other worker's reference if it moved the object first).
+u64 ParallelMoveObjects(u64 reference, Object header, u64 num_objects);
+
+// The number of objects moved by the workers during the last parallel collection.
+u64 ParallelObjectsMoved();
+
+#endif
@@ -1,16 +1,23 @@
 #include "primitives.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "evaluate.h"
+#include "file.h"
+#include "gc_statistics.h"
 #include "log.h"
+#include "memory.h"
 #include "pair.h"
 #include "read.h"
+#include "record.h"
 #include "root.h"
 #include "byte_vector.h"
 #include "string.h"
 #include "symbol_table.h"
 #include "vector.h"
+#include "weak_reference.h"
 
 // TODO: Change primitives to continuation passing style?
 
@@ -243,6 +250,84 @@ DECLARE_PRIMITIVE(PrimitiveSetPairRight, arguments, error) {
 }
 DECLARE_PRIMITIVE(PrimitiveList, arguments, error) { return arguments; }
 
+DECLARE_PRIMITIVE(PrimitiveMakeRecordType, arguments, error) {
+  Object name, field_names;
+  Extract2Arguments(&arguments, &name, &field_names, error);
+  CHECK(error);
+  if (!IsSymbol(name)) return InvalidArgumentError(error);
+  Object fields = field_names;
+  for (; IsPair(fields); fields = Cdr(fields)) {
+    if (!IsSymbol(Car(fields))) return InvalidArgumentError(error);
+  }
+  if (!IsNil(fields)) return InvalidArgumentError(error);
+  return MakeRecordType(name, field_names, error);
+}
+DECLARE_PRIMITIVE(PrimitiveRecordConstructor, arguments, error) {
+  Object type;
+  Extract1Argument(&arguments, &type, error);
+  CHECK(error);
+  if (!IsRecordType(type)) return InvalidArgumentError(error);
+  return MakeRecordProcedure(RECORD_KIND_CONSTRUCTOR, type, RecordTypeNumFields(type), error);
+}
+DECLARE_PRIMITIVE(PrimitiveRecordPredicate, arguments, error) {
+  Object type;
+  Extract1Argument(&arguments, &type, error);
+  CHECK(error);
+  if (!IsRecordType(type)) return InvalidArgumentError(error);
+  return MakeRecordProcedure(RECORD_KIND_PREDICATE, type, 0, error);
+}
+DECLARE_PRIMITIVE(PrimitiveRecordAccessor, arguments, error) {
+  Object type, field_name;
+  Extract2Arguments(&arguments, &type, &field_name, error);
+  CHECK(error);
+  u64 field;
+  if (!IsRecordType(type) || !FindRecordField(type, field_name, &field)) return InvalidArgumentError(error);
+  return MakeRecordProcedure(RECORD_KIND_ACCESSOR, type, field, error);
+}
+DECLARE_PRIMITIVE(PrimitiveRecordModifier, arguments, error) {
+  Object type, field_name;
+  Extract2Arguments(&arguments, &type, &field_name, error);
+  CHECK(error);
+  u64 field;
+  if (!IsRecordType(type) || !FindRecordField(type, field_name, &field)) return InvalidArgumentError(error);
+  return MakeRecordProcedure(RECORD_KIND_MODIFIER, type, field, error);
+}
+DECLARE_PRIMITIVE(PrimitiveIsRecord, arguments, error) {
+  Object object;
+  Extract1Argument(&arguments, &object, error);
+  CHECK(error);
+  // Record types and record procedures are records internally, but not instances of a record type.
+  return BoxBoolean(IsRecord(object) && IsRecordType(RecordType(object)));
+}
+
+DECLARE_PRIMITIVE(PrimitiveAllocateWeakReference, arguments, error) {
+  CheckEmptyArguments(arguments, error);
+  CHECK(error);
+
+  return AllocateWeakReference(error);
+}
+DECLARE_PRIMITIVE(PrimitiveIsWeakReference, arguments, error) {
+  Object object;
+  Extract1Argument(&arguments, &object, error);
+  CHECK(error);
+  return BoxBoolean(IsWeakReference(object));
+}
+DECLARE_PRIMITIVE(PrimitiveWeakReferenceTarget, arguments, error) {
+  Object weak_reference;
+  Extract1Argument(&arguments, &weak_reference, error);
+  CHECK(error);
+  if (!IsWeakReference(weak_reference)) return InvalidArgumentError(error);
+  return WeakReferenceTarget(weak_reference);
+}
+DECLARE_PRIMITIVE(PrimitiveSetWeakReferenceTarget, arguments, error) {
+  Object weak_reference, target;
+  Extract2Arguments(&arguments, &weak_reference, &target, error);
+  CHECK(error);
+  if (!IsWeakReference(weak_reference)) return InvalidArgumentError(error);
+  SetWeakReferenceTarget(weak_reference, target);
+  return FindSymbol("ok");
+}
+
 DECLARE_PRIMITIVE(PrimitiveEq, arguments, error) {
   Object a, b;
   Extract2Arguments(&arguments, &a, &b, error);
@@ -257,6 +342,12 @@ DECLARE_PRIMITIVE(PrimitiveEvaluate, arguments, error) {
   return Evaluate(expression);
 }
 
+DECLARE_PRIMITIVE(PrimitiveGCStatistics, arguments, error) {
+  CheckEmptyArguments(arguments, error);
+  CHECK(error);
+  return GCStatisticsVector(error);
+}
+
 DECLARE_PRIMITIVE(PrimitiveStringToByteVector, arguments, error) {
   Object string;
   Extract1Argument(&arguments, &string, error);
@@ -283,16 +374,23 @@ DECLARE_PRIMITIVE(PrimitiveOpenBinaryFileForReading, arguments, error) {
     // TODO: read errno?
     return nil;
   }
-  return BoxFilePointer(file);
+  // REFERENCES INVALIDATED
+  Object result = AllocateFile(file, error);
+  if (*error) fclose(file);
+  return result;
 }
 
 DECLARE_PRIMITIVE(PrimitiveFileLength, arguments, error) {
   Object file;
   Extract1Argument(&arguments, &file, error);
   CHECK(error);
-  if (!IsFilePointer(file)) return InvalidArgumentError(error);
+  if (!IsFile(file)) return InvalidArgumentError(error);
 
-  FILE *f = UnboxFilePointer(file);
+  FILE *f = FileStream(file);
+  if (!f) {
+    *error = ERROR_FILE_IS_CLOSED;
+    return nil;
+  }
   if (fseek(f, 0, SEEK_END)) {
     *error = ERROR_COULD_NOT_SEEK_TO_END_OF_FILE;
     return nil;
@@ -309,17 +407,20 @@ DECLARE_PRIMITIVE(PrimitiveCopyFileContents, arguments, error) {
   Object file, byte_vector;
   Extract2Arguments(&arguments, &file, &byte_vector, error);
   CHECK(error);
-  if (!IsFilePointer(file)) return InvalidArgumentError(error);
+  if (!IsFile(file)) return InvalidArgumentError(error);
   if (!IsByteVector(byte_vector)) return InvalidArgumentError(error);
 
-  FILE *f = UnboxFilePointer(file);
+  FILE *f = FileStream(file);
+  if (!f) {
+    *error = ERROR_FILE_IS_CLOSED;
+    return nil;
+  }
   if (fseek(f, 0, SEEK_SET)) {
     *error = ERROR_COULD_NOT_SEEK_TO_START_OF_FILE;
     return nil;
   }
   s64 length = UnsafeByteVectorLength(byte_vector) - 1;
-  // TODO: ByteVectorBuffer
-  s64 num_bytes_read = fread(StringCharacterBuffer(byte_vector), 1, length, f);
+  s64 num_bytes_read = fread(ByteVectorBuffer(byte_vector), 1, length, f);
   if (ferror(f)) {
     *error = ERROR_COULD_NOT_READ_FILE;
   }
@@ -333,13 +434,10 @@ DECLARE_PRIMITIVE(PrimitiveCloseFile, arguments, error) {
   Object file;
   Extract1Argument(&arguments, &file, error);
   CHECK(error);
-  if (!IsFilePointer(file)) return InvalidArgumentError(error);
+  if (!IsFile(file)) return InvalidArgumentError(error);
 
-  FILE *f = UnboxFilePointer(file);
-  if (fclose(f)) {
-    *error = ERROR_COULD_NOT_CLOSE_FILE;
-    return nil;
-  }
+  CloseFile(file, error);
+  CHECK(error);
   return FindSymbol("ok");
 }
 
@@ -352,6 +450,43 @@ DECLARE_PRIMITIVE(PrimitiveAllocateByteVector, arguments, error) {
   return AllocateByteVector(UnboxFixnum(num_bytes), error);
 }
 
+DECLARE_PRIMITIVE(PrimitiveAllocatePinnedByteVector, arguments, error) {
+  Object num_bytes;
+  Extract1Argument(&arguments, &num_bytes, error);
+  CHECK(error);
+  if (!IsFixnum(num_bytes)) return InvalidArgumentError(error);
+
+  return AllocatePinnedByteVector(UnboxFixnum(num_bytes), error);
+}
+
+DECLARE_PRIMITIVE(PrimitivePinByteVector, arguments, error) {
+  Object byte_vector;
+  Extract1Argument(&arguments, &byte_vector, error);
+  CHECK(error);
+  if (!IsByteVector(byte_vector)) return InvalidArgumentError(error);
+  PinObject(byte_vector, error);
+  CHECK(error);
+  return FindSymbol("ok");
+}
+
+DECLARE_PRIMITIVE(PrimitiveUnpinByteVector, arguments, error) {
+  Object byte_vector;
+  Extract1Argument(&arguments, &byte_vector, error);
+  CHECK(error);
+  if (!IsByteVector(byte_vector)) return InvalidArgumentError(error);
+  UnpinObject(byte_vector, error);
+  CHECK(error);
+  return FindSymbol("ok");
+}
+
+DECLARE_PRIMITIVE(PrimitiveIsByteVectorPinned, arguments, error) {
+  Object byte_vector;
+  Extract1Argument(&arguments, &byte_vector, error);
+  CHECK(error);
+  if (!IsByteVector(byte_vector)) return InvalidArgumentError(error);
+  return BoxBoolean(IsPinned(byte_vector));
+}
+
 DECLARE_PRIMITIVE(PrimitiveIsByteVector, arguments, error) {
   Object byte_vector;
   Extract1Argument(&arguments, &byte_vector, error);
@@ -415,7 +550,15 @@ DECLARE_PRIMITIVE(PrimitiveIntern, arguments, error) {
   Extract1Argument(&arguments, &string, error);
   CHECK(error);
   if (!IsString(string)) return InvalidArgumentError(error);
-  return InternSymbol(StringCharacterBuffer(string), error);
+  // Interning allocates, so the name can't be read out of the string while it's being interned.
+  u8 *name = strdup(StringCharacterBuffer(string));
+  if (!name) {
+    *error = ERROR_OUT_OF_MEMORY;
+    return nil;
+  }
+  Object symbol = InternSymbol(name, error);
+  free(name);
+  return symbol;
 }
 
 DECLARE_PRIMITIVE(PrimitiveUnintern, arguments, error) {
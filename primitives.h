@@ -19,6 +19,10 @@
   X("byte-vector-ref", PrimitiveByteVectorRef) \
   X("string->byte-vector", PrimitiveStringToByteVector) \
   X("byte-vector->string", PrimitiveByteVectorToString) \
+  X("allocate-pinned-byte-vector", PrimitiveAllocatePinnedByteVector) \
+  X("pin-byte-vector!", PrimitivePinByteVector) \
+  X("unpin-byte-vector!", PrimitiveUnpinByteVector) \
+  X("byte-vector-pinned?", PrimitiveIsByteVectorPinned) \
 \
   X("symbol->string", PrimitiveSymbolToString) \
   X("intern", PrimitiveIntern) \
@@ -38,9 +42,22 @@
   X("pair-right", PrimitivePairRight) \
   X("set-pair-left!", PrimitiveSetPairLeft) \
   X("set-pair-right!", PrimitiveSetPairRight) \
+\
+  X("make-record-type", PrimitiveMakeRecordType) \
+  X("record-constructor", PrimitiveRecordConstructor) \
+  X("record-predicate", PrimitiveRecordPredicate) \
+  X("record-accessor", PrimitiveRecordAccessor) \
+  X("record-modifier", PrimitiveRecordModifier) \
+  X("record?", PrimitiveIsRecord) \
+\
+  X("allocate-weak-reference", PrimitiveAllocateWeakReference) \
+  X("weak-reference?", PrimitiveIsWeakReference) \
+  X("weak-reference-target", PrimitiveWeakReferenceTarget) \
+  X("set-weak-reference-target!", PrimitiveSetWeakReferenceTarget) \
 \
   X("eq?", PrimitiveEq) \
   X("evaluate", PrimitiveEvaluate) \
+  X("gc-statistics", PrimitiveGCStatistics) \
 \
   X("open-binary-file-for-reading!", PrimitiveOpenBinaryFileForReading) \
   X("file-length", PrimitiveFileLength) \
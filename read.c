@@ -399,19 +399,17 @@ void ReadQuotedObject() {
 }
 
 void ReadQuotedObjectFinished() {
-  Object pair;
+  CHECK(ReserveObjects(4, &error));
 
   // (quoted-object)
-  CHECK(pair = AllocatePair(&error));
-  SetCar(pair, GetReadResult());
-  SetCdr(pair, nil);
-  SetReadResult(pair);
+  Object quoted = AllocateReservedPair();
+  SetCar(quoted, GetReadResult());
 
   // (quote quoted-object)
-  CHECK(pair = AllocatePair(&error));
-  SetCar(pair, FindSymbol("quote"));
-  SetCdr(pair, GetReadResult());
-  SetReadResult(pair);
+  Object quote = AllocateReservedPair();
+  SetCar(quote, FindSymbol("quote"));
+  SetCdr(quote, quoted);
+  SetReadResult(quote);
 
   Restore(REGISTER_CONTINUE);
   CONTINUE;
@@ -570,7 +568,7 @@ void TestRead() {
   enum ErrorCode error = NO_ERROR;
   InitializeMemory(512, &error);
   InitializeSymbolTable(1, &error);
-  InternSymbol("quote", &error);
+  InternPermanentSymbol("quote", &error);
 
   // Read string
   {
@@ -0,0 +1,197 @@
+#include "record.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "allocation_profiler.h"
+#include "log.h"
+#include "memory.h"
+#include "pair.h"
+#include "root.h"
+
+// Prints <record-kind name> or, for procedures of a field, <record-kind name field>.
+static void PrintRecordProcedure(const char *kind, Object procedure, b64 has_field);
+
+Object AllocateRecord(u64 num_slots, enum ErrorCode *error) {
+  u64 new_reference = AllocateObjects(num_slots + 2, error);
+  if (*error) {
+    LOG_ERROR("Not enough memory to allocate record of %llu slots", num_slots);
+    return nil;
+  }
+  ProfileAllocation(TAG_RECORD, num_slots + 2, __builtin_return_address(0));
+  // [ ..., free.. ]
+
+  memory.the_objects[new_reference] = BoxFixnum(num_slots + 1);
+  for (u64 i = 0; i <= num_slots; ++i) memory.the_objects[new_reference+1 + i] = nil;
+  // [ ..., N+1, type, slot0, ..., slotN-1, free.. ]
+
+  return BoxRecord(new_reference);
+}
+
+Object MoveRecord(Object record) {
+  u64 ref = UnboxReference(record);
+  // New: [ ..., free... ]
+  // Old: [ ..., N+1, type, slot0, ... slotN-1, ... ] OR
+  //      [ ..., <BH new>, ... ]
+  Object old_header = LoadHeader(ref);
+  if (IsBrokenHeart(old_header)) return BoxRecord(UnboxReference(old_header));
+
+  assert(IsFixnum(old_header));
+  u64 new_reference = MoveObjects(ref, old_header, 1 + UnboxFixnum(old_header));
+  // New: [ ..., N+1, type, slot0, ... slotN-1, free.. ]
+  // Old: [ ..., <BH new>, ... ]
+  LOG(LOG_MEMORY, "Moved record from %llu to %llu\n", ref, new_reference);
+  return BoxRecord(new_reference);
+}
+
+Object RecordType(Object record) {
+  assert(IsRecord(record));
+  return ReadBarrier(UnboxReference(record) + 1);
+}
+void SetRecordType(Object record, Object type) {
+  assert(IsRecord(record));
+  WriteBarrier(UnboxReference(record) + 1, type);
+  memory.the_objects[UnboxReference(record) + 1] = type;
+}
+u64 RecordNumSlots(Object record) {
+  assert(IsRecord(record));
+  return UnboxFixnum(memory.the_objects[UnboxReference(record)]) - 1;
+}
+Object RecordSlot(Object record, u64 index) {
+  assert(index < RecordNumSlots(record));
+  return ReadBarrier(UnboxReference(record) + 2 + index);
+}
+void SetRecordSlot(Object record, u64 index, Object value) {
+  assert(index < RecordNumSlots(record));
+  WriteBarrier(UnboxReference(record) + 2 + index, value);
+  memory.the_objects[UnboxReference(record) + 2 + index] = value;
+}
+
+Object MakeRecordType(Object name, Object field_names, enum ErrorCode *error) {
+  SetRegister(REGISTER_PRIMITIVE_A, name);
+  SetRegister(REGISTER_PRIMITIVE_B, field_names);
+  // REFERENCES INVALIDATED
+  Object type = AllocateRecord(2, error);
+  if (!*error) {
+    SetRecordType(type, BoxFixnum(RECORD_KIND_TYPE));
+    SetRecordSlot(type, 0, GetRegister(REGISTER_PRIMITIVE_A));
+    SetRecordSlot(type, 1, GetRegister(REGISTER_PRIMITIVE_B));
+  }
+  SetRegister(REGISTER_PRIMITIVE_A, nil);
+  SetRegister(REGISTER_PRIMITIVE_B, nil);
+  return *error ? nil : type;
+}
+
+b64 IsRecordType(Object object) {
+  return IsRecord(object) && RecordType(object) == BoxFixnum(RECORD_KIND_TYPE);
+}
+Object RecordTypeName(Object type) {
+  assert(IsRecordType(type));
+  return RecordSlot(type, 0);
+}
+Object RecordTypeFieldNames(Object type) {
+  assert(IsRecordType(type));
+  return RecordSlot(type, 1);
+}
+u64 RecordTypeNumFields(Object type) {
+  u64 num_fields = 0;
+  for (Object fields = RecordTypeFieldNames(type); IsPair(fields); fields = Cdr(fields)) ++num_fields;
+  return num_fields;
+}
+b64 FindRecordField(Object type, Object field_name, u64 *index) {
+  *index = 0;
+  for (Object fields = RecordTypeFieldNames(type); IsPair(fields); fields = Cdr(fields), ++*index) {
+    if (Car(fields) == field_name) return 1;
+  }
+  return 0;
+}
+b64 IsRecordOfType(Object object, Object type) {
+  return IsRecord(object) && RecordType(object) == type;
+}
+
+Object MakeRecordProcedure(enum RecordKind kind, Object type, u64 field, enum ErrorCode *error) {
+  assert(kind != RECORD_KIND_TYPE);
+  SetRegister(REGISTER_PRIMITIVE_A, type);
+  // REFERENCES INVALIDATED
+  Object procedure = AllocateRecord(2, error);
+  if (!*error) {
+    SetRecordType(procedure, BoxFixnum(kind));
+    SetRecordSlot(procedure, 0, GetRegister(REGISTER_PRIMITIVE_A));
+    SetRecordSlot(procedure, 1, BoxFixnum(field));
+  }
+  SetRegister(REGISTER_PRIMITIVE_A, nil);
+  return *error ? nil : procedure;
+}
+
+b64 IsRecordProcedure(Object object) {
+  if (!IsRecord(object)) return 0;
+  Object kind = RecordType(object);
+  return IsFixnum(kind) && UnboxFixnum(kind) != RECORD_KIND_TYPE;
+}
+enum RecordKind RecordProcedureKind(Object procedure) {
+  assert(IsRecordProcedure(procedure));
+  return UnboxFixnum(RecordType(procedure));
+}
+Object RecordProcedureType(Object procedure) {
+  assert(IsRecordProcedure(procedure));
+  return RecordSlot(procedure, 0);
+}
+u64 RecordProcedureField(Object procedure) {
+  assert(IsRecordProcedure(procedure));
+  return UnboxFixnum(RecordSlot(procedure, 1));
+}
+u64 RecordProcedureArity(Object procedure) {
+  switch (RecordProcedureKind(procedure)) {
+    case RECORD_KIND_CONSTRUCTOR: return RecordProcedureField(procedure);
+    case RECORD_KIND_PREDICATE:
+    case RECORD_KIND_ACCESSOR:    return 1;
+    case RECORD_KIND_MODIFIER:    return 2;
+    case RECORD_KIND_TYPE:        break;
+  }
+  assert(!"Error: not a record procedure");
+  return 0;
+}
+
+void PrintRecord(Object record) {
+  Object type = RecordType(record);
+  if (IsFixnum(type)) {
+    switch (UnboxFixnum(type)) {
+      case RECORD_KIND_TYPE:
+        printf("(record-type ");
+        PrintObject(RecordTypeName(record));
+        printf(" ");
+        PrintObject(RecordTypeFieldNames(record));
+        printf(")");
+        return;
+      case RECORD_KIND_CONSTRUCTOR: PrintRecordProcedure("constructor", record, 0); return;
+      case RECORD_KIND_PREDICATE:   PrintRecordProcedure("predicate", record, 0);   return;
+      case RECORD_KIND_ACCESSOR:    PrintRecordProcedure("accessor", record, 1);    return;
+      case RECORD_KIND_MODIFIER:    PrintRecordProcedure("modifier", record, 1);    return;
+    }
+  }
+  // The evaluator's analyzed expressions print as the expressions they were analyzed from.
+  if (IsEvaluateFunction(type)) {
+    PrintObject(RecordSlot(record, 0));
+    return;
+  }
+  printf("(record ");
+  PrintObject(IsRecordType(type) ? RecordTypeName(type) : type);
+  for (u64 i = 0; i < RecordNumSlots(record); ++i) {
+    printf(" ");
+    PrintObject(RecordSlot(record, i));
+  }
+  printf(")");
+}
+
+static void PrintRecordProcedure(const char *kind, Object procedure, b64 has_field) {
+  Object type = RecordProcedureType(procedure);
+  printf("<record-%s ", kind);
+  PrintObject(RecordTypeName(type));
+  if (has_field) {
+    Object fields = RecordTypeFieldNames(type);
+    for (u64 i = 0; i < RecordProcedureField(procedure); ++i) fields = Cdr(fields);
+    printf(" ");
+    PrintObject(Car(fields));
+  }
+  printf(">");
+}
@@ -0,0 +1,65 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include "error.h"
+#include "tag.h"
+
+// A record is an instance of a record type, with a fixed number of slots.
+// Memory Layout: [ ..., N+1, type, slot0, .., slotN-1, ... ]
+// Records are laid out like vectors, so the collectors treat the type like any other slot.
+//
+// The type of a record made by a record constructor is a record type.
+// The records built into the evaluator have a fixnum RecordKind as their type instead:
+//   record type:      [ ..., 3, RECORD_KIND_TYPE, name, field-names, ... ]
+//   record procedure: [ ..., 3, RECORD_KIND_<kind>, record-type, field, ... ]
+//     field is the index of the field of an accessor or modifier, and the number of fields of a constructor.
+// The evaluator's analyzed expressions have the EvaluateFunction which evaluates them as their type (see evaluate.c).
+// Record procedures are applied by the evaluator directly: the arguments of a constructor are stored into the
+// new record as they are evaluated, and the other procedures take their one or two arguments from the stack,
+// so no argument list is allocated.
+
+enum RecordKind {
+  RECORD_KIND_TYPE,
+  RECORD_KIND_CONSTRUCTOR,
+  RECORD_KIND_PREDICATE,
+  RECORD_KIND_ACCESSOR,
+  RECORD_KIND_MODIFIER,
+};
+
+// Allocate a record with num_slots slots. The type and the slots are nil.
+Object AllocateRecord(u64 num_slots, enum ErrorCode *error);
+Object MoveRecord(Object record);
+
+// Crash if !IsRecord(record)
+// Setters pass through the write barrier.
+Object RecordType(Object record);
+void SetRecordType(Object record, Object type);
+u64 RecordNumSlots(Object record);
+Object RecordSlot(Object record, u64 index);
+void SetRecordSlot(Object record, u64 index, Object value);
+
+// Record types.
+// Allocate a record type with name and field_names, a list of symbols. REFERENCES INVALIDATED
+Object MakeRecordType(Object name, Object field_names, enum ErrorCode *error);
+b64 IsRecordType(Object object);
+Object RecordTypeName(Object type);
+Object RecordTypeFieldNames(Object type);
+u64 RecordTypeNumFields(Object type);
+// Returns false if type has no field named field_name.
+b64 FindRecordField(Object type, Object field_name, u64 *index);
+// True if object is a record of type.
+b64 IsRecordOfType(Object object, Object type);
+
+// Record procedures.
+// Allocate a procedure of kind for type. REFERENCES INVALIDATED
+Object MakeRecordProcedure(enum RecordKind kind, Object type, u64 field, enum ErrorCode *error);
+b64 IsRecordProcedure(Object object);
+enum RecordKind RecordProcedureKind(Object procedure);
+Object RecordProcedureType(Object procedure);
+u64 RecordProcedureField(Object procedure);
+// The number of arguments the procedure takes.
+u64 RecordProcedureArity(Object procedure);
+
+void PrintRecord(Object record);
+
+#endif
@@ -1,35 +1,76 @@
 #include "root.h"
 
 #include <assert.h>
+#include <stdlib.h>
 
+#include "log.h"
 #include "memory.h"
-#include "pair.h"
 #include "symbol_table.h"
-#include "vector.h"
 
 void InitializeRoot(enum ErrorCode *error) {
-  memory.root = AllocateVector(NUM_REGISTERS, error);
+  for (u64 reg = 0; reg < NUM_REGISTERS; ++reg) memory.registers[reg] = nil;
+  memory.stack_size = 0;
+}
+
+void DestroyRoot() {
+  free(memory.stack);
+  memory.stack = 0;
+  memory.stack_size = memory.max_stack_size = 0;
 }
 
 Object GetRegister(enum Register reg) {
-  return UnsafeVectorRef(memory.root, reg); 
+  // The registers are moved at the start of every collection, so they never reference a condemned object.
+  return memory.registers[reg];
 }
 
 void SetRegister(enum Register reg, Object value) {
-  UnsafeVectorSet(memory.root, reg, value); 
+  // The registers are roots of every collection, so stores bypass the write barrier.
+  memory.registers[reg] = value;
 }
 
-void Save(enum Register reg, enum ErrorCode *error) {
-  Object stack = AllocatePair(error);
-  if (*error) return;
-  SetCar(stack, GetRegister(reg));
-  SetCdr(stack, GetRegister(REGISTER_STACK));
-  SetRegister(REGISTER_STACK, stack);
+void Save(enum Register reg, enum ErrorCode *error) { Push(memory.registers[reg], error); }
+void Restore(enum Register reg) { memory.registers[reg] = Pop(); }
+void ClearStack() { memory.stack_size = 0; }
+
+void Push(Object value, enum ErrorCode *error) {
+  if (memory.stack_size == memory.max_stack_size) {
+    // The stack is limited to what the heap could hold, as when the stack was a list of pairs.
+    u64 new_max_stack_size = memory.max_stack_size ? 2*memory.max_stack_size : 256;
+    if (new_max_stack_size > memory.max_space_objects) new_max_stack_size = memory.max_space_objects;
+    Object *new_stack = new_max_stack_size > memory.max_stack_size
+      ? (Object*)realloc(memory.stack, sizeof(Object)*new_max_stack_size)
+      : 0;
+    if (!new_stack) {
+      LOG_ERROR("Could not grow the stack beyond %llu objects", memory.max_stack_size);
+      *error = ERROR_STACK_OVERFLOW;
+      return;
+    }
+    memory.stack = new_stack;
+    memory.max_stack_size = new_max_stack_size;
+  }
+  memory.stack[memory.stack_size++] = value;
+}
+Object Pop() {
+  assert(memory.stack_size > 0);
+  return memory.stack[--memory.stack_size];
 }
-void Restore(enum Register reg) {
-  Object value = Car(GetRegister(REGISTER_STACK));
-  SetRegister(reg, value);
-  SetRegister(REGISTER_STACK, Cdr(GetRegister(REGISTER_STACK)));
+Object StackRef(u64 depth) {
+  assert(depth < memory.stack_size);
+  return memory.stack[memory.stack_size - 1 - depth];
+}
+u64 StackSize() { return memory.stack_size; }
+void SetStackSize(u64 size) {
+  assert(size <= memory.stack_size);
+  memory.stack_size = size;
+}
+
+Object *RegisterRoots(enum Register reg, u64 *num_roots) {
+  if (reg == REGISTER_STACK) {
+    *num_roots = memory.stack_size;
+    return memory.stack;
+  }
+  *num_roots = 1;
+  return &memory.registers[reg];
 }
 
 EvaluateFunction GetContinue() {
@@ -56,3 +97,6 @@ void SetProcedure(Object o) { SetRegister(REGISTER_PROCEDURE, o); }
 
 Object GetArgumentList() { return GetRegister(REGISTER_ARGUMENT_LIST); }
 void SetArgumentList(Object o) { SetRegister(REGISTER_ARGUMENT_LIST, o); }
+
+Object GetScope() { return GetRegister(REGISTER_SCOPE); }
+void SetScope(Object o) { SetRegister(REGISTER_SCOPE, o); }
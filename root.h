@@ -4,10 +4,14 @@
 #include "error.h"
 #include "tag.h"
 
-// At the root of memory is a vector of registers, holding all of the data/references
-// needed for the program.
+// At the root of memory are the registers, holding all of the data/references
+// needed for the program. They are kept in memory.registers, outside of the heap,
+// and every collection moves the objects they reference.
+// Save pushes a register onto the control stack, memory.stack, which is also outside of the heap
+// and is a root of every collection. Save and Restore don't allocate, so they never cause a collection.
 
 void InitializeRoot(enum ErrorCode *error);
+void DestroyRoot();
 
 enum Register {
   // The global symbol table (hash -> symbol)
@@ -18,6 +22,7 @@ enum Register {
   REGISTER_READ_RESULT,
 
   // Registers for evaluation
+  // The saved registers. They are kept on the control stack, rather than in the register itself.
   REGISTER_STACK,
   REGISTER_EXPRESSION,
   REGISTER_VALUE,
@@ -26,6 +31,8 @@ enum Register {
   REGISTER_PROCEDURE,
   REGISTER_UNEVALUATED,
   REGISTER_CONTINUE,
+  // The variables of the frames around the expression being analyzed or compiled (see environment.h).
+  REGISTER_SCOPE,
 
   // Registers for primitives
   // TODO: check if needed/consolidate
@@ -41,8 +48,25 @@ enum Register {
 Object GetRegister(enum Register reg);
 void SetRegister(enum Register reg, Object value);
 
+// Fails with ERROR_STACK_OVERFLOW if the stack can't grow.
 void Save(enum Register reg, enum ErrorCode *error);
 void Restore(enum Register reg);
+// Pop every saved register.
+void ClearStack();
+
+// The bytecode machine (see bytecode.h) keeps its operands and frames on the control stack.
+// Fails with ERROR_STACK_OVERFLOW if the stack can't grow.
+void Push(Object value, enum ErrorCode *error);
+Object Pop();
+// The object depth objects below the top of the stack.
+Object StackRef(u64 depth);
+u64 StackSize();
+// Pop objects until size remain.
+void SetStackSize(u64 size);
+
+// Collector internals.
+// The roots of reg are roots[0, *num_roots). The roots of REGISTER_STACK are the saved registers.
+Object *RegisterRoots(enum Register reg, u64 *num_roots);
 
 EvaluateFunction GetContinue();
 void SetContinue(EvaluateFunction func);
@@ -65,6 +89,9 @@ void SetProcedure(Object procedure);
 Object GetArgumentList();
 void SetArgumentList(Object arguments);
 
+Object GetScope();
+void SetScope(Object scope);
+
 EvaluateFunction GetContinue();
 void SetContinue(EvaluateFunction func);
 
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <stdio.h>
 
+#include "allocation_profiler.h"
 #include "blob.h"
 #include "memory.h"
 
@@ -11,6 +12,7 @@ Object AllocateString(const char *string, enum ErrorCode *error) {
   u64 num_bytes = strlen(string) + 1;
   u64 new_reference = AllocateBlob(num_bytes, error);
   if (*error) return nil;
+  ProfileAllocation(TAG_STRING, NumObjectsPerBlob(num_bytes), __builtin_return_address(0));
 
   memcpy(&memory.the_objects[new_reference + 1], string, num_bytes);
   return BoxString(new_reference);
@@ -10,8 +10,17 @@
 #include "string.h"
 #include "symbol.h"
 #include "vector.h"
+#include "weak_reference.h"
 
-Object InternNewSymbol(u64 index, const u8 *name, enum ErrorCode *error);
+Object InternNewSymbol(u64 index, const u8 *name, b64 is_permanent, enum ErrorCode *error);
+
+// Returns the symbol of an entry in a symbol list, or nil if it has been collected.
+// Entries are either permanent symbols, or weak references to symbols.
+Object EntrySymbol(Object entry);
+// Removes the entries whose symbols have been collected from the symbol list at index.
+void RemoveCollectedSymbols(u64 index);
+// Returns the pair of the symbol list whose entry has the given name, or nil.
+Object FindSymbolEntry(Object symbol_table, u64 index, const u8 *name);
 
 // Returns true if the string object is deep equal the string name
 b64 IsSymbolEqual(Object symbol, const u8 *name);
@@ -54,7 +63,23 @@ Object InternSymbol(const u8 *name, enum ErrorCode *error) {
   if (found != nil)
     return found;
 
-  return InternNewSymbol(index, name, error);
+  RemoveCollectedSymbols(index);
+  return InternNewSymbol(index, name, 0, error);
+}
+
+Object InternPermanentSymbol(const u8 *name, enum ErrorCode *error) {
+  Object symbol_table = GetSymbolTable();
+  u64 index = GetSymbolListIndex(symbol_table, name);
+  Object entry = FindSymbolEntry(symbol_table, index, name);
+  if (entry != nil) {
+    // Replace the weak reference with the symbol itself.
+    Object symbol = EntrySymbol(First(entry));
+    SetCar(entry, symbol);
+    return symbol;
+  }
+
+  RemoveCollectedSymbols(index);
+  return InternNewSymbol(index, name, 1, error);
 }
 
 void UninternSymbol(const u8 *name) {
@@ -69,7 +94,7 @@ void UninternSymbol(const u8 *name) {
 
 // Helpers
 
-Object InternNewSymbol(u64 index, const u8 *name, enum ErrorCode *error) {
+Object InternNewSymbol(u64 index, const u8 *name, b64 is_permanent, enum ErrorCode *error) {
   // Create a new symbol and add it to the symbol list
   Object new_symbols = AllocatePair(error);
   if (*error) return nil;
@@ -79,12 +104,61 @@ Object InternNewSymbol(u64 index, const u8 *name, enum ErrorCode *error) {
   UnsafeVectorSet(GetSymbolTable(), index, new_symbols);
 
   SetCdr(new_symbols, old_symbols);
-  SetCar(new_symbols, AllocateSymbol(name, error));
-  if (*error) return nil;
+  Object symbol = AllocateSymbol(name, error);
+  // REFERENCES INVALIDATED
+  new_symbols = UnsafeVectorRef(GetSymbolTable(), index);
+  if (*error) {
+    UnsafeVectorSet(GetSymbolTable(), index, Cdr(new_symbols));
+    return nil;
+  }
+  SetCar(new_symbols, symbol);
+  if (is_permanent) return symbol;
+
+  // The symbol stays in the symbol list while its weak reference is allocated.
+  Object weak_reference = AllocateWeakReference(error);
   // REFERENCES INVALIDATED
+  new_symbols = UnsafeVectorRef(GetSymbolTable(), index);
+  if (*error) {
+    UnsafeVectorSet(GetSymbolTable(), index, Cdr(new_symbols));
+    return nil;
+  }
+  symbol = First(new_symbols);
+  SetWeakReferenceTarget(weak_reference, symbol);
+  SetCar(new_symbols, weak_reference);
 
   // Return the new symbol.
-  return Car(UnsafeVectorRef(GetSymbolTable(), index));
+  return symbol;
+}
+
+Object EntrySymbol(Object entry) {
+  return IsWeakReference(entry) ? WeakReferenceTarget(entry) : entry;
+}
+
+void RemoveCollectedSymbols(u64 index) {
+  Object symbols = UnsafeVectorRef(GetSymbolTable(), index);
+  while (symbols != nil && EntrySymbol(First(symbols)) == nil) symbols = Rest(symbols);
+  UnsafeVectorSet(GetSymbolTable(), index, symbols);
+  if (symbols == nil) return;
+
+  // prev := (live . rest)
+  for (Object prev = symbols; Rest(prev) != nil;) {
+    if (EntrySymbol(First(Rest(prev))) == nil) {
+      // prev := (live . collected . rest) => (live . rest)
+      SetCdr(prev, Rest(Rest(prev)));
+    } else {
+      prev = Rest(prev);
+    }
+  }
+}
+
+Object FindSymbolEntry(Object symbol_table, u64 index, const u8 *name) {
+  for (Object symbols = UnsafeVectorRef(symbol_table, index);
+      symbols != nil;
+      symbols = Rest(symbols)) {
+    if (IsSymbolEqual(EntrySymbol(First(symbols)), name))
+      return symbols;
+  }
+  return nil;
 }
 
 u64 GetSymbolListIndex(Object symbol_table, const u8 *name) {
@@ -97,7 +171,7 @@ Object RemoveSymbolDestructively(Object symbols, const u8 *name) {
   if (symbols == nil) {
     // CASE: ()
     return nil;
-  } else if (IsSymbolEqual(First(symbols), name)) {
+  } else if (IsSymbolEqual(EntrySymbol(First(symbols)), name)) {
     // CASE: (symbol . rest)
     return Rest(symbols);
   } else {
@@ -114,7 +188,7 @@ Object RemoveSymbolDestructively(Object symbols, const u8 *name) {
       // prev := (x . y . rest)
       // symbols := (y . rest)
 
-      Object symbol = First(symbols);
+      Object symbol = EntrySymbol(First(symbols));
       if (IsSymbolEqual(symbol, name)) {
         // prev := (x . symbol . rest)
         // symbols := (symbol . rest)
@@ -129,17 +203,13 @@ Object RemoveSymbolDestructively(Object symbols, const u8 *name) {
 }
 
 Object FindSymbolInSymbolList(Object symbol_table, u64 index, const u8 *name) {
-  for (Object symbols = UnsafeVectorRef(symbol_table, index);
-      symbols != nil;
-      symbols = Rest(symbols)) {
-    Object symbol = First(symbols);
-    if (IsSymbolEqual(symbol, name))
-      return symbol;
-  }
-  return nil;
+  Object entry = FindSymbolEntry(symbol_table, index, name);
+  return entry == nil ? nil : EntrySymbol(First(entry));
 }
 
 b64 IsSymbolEqual(Object symbol, const u8 *name) {
+  // Collected symbols aren't equal to anything.
+  if (symbol == nil) return 0;
   assert(IsSymbol(symbol));
   return strcmp(StringCharacterBuffer(symbol), name) == 0;
 }
@@ -184,14 +254,33 @@ void TestSymbolTable() {
   DestroyMemory();
   InitializeMemory(128, &error);
   InitializeSymbolTable(1, &error);
-  InternSymbol(symbol_name, &error);
-  InternSymbol("dimple", &error);
-  InternSymbol("pimple", &error);
-  InternSymbol("limp-pole", &error);
+  // The symbols are referenced, so that they stay interned.
+  SetRegister(REGISTER_EXPRESSION, InternSymbol(symbol_name, &error));
+  SetRegister(REGISTER_VALUE, InternSymbol("dimple", &error));
+  SetRegister(REGISTER_ARGUMENT_LIST, InternSymbol("pimple", &error));
+  SetRegister(REGISTER_PROCEDURE, InternSymbol("limp-pole", &error));
   assert(FindSymbol(symbol_name) != nil);
   UninternSymbol("dimple");
   assert(FindSymbol("dimple") == nil);
   assert(FindSymbol(symbol_name) != nil);
   assert(FindSymbol("pimple") != nil);
   DestroyMemory();
+
+  // Symbols which are only referenced by the symbol table are collected, unless they are permanent.
+  InitializeMemory(128, &error);
+  InitializeSymbolTable(1, &error);
+  InternPermanentSymbol("permanent", &error);
+  InternSymbol("collected", &error);
+  SetRegister(REGISTER_EXPRESSION, InternSymbol("referenced", &error));
+  assert(!error);
+  CollectGarbage();
+  assert(FindSymbol("permanent") != nil);
+  assert(FindSymbol("collected") == nil);
+  assert(FindSymbol("referenced") == GetRegister(REGISTER_EXPRESSION));
+  InternSymbol("collected", &error);
+  assert(!error);
+  // Only the 3 live entries are left in the symbol list.
+  Object symbols = UnsafeVectorRef(GetSymbolTable(), 0);
+  assert(IsPair(Rest(Rest(symbols))) && Rest(Rest(Rest(symbols))) == nil);
+  DestroyMemory();
 }
@@ -8,6 +8,11 @@
 // Internally, it is a Vector Object whose elements are Lists of symbols.
 // It is used to uniquely store references to symbols, so that they can be compared
 // for equality by testing to see if the references are equal, instead of a deep equality check.
+//
+// The symbol lists hold weak references to symbols, so a symbol is removed from the table once
+// nothing else references it. Interning the same name afterwards creates a new symbol, which is
+// indistinguishable because no references to the old one remain.
+// Permanent symbols are held strongly, for names which C code looks up with FindSymbol.
 
 // Intialize the global symbol table.
 void InitializeSymbolTable(u64 size, enum ErrorCode *error);
@@ -17,6 +22,8 @@ Object MakeSymbolTable(u64 size, enum ErrorCode *error);
 
 Object FindSymbol(const u8 *name);
 Object InternSymbol(const u8 *name, enum ErrorCode *error);
+// Intern a symbol which stays in the symbol table, even if nothing references it.
+Object InternPermanentSymbol(const u8 *name, enum ErrorCode *error);
 void UninternSymbol(const u8 *name);
 
 void TestSymbolTable();
@@ -102,9 +102,18 @@ b64 IsByteVector(Object object)         { return HasTag(object, TAG_BYTE_VECTOR)
 b64 IsString(Object object)             { return HasTag(object, TAG_STRING); }
 b64 IsSymbol(Object object)             { return HasTag(object, TAG_SYMBOL); }
 b64 IsCompoundProcedure(Object object)  { return HasTag(object, TAG_COMPOUND_PROCEDURE); }
+b64 IsWeakReference(Object object)      { return HasTag(object, TAG_WEAK_REFERENCE); }
+b64 IsFile(Object object)               { return HasTag(object, TAG_FILE); }
+b64 IsRecord(Object object)             { return HasTag(object, TAG_RECORD); }
 b64 IsPrimitiveProcedure(Object object) { return HasTag(object, TAG_PRIMITIVE_PROCEDURE); }
 b64 IsEvaluateFunction(Object object)   { return HasTag(object, TAG_EVALUATE_FUNCTION); }
-b64 IsFilePointer(Object object)        { return HasTag(object, TAG_FILE_POINTER); }
+b64 IsReference(Object object) {
+  if (IsTagged(object)) {
+    enum Tag tag = GetTag(object);
+    return TAG_PAIR <= tag && tag <= TAG_RECORD;
+  }
+  return 0;
+}
 
 Object TagPayload(u64 payload, enum Tag tag) {
   return TAGGED_OBJECT_MASK | SHIFT_LEFT(tag, TAG_SHIFT) | payload;
@@ -122,9 +131,12 @@ Object BoxByteVector(u64 reference)        { return TagPayload(PAYLOAD_MASK & re
 Object BoxString(u64 reference)            { return TagPayload(PAYLOAD_MASK & reference, TAG_STRING); }
 Object BoxSymbol(u64 reference)            { return TagPayload(PAYLOAD_MASK & reference, TAG_SYMBOL); }
 Object BoxCompoundProcedure(u64 reference) { return TagPayload(PAYLOAD_MASK & reference, TAG_COMPOUND_PROCEDURE); }
+Object BoxWeakReference(u64 reference)     { return TagPayload(PAYLOAD_MASK & reference, TAG_WEAK_REFERENCE); }
+Object BoxFile(u64 reference)              { return TagPayload(PAYLOAD_MASK & reference, TAG_FILE); }
+Object BoxRecord(u64 reference)            { return TagPayload(PAYLOAD_MASK & reference, TAG_RECORD); }
 
 Object BoxReal64(real64 value)       { return Real64ToU64(value); }
-Object BoxBrokenHeart(u64 reference) { return TagPayload(reference, TAG_BROKEN_HEART); }
+Object BoxBrokenHeart(u64 reference) { return TagPayload(PAYLOAD_MASK & reference, TAG_BROKEN_HEART); }
 Object BoxBlobHeader(u64 num_bytes)  { return TagPayload(num_bytes, TAG_BLOB_HEADER); }
 Object BoxPrimitiveProcedure(PrimitiveFunction function) {
   u64 address = (u64)function;
@@ -135,9 +147,6 @@ Object BoxPrimitiveProcedure(PrimitiveFunction function) {
 Object BoxEvaluateFunction(EvaluateFunction function) {
   return BoxPrimitiveProcedure((PrimitiveFunction)function);
 }
-Object BoxFilePointer(FILE *file) {
-  return BoxPrimitiveProcedure((PrimitiveFunction)file);
-}
 
 s64 UnboxFixnum(Object object) {
   u64 sign_bit_mask = SHIFT_LEFT(1, TAG_SHIFT-1); 
@@ -159,15 +168,13 @@ PrimitiveFunction UnboxPrimitiveProcedure(Object object) {
 EvaluateFunction UnboxEvaluateFunction(Object object) {
   return (EvaluateFunction)(PAYLOAD_MASK & object);
 }
-FILE *UnboxFilePointer(Object object) {
-  return (FILE *)(PAYLOAD_MASK & object);
-}
 
 // Just for testing.
 s64 TwosComplement(u64 value) { return (s64)(~value + 1); }
 
 void TestTag() {
-  assert(NUM_TAGS < 16);
+  // Tags are 4 bits.
+  assert(NUM_TAGS <= 16);
 
   assert(-1 == UnboxFixnum(BoxFixnum(-1)));
   assert(               SHIFT_LEFT(1, TAG_SHIFT-1) - 1 == UnboxFixnum(BoxFixnum(SHIFT_LEFT(1, TAG_SHIFT-1) - 1)));
@@ -177,6 +184,10 @@ void TestTag() {
   assert(!UnboxBoolean(BoxBoolean(1 != 1)));
 
   assert(IsPair(BoxPair(42)));
+  assert(IsReference(BoxPair(42)));
+  assert(IsReference(BoxRecord(42)));
+  assert(!IsReference(BoxBlobHeader(42)));
+  assert(!IsReference(BoxFixnum(42)));
   assert(IsBoolean(BoxBoolean(1)));
 
   assert(!IsBoolean(BoxReal64(3.14159)));
@@ -34,7 +34,6 @@ enum Tag {
   TAG_FIXNUM, // Fixnum is a 47-bit signed integer
   TAG_PRIMITIVE_PROCEDURE, // An object holding a PrimitiveFunction
   TAG_EVALUATE_FUNCTION = TAG_PRIMITIVE_PROCEDURE, // An object holding an EvaluateFunction
-  TAG_FILE_POINTER = TAG_PRIMITIVE_PROCEDURE, // An object holding a FILE*
 
   // Reference Types (Payloads are indices into memory vectors)
   TAG_PAIR, // Pair consists of two Objects
@@ -42,13 +41,15 @@ enum Tag {
   TAG_BYTE_VECTOR, // Byte vector consists of a length N, followed by at least N bytes
   TAG_STRING, // String consists of a length N, followed by at least N+1 bytes. String is 0-terminated
   TAG_SYMBOL, // Symbol is a string with a different tag.
-  TAG_COMPOUND_PROCEDURE, // Compound procedure consists of 3 Objects
+  TAG_COMPOUND_PROCEDURE, // Compound procedure consists of 4 Objects
+  TAG_WEAK_REFERENCE, // Weak reference is a blob holding an Object which it doesn't keep alive
+  TAG_FILE, // File is a blob holding a FILE*, which is closed once the file is collected
+  TAG_RECORD, // Record consists of a length N+1, followed by its type and N slots
 
   // GC Types (Types not directly accessible)
   TAG_BROKEN_HEART, // Used to annotate referenced objects that have been moved during garbage collection.
   TAG_BLOB_HEADER, // Stores an unsigned integer which stores the size of the blob in bytes
 
-  // TODO: User defined tags (e.g. boxed references)
   // TODO: Big integers
 
   NUM_TAGS,
@@ -78,7 +79,11 @@ b64 IsSymbol(Object object);
 b64 IsPrimitiveProcedure(Object object);
 b64 IsEvaluateFunction(Object object);
 b64 IsCompoundProcedure(Object object);
-b64 IsFilePointer(Object object);
+b64 IsWeakReference(Object object);
+b64 IsFile(Object object);
+b64 IsRecord(Object object);
+// True if the object's payload is an index into memory.
+b64 IsReference(Object object);
 
 // Construct boxed values given native C types
 Object BoxFixnum(s64 fixnum); // Truncates to 47 bits
@@ -86,7 +91,6 @@ Object BoxBoolean(b64 boolean);
 Object BoxReal64(real64 value);
 Object BoxPrimitiveProcedure(PrimitiveFunction proc);
 Object BoxEvaluateFunction(EvaluateFunction func);
-Object BoxFilePointer(FILE *file);
 // Construct referential data structures. References are indices.
 Object BoxPair(u64 reference);
 Object BoxVector(u64 reference);
@@ -94,6 +98,9 @@ Object BoxByteVector(u64 reference);
 Object BoxString(u64 reference);
 Object BoxSymbol(u64 reference);
 Object BoxCompoundProcedure(u64 reference);
+Object BoxWeakReference(u64 reference);
+Object BoxFile(u64 reference);
+Object BoxRecord(u64 reference);
 // Box GC Types
 Object BoxBrokenHeart(u64 reference);
 Object BoxBlobHeader(u64 num_bytes);
@@ -111,7 +118,6 @@ b64    UnboxBoolean(Object object);
 real64 UnboxReal64(Object object);
 PrimitiveFunction UnboxPrimitiveProcedure(Object object);
 EvaluateFunction UnboxEvaluateFunction(Object object);
-FILE *UnboxFilePointer(Object object);
 // Unbox Pair, Vector, Byte Vector, String, Symbol
 u64 UnboxReference(Object object);
 // Unbox GC Types
@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "evaluate.h"
 #include "memory.h"
 #include "tag.h"
@@ -5,6 +7,11 @@
 #include "symbol_table.h"
 
 int main(int argc, char **argv) {
+  if (argc > 1 && !strcmp(argv[1], "benchmark")) {
+    BenchmarkMemory();
+    BenchmarkEvaluate();
+    return 0;
+  }
   TestTag();
   TestMemory();
   TestSymbolTable();
@@ -0,0 +1,87 @@
+#include "type_descriptor.h"
+
+#include <stdio.h>
+
+#include "blob.h"
+#include "byte_vector.h"
+#include "compound_procedure.h"
+#include "file.h"
+#include "memory.h"
+#include "pair.h"
+#include "record.h"
+#include "string.h"
+#include "symbol.h"
+#include "vector.h"
+#include "weak_reference.h"
+
+static void PrintNil(Object object);
+static void PrintTrue(Object object);
+static void PrintFalse(Object object);
+static void PrintFixnum(Object object);
+static void PrintPrimitiveProcedure(Object object);
+
+static const struct TypeDescriptor type_descriptors[NUM_TAGS] = {
+  // Tag-only types
+  [TAG_NIL]   = {"nil",   0, LAYOUT_IMMEDIATE, 0, 0, PrintNil},
+  [TAG_TRUE]  = {"true",  0, LAYOUT_IMMEDIATE, 0, 0, PrintTrue},
+  [TAG_FALSE] = {"false", 0, LAYOUT_IMMEDIATE, 0, 0, PrintFalse},
+
+  // Primitive Types
+  [TAG_FIXNUM]              = {"fixnum",              0, LAYOUT_IMMEDIATE, 0, 0, PrintFixnum},
+  [TAG_PRIMITIVE_PROCEDURE] = {"primitive-procedure", 0, LAYOUT_IMMEDIATE, 0, 0, PrintPrimitiveProcedure},
+
+  // Reference Types
+  [TAG_PAIR]               = {"pair",               "Pair",              LAYOUT_SLOTS,         2, MoveList,              PrintPair},
+  [TAG_VECTOR]             = {"vector",             "Vector",            LAYOUT_COUNTED_SLOTS, 0, MoveVector,            PrintVector},
+  [TAG_BYTE_VECTOR]        = {"byte-vector",        "ByteVector",        LAYOUT_BLOB,          0, MoveByteVector,        PrintByteVector},
+  [TAG_STRING]             = {"string",             "String",            LAYOUT_BLOB,          0, MoveString,            PrintString},
+  [TAG_SYMBOL]             = {"symbol",             "Symbol",            LAYOUT_BLOB,          0, MoveSymbol,            PrintSymbol},
+  [TAG_COMPOUND_PROCEDURE] = {"compound-procedure", "CompoundProcedure", LAYOUT_SLOTS,         4, MoveCompoundProcedure, PrintCompoundProcedure},
+  [TAG_WEAK_REFERENCE]     = {"weak-reference",     "WeakReference",     LAYOUT_BLOB,          0, MoveWeakReference,     PrintWeakReference},
+  [TAG_FILE]               = {"file",               "File",              LAYOUT_BLOB,          0, MoveFile,              PrintFile},
+  [TAG_RECORD]             = {"record",             "Record",            LAYOUT_COUNTED_SLOTS, 0, MoveRecord,            PrintRecord},
+
+  // GC Types
+  [TAG_BROKEN_HEART] = {0, 0, LAYOUT_IMMEDIATE, 0, 0, 0},
+  [TAG_BLOB_HEADER]  = {0, 0, LAYOUT_IMMEDIATE, 0, 0, 0},
+};
+
+const struct TypeDescriptor *TypeDescriptorOf(enum Tag tag) { return &type_descriptors[tag]; }
+
+u64 ObjectSize(Object object) {
+  u64 reference = UnboxReference(object);
+  const struct TypeDescriptor *descriptor = TypeDescriptorOf(GetTag(object));
+  switch (descriptor->layout) {
+    case LAYOUT_IMMEDIATE:     return 0;
+    case LAYOUT_SLOTS:         return descriptor->num_slots;
+    case LAYOUT_COUNTED_SLOTS: return 1 + UnboxFixnum(memory.the_objects[reference]);
+    case LAYOUT_BLOB:          return NumObjectsPerBlob(UnboxBlobHeader(memory.the_objects[reference]));
+  }
+  return 0;
+}
+
+void ReferenceSlots(Object object, u64 *start, u64 *end) {
+  u64 reference = UnboxReference(object);
+  const struct TypeDescriptor *descriptor = TypeDescriptorOf(GetTag(object));
+  switch (descriptor->layout) {
+    case LAYOUT_SLOTS:
+      *start = reference;
+      *end = reference + descriptor->num_slots;
+      return;
+    case LAYOUT_COUNTED_SLOTS:
+      // The length isn't a reference.
+      *start = reference + 1;
+      *end = *start + UnboxFixnum(memory.the_objects[reference]);
+      return;
+    case LAYOUT_IMMEDIATE:
+    case LAYOUT_BLOB:
+      *start = *end = 0;
+      return;
+  }
+}
+
+static void PrintNil(Object object)   { printf("nil"); }
+static void PrintTrue(Object object)  { printf("#t"); }
+static void PrintFalse(Object object) { printf("#f"); }
+static void PrintFixnum(Object object) { printf("%lld", (long long)UnboxFixnum(object)); }
+static void PrintPrimitiveProcedure(Object object) { printf("<procedure %p>", (void*)UnboxPrimitiveProcedure(object)); }
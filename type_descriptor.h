@@ -0,0 +1,43 @@
+#ifndef TYPE_DESCRIPTOR_H
+#define TYPE_DESCRIPTOR_H
+
+#include "tag.h"
+
+// Each tag is described by a TypeDescriptor: its name, how it is laid out in memory, and how it is moved and printed.
+// The collectors and the printer look the descriptor up by tag instead of switching on it,
+// so a new type of heap object is added by adding its descriptor to the table in type_descriptor.c.
+
+enum SlotLayout {
+  // Tag-only and immediate objects don't occupy memory.
+  LAYOUT_IMMEDIATE,
+  // num_slots Objects, any of which may be a reference. e.g. Pair: [ ..., car, cdr, ... ]
+  LAYOUT_SLOTS,
+  // A fixnum N followed by N Objects. e.g. Vector: [ ..., N, Object0, .., ObjectN, ... ]
+  LAYOUT_COUNTED_SLOTS,
+  // A blob header followed by bytes, which don't hold references. e.g. String, Symbol
+  LAYOUT_BLOB,
+};
+
+struct TypeDescriptor {
+  // The name of the type, used by the allocation profile and the heap census. e.g. "byte-vector"
+  const char *name;
+  // The name printed for a reference to the type. e.g. <ByteVector 42>
+  const char *reference_name;
+  enum SlotLayout layout;
+  // The size of a LAYOUT_SLOTS object.
+  u64 num_slots;
+  // Move a condemned object to the to-space, and return the moved object.
+  Object (*move)(Object object);
+  // Print the object, following references.
+  void (*print)(Object object);
+};
+
+// Returns the descriptor of tag. Collector-only tags (broken hearts, blob headers) have no name, move or print.
+const struct TypeDescriptor *TypeDescriptorOf(enum Tag tag);
+
+// The number of Objects occupied by the referenced object.
+u64 ObjectSize(Object object);
+// The Objects of the referenced object which may hold references are [*start, *end). Empty if there aren't any.
+void ReferenceSlots(Object object, u64 *start, u64 *end);
+
+#endif
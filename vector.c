@@ -2,24 +2,23 @@
 
 #include <assert.h>
 #include <stdio.h>
-#include <string.h>
 
+#include "allocation_profiler.h"
 #include "log.h"
 #include "memory.h"
 
 Object AllocateVector(u64 num_objects, enum ErrorCode *error) {
-  EnsureEnoughMemory(num_objects + 1, error);
+  u64 new_reference = AllocateObjects(num_objects + 1, error);
   if (*error) {
     LOG_ERROR("Not enough memory to allocate vector of size %llu. %s", num_objects);
     return nil;
   }
+  ProfileAllocation(TAG_VECTOR, num_objects + 1, __builtin_return_address(0));
   // [ ..., free.. ]
-  u64 new_reference = memory.free;
 
-  memory.the_objects[memory.free++] = BoxFixnum(num_objects);
+  memory.the_objects[new_reference] = BoxFixnum(num_objects);
   for (int i = 0; i < num_objects; ++i)
-    memory.the_objects[memory.free++] = nil;
-  memory.num_objects_allocated += num_objects + 1;
+    memory.the_objects[new_reference+1 + i] = nil;
   // [ ..., nObjects, Object0, ..., ObjectN, free.. ]
 
   return BoxVector(new_reference);
@@ -30,10 +29,8 @@ Object MoveVector(Object vector) {
   // New: [ ..., free... ]
   // Old: [ ..., nObjects, Object0, ... ObjectN, ... ] OR
   //      [ ..., <BH new>, ... ]
-  u64 new_reference = memory.free;
-
-  LOG(LOG_MEMORY, "moving from %llu in the_objects to %llu in new_objects\n", ref, new_reference);
-  Object old_header = memory.the_objects[ref];
+  LOG(LOG_MEMORY, "moving from %llu\n", ref);
+  Object old_header = LoadHeader(ref);
 
   if (IsBrokenHeart(old_header)) {
     // Already been moved
@@ -49,13 +46,10 @@ Object MoveVector(Object vector) {
   u64 num_objects = 1 + UnboxFixnum(old_header);
   LOG(LOG_MEMORY, "moving vector of size %llu objects (including header)\n", num_objects);
 
-  memcpy(&memory.new_objects[memory.free], &memory.the_objects[ref], num_objects*sizeof(Object));
-  memory.free += num_objects;
+  u64 new_reference = MoveObjects(ref, old_header, num_objects);
   // New: [ ..., nObjects, Object0, ... ObjectN, free.. ]
-
-  LOG(LOG_MEMORY, "Leaving a broken heart pointing at %llu in its place\n", new_reference);
-  memory.the_objects[ref] = BoxBrokenHeart(new_reference);
   // Old: [ ..., <BH new>, ... ]
+  LOG(LOG_MEMORY, "Left a broken heart pointing at %llu in its place\n", new_reference);
 
   return BoxVector(new_reference);
 }
@@ -67,22 +61,22 @@ s64 UnsafeVectorLength(Object vector) {
 Object UnsafeVectorRef(Object vector, u64 index) {
   assert(IsVector(vector));
   assert(index < UnsafeVectorLength(vector));
-  return memory.the_objects[UnboxReference(vector)+1 + index];
+  return ReadBarrier(UnboxReference(vector)+1 + index);
 }
 void UnsafeVectorSet(Object vector, u64 index, Object value) {
   assert(IsVector(vector));
   assert(index < UnsafeVectorLength(vector));
+  WriteBarrier(UnboxReference(vector)+1 + index, value);
   memory.the_objects[UnboxReference(vector)+1 + index] = value;
 }
 
 void PrintVector(Object vector) {
   assert(IsVector(vector));
-  u64 reference = UnboxReference(vector);
-  u64 length = UnboxFixnum(memory.the_objects[reference]);
+  u64 length = UnsafeVectorLength(vector);
   printf("(vector");
   for (u64 index = 0; index < length; ++index) {
     printf(" ");
-    PrintObject(memory.the_objects[reference+1 + index]);
+    PrintObject(UnsafeVectorRef(vector, index));
   }
   printf(")");
 }
@@ -14,6 +14,7 @@ Object MoveVector(Object vector);
 
 s64 UnsafeVectorLength(Object vector);
 Object UnsafeVectorRef(Object vector, u64 index);
+// Passes through the write barrier.
 void UnsafeVectorSet(Object vector, u64 index, Object value);
 
 void PrintVector(Object vector);
@@ -0,0 +1,91 @@
+#include "weak_reference.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "allocation_profiler.h"
+#include "blob.h"
+#include "log.h"
+#include "mark_compact.h"
+#include "memory.h"
+
+// The references of every weak reference which may still be alive.
+static u64 *weak_references;
+static u64 num_weak_references;
+static u64 max_weak_references;
+
+// Record the weak reference at reference. Returns false if the table couldn't grow.
+static b64 RecordWeakReference(u64 reference);
+
+Object AllocateWeakReference(enum ErrorCode *error) {
+  u64 new_reference = AllocateBlob(sizeof(Object), error);
+  if (*error) return nil;
+  ProfileAllocation(TAG_WEAK_REFERENCE, NumObjectsPerBlob(sizeof(Object)), __builtin_return_address(0));
+  // [ ..., 8, free.. ]
+  memory.the_objects[new_reference + 1] = nil;
+  // [ ..., 8, target, free.. ]
+  if (!RecordWeakReference(new_reference)) {
+    *error = ERROR_COULD_NOT_ALLOCATE_HEAP_BUFFER;
+    return nil;
+  }
+  return BoxWeakReference(new_reference);
+}
+
+Object MoveWeakReference(Object weak_reference) {
+  return BoxWeakReference(MoveBlob(UnboxReference(weak_reference)));
+}
+
+Object WeakReferenceTarget(Object weak_reference) {
+  assert(IsWeakReference(weak_reference));
+  // The target isn't scanned, so it may still be condemned during an incremental collection.
+  return ReadBarrier(UnboxReference(weak_reference) + 1);
+}
+
+void SetWeakReferenceTarget(Object weak_reference, Object target) {
+  assert(IsWeakReference(weak_reference));
+  memory.the_objects[UnboxReference(weak_reference) + 1] = target;
+}
+
+void PrintWeakReference(Object weak_reference) {
+  printf("(weak-reference ");
+  PrintObject(WeakReferenceTarget(weak_reference));
+  printf(")");
+}
+
+void UpdateWeakReferences() {
+  u64 num_kept = 0;
+  for (u64 i = 0; i < num_weak_references; ++i) {
+    u64 reference = weak_references[i];
+    Object weak_reference = SurvivingObject(BoxWeakReference(reference));
+    if (IsNil(weak_reference)) continue;
+    // The mark-compact collector updates objects before they slide to their new references.
+    u64 target = (IsCompacting() ? reference : UnboxReference(weak_reference)) + 1;
+    memory.the_objects[target] = SurvivingObject(memory.the_objects[target]);
+    weak_references[num_kept++] = UnboxReference(weak_reference);
+  }
+  LOG(LOG_MEMORY, "%llu of %llu weak references survived\n", num_kept, num_weak_references);
+  num_weak_references = num_kept;
+}
+
+void DestroyWeakReferences() {
+  free(weak_references);
+  weak_references = 0;
+  num_weak_references = 0;
+  max_weak_references = 0;
+}
+
+static b64 RecordWeakReference(u64 reference) {
+  if (num_weak_references == max_weak_references) {
+    u64 new_max_weak_references = max_weak_references ? 2*max_weak_references : 64;
+    u64 *new_weak_references = (u64*)realloc(weak_references, sizeof(u64)*new_max_weak_references);
+    if (!new_weak_references) {
+      LOG_ERROR("Could not grow the weak reference table to %llu references", new_max_weak_references);
+      return 0;
+    }
+    weak_references = new_weak_references;
+    max_weak_references = new_max_weak_references;
+  }
+  weak_references[num_weak_references++] = reference;
+  return 1;
+}
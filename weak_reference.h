@@ -0,0 +1,33 @@
+#ifndef WEAK_REFERENCE_H
+#define WEAK_REFERENCE_H
+
+#include "error.h"
+#include "tag.h"
+
+// A weak reference refers to a target object without keeping it alive.
+// Once the target is no longer reachable from the root (except through weak references),
+// the next collection which condemns it sets the target of the weak reference to nil.
+//
+// A weak reference is implemented as a Blob holding the target: [ 8, target ]
+// so collections copy the target along with the weak reference, but never scan it.
+// Every weak reference is recorded in a table. At the end of each collection, the table is used to
+// update the targets which moved, to clear the targets which died, and to forget the weak references which died.
+// Stores into weak references don't need to pass through the write barrier.
+
+// Allocate a weak reference with a target of nil.
+Object AllocateWeakReference(enum ErrorCode *error);
+Object MoveWeakReference(Object weak_reference);
+
+// Returns the target of weak_reference, or nil if it has been collected.
+Object WeakReferenceTarget(Object weak_reference);
+void SetWeakReferenceTarget(Object weak_reference, Object target);
+
+void PrintWeakReference(Object weak_reference);
+
+// Collector internals.
+// Update the recorded weak references, once every reachable object has been moved.
+void UpdateWeakReferences();
+// Forget every weak reference.
+void DestroyWeakReferences();
+
+#endif